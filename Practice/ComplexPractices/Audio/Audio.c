@@ -1,246 +1,256 @@
-#define MINIAUDIO_IMPLEMENTATION
-#include "miniaudio.h"
-#include <dirent.h>
+#include "player.h"
+#include "library.h"
+#include "metrics.h"
+#include "playlist.h"
+#include <locale.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+void print_track_stats(MiniaudioPlayer* player, const PlayerStatus* status) {
+    PlayerDeviceInfo device;
+    const TrackFormat* format = &status->format;
+
+    player_get_device_info(player, &device);
+    printf("\r  source %s %uch %u Hz -> device %s %uch %u Hz | decoder: %s%s%s | backend: %s%s%s\n",
+           player_format_name(format->source_format), format->source_channels, format->source_rate,
+           player_format_name(device.format), device.channels, device.sample_rate,
+           format->converted ? "convert " : "", format->resampled ? "resample" : "",
+           (format->converted || format->resampled) ? "" : "passthrough",
+           device.converted ? "convert " : "", device.resampled ? "resample" : "",
+           (device.converted || device.resampled) ? "" : "passthrough");
+}
 
-typedef struct
-{
-    ma_decoder decoder;
-    ma_bool32 is_active;
-    char filepath[512];
-} AudioTrack;
+void print_latency_report(MiniaudioPlayer* player, const LoadSample* from) {
+    PlayerDeviceInfo device;
+    LoadSample now;
+    LoadStats load;
 
-typedef struct
-{
-    AudioTrack current;
-    AudioTrack next;
-    ma_device device;
-    char** playlist;
-    int playlist_count;
-    int current_index;
-    ma_bool32 auto_advance;
-} MiniaudioPlayer;
-
-const char* get_filename(const char* filepath) {
-    const char* filename = strrchr(filepath, '/');
-    if (filename == NULL) {
-        return filepath;
-    }
-    return filename + 1;
-}
+    player_get_device_info(player, &device);
+    player_load_sample(player, &now);
+    player_load_stats(player, from, &now, &load);
 
-void data_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount) {
-    MiniaudioPlayer* player = (MiniaudioPlayer*)pDevice->pUserData;
+    printf("\rLatency %s: period %u frames (%.1f ms), %.1f wakeups/s (%.1f idle), CPU %.1f%% over %.1f s%s\n",
+           player_latency_name(device.latency), load.period_frames, load.period_ms,
+           load.wakeups_per_sec, load.idle_wakeups_per_sec, load.cpu_percent, now.wall - from->wall,
+           device.lost ? ", device lost" : device.suspended ? ", device suspended" : "");
+}
 
-    if (!player->current.is_active) {
-        // Silence if nothing playing
-        memset(pOutput, 0, frameCount * ma_get_bytes_per_frame(pDevice->playback.format, pDevice->playback.channels));
-        return;
-    }
-    
-    // Read from current decoder
-    ma_uint64 framesRead = 0;
-    ma_decoder_read_pcm_frames(&player->current.decoder, pOutput, frameCount, &framesRead);
-    
-    if (framesRead < frameCount) {
-        // Fill rest with silence
-        size_t bytesPerFrame = ma_get_bytes_per_frame(pDevice->playback.format, pDevice->playback.channels);
-        memset((unsigned char*)pOutput + (framesRead * bytesPerFrame), 0, 
-               (frameCount - framesRead) * bytesPerFrame);
-        
-        // Auto-advance to next track if enabled
-        if (player->auto_advance && player->next.is_active) {
-            ma_decoder_uninit(&player->current.decoder);
-            player->current = player->next;
-            player->next.is_active = MA_FALSE;
-            player->current_index++;
-            
-            printf("\rNow playing: %s\n", get_filename(player->current.filepath));
-
-            // Pre-load the next track
-            if (player->current_index + 1 < player->playlist_count) {
-                strcpy(player->next.filepath, player->playlist[player->current_index + 1]);
-                if (ma_decoder_init_file(player->next.filepath, NULL, &player->next.decoder) == MA_SUCCESS) {
-                    player->next.is_active = MA_TRUE;
-                    printf("Preloaded: %s", get_filename(player->next.filepath));
-                    fflush(stdout);
-                }
+int main(int argc, char** argv)
+{
+    MiniaudioPlayer* player;
+    PlayerStatus status;
+    char lastPlayed[512] = "";
+    PlayerAdaptation adaptations[PLAYER_ADAPT_LOG];
+    ma_uint64 lastAdaptation = 0;
+    PlayerFormatMode formatMode = PLAYER_FORMAT_FIXED;
+    PlayerLatencyProfile latency = PLAYER_LATENCY_BALANCED;
+    LoadSample loadFrom;
+    char line[64];
+    const char* renderPath = NULL;
+    const char* music_dir = "/Users/hpapez27/Desktop/Musikk/TermusicFiles/Pink_Floyd_-_The_Dark_Side_of_the_Moon";
+    char **entries = NULL;
+    char **files = NULL;
+    int entry_count;
+    int file_count = 0;
+    int i;
+    const char* metricsAddress = NULL;
+    MetricsExporter exporter;
+    int exporting = 0;
+    int prefetchDepth = -1;
+    double prefetchMegabytes = PLAYER_PREFETCH_BUDGET / 1048576.0;
+    const char* playlistPath = NULL;
+    PlaylistLoader loader;
+
+    setlocale(LC_COLLATE, "");
+    setlocale(LC_CTYPE, "");
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--native") == 0) {
+            formatMode = PLAYER_FORMAT_NATIVE;
+        } else if (strcmp(argv[i], "--bitperfect") == 0) {
+            formatMode = PLAYER_FORMAT_BITPERFECT;
+        } else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+            if (player_parse_latency(argv[++i], &latency) != 0) {
+                printf("Unknown latency profile: %s (low, balanced, powersave)\n", argv[i]);
+                return 1;
             }
-        } else {
-            player->current.is_active = MA_FALSE;
+        } else if (strcmp(argv[i], "--render") == 0 && i + 1 < argc) {
+            renderPath = argv[++i];
+        } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            music_dir = argv[++i];
+        } else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+            metricsAddress = argv[++i];
+        } else if (strcmp(argv[i], "--prefetch") == 0 && i + 1 < argc) {
+            sscanf(argv[++i], "%d:%lf", &prefetchDepth, &prefetchMegabytes);
+        } else if (strcmp(argv[i], "--playlist") == 0 && i + 1 < argc) {
+            playlistPath = argv[++i];
         }
     }
-    
-    (void)pInput;
-}
 
-int player_init(MiniaudioPlayer* player)
-{
-    memset(player, 0, sizeof(MiniaudioPlayer));
-
-    ma_device_config config = ma_device_config_init(ma_device_type_playback);
-    config.playback.format = ma_format_f32;
-    config.playback.channels = 2;
-    config.sampleRate = 48000;
-    config.dataCallback = data_callback;
-    config.pUserData = player;
+    memset(&loader, 0, sizeof(loader));
+    if (playlistPath != NULL && renderPath != NULL)
+    {
+        // A render needs the whole queue before it starts.
+        PlaylistReader reader;
+        char path[1024];
 
-    if (ma_device_init(NULL, &config, &player->device) != MA_SUCCESS) {
-        printf("\rFailed to initialize playback device.\n");
-        return -1;
+        if (playlist_open(&reader, playlistPath) != 0)
+        {
+            printf("Cannot read playlist %s\n", playlistPath);
+            return 1;
+        }
+        while (playlist_next(&reader, path, sizeof(path)))
+        {
+            files = realloc(files, sizeof(char *) * (file_count + 1));
+            files[file_count++] = strdup(path);
+        }
+        playlist_close(&reader);
     }
 
-    if (ma_device_start(&player->device) != MA_SUCCESS) {
-        printf("\rFailed to start playback device.\n");
-        ma_device_uninit(&player->device);
+    entry_count = playlistPath != NULL ? 0 : library_list_directory(music_dir, &entries);
+    if (entry_count < 0)
+    {
+        printf("No such directory.");
         return -1;
     }
-    
-    return 0;
-}
 
-int player_play_file(MiniaudioPlayer* player, const char* filepath)
-{
-    if (player->current.is_active)
+    for (i = 0; i < entry_count; i++)
     {
-        ma_decoder_uninit(&player->current.decoder);
-    }
+        if (!is_audio_file(entries[i]))
+            continue;
 
-    strcpy(player->current.filepath, filepath);
-    if (ma_decoder_init_file(filepath, NULL, &player->current.decoder) != MA_SUCCESS)
-    {
-        printf("\rFailed to load file: %s\n", filepath);
-        player->current.is_active = MA_FALSE;
-        return -1;
+        files = realloc(files, sizeof(char *) * (file_count + 1));
+        
+        // Allocate space for full path
+        size_t path_len = strlen(music_dir) + strlen(entries[i]) + 2;
+        files[file_count] = malloc(path_len);
+        snprintf(files[file_count], path_len, "%s/%s", music_dir, entries[i]);
+        
+        file_count++;
     }
+    library_free_list(entries, entry_count);
 
-    player->current.is_active = MA_TRUE;
-    player->auto_advance = MA_FALSE;
-    printf("\rNow playing: %s\n", get_filename(filepath));
-
-    return 0;
-}
-
-int player_play_playlist(MiniaudioPlayer* player, char** files, int count)
-{
-    if (count == 0) return -1;
-
-    player->playlist = files;
-    player->playlist_count = count;
-    player->current_index = 0;
-    player->auto_advance = MA_TRUE;
-
-    if (player_play_file(player, files[0]) != 0) return -1;
+    if (renderPath != NULL)
+    {
+        RenderStats stats;
+        int result = 1;
 
-    player->auto_advance = MA_TRUE;
+        player = player_create_offline(ma_format_f32, 2, 48000);
+        if (player != NULL && player_play_playlist(player, files, file_count) == 0 &&
+            player_render(player, renderPath, &stats) == 0)
+        {
+            printf("Rendered %d tracks, %llu frames (%.1f s of audio) in %.3f s: %.1fx realtime\n",
+                   file_count, (unsigned long long)stats.frames, (double)stats.frames / 48000,
+                   stats.seconds, stats.realtime_factor);
+            result = 0;
+        }
+        else
+        {
+            printf("Render failed.\n");
+        }
 
-    if (count > 1)
-    {
-        strcpy(player->next.filepath, files[1]);
-        if (ma_decoder_init_file(files[1], NULL, &player->next.decoder) == MA_SUCCESS)
+        if (player != NULL)
+            player_destroy(player);
+        for (i = 0; i < file_count; i++)
         {
-            player->next.is_active = MA_TRUE;
-            printf("\rPreloaded: %s", get_filename(files[1]));
-            fflush(stdout);
+            free(files[i]);
         }
+        free(files);
+        return result;
     }
 
-    return 0;
-}
-
-int player_stop(MiniaudioPlayer* player)
-{
-    if (player->current.is_active) {
-        ma_decoder_uninit(&player->current.decoder);
-        player->current.is_active = MA_FALSE;
+    player = player_create(formatMode, latency);
+    if (player == NULL)
+    {
+        printf("\rFailed to initialize playback device.\n");
+        return 1;
     }
-    if (player->next.is_active) {
-        ma_decoder_uninit(&player->next.decoder);
-        player->next.is_active = MA_FALSE;
+    if (prefetchDepth >= 0) {
+        player_set_prefetch(player, prefetchDepth, (size_t)(prefetchMegabytes * 1048576));
     }
 
-    return 0;
-}
-
-void player_cleanup(MiniaudioPlayer* player)
-{
-    player_stop(player);
-    ma_device_uninit(&player->device);
-}
-
-int compare_strings(const void* a, const void* b) {
-    return strcmp(*(const char**)a, *(const char**)b);
-}
-
-int is_audio_file(const char* filename) {
-    const char* ext = strrchr(filename, '.');
-    if (ext == NULL) return 0;
-    
-    // Check for common audio extensions
-    return (strcmp(ext, ".mp3") == 0 ||
-            strcmp(ext, ".MP3") == 0 ||
-            strcmp(ext, ".wav") == 0 ||
-            strcmp(ext, ".WAV") == 0 ||
-            strcmp(ext, ".flac") == 0 ||
-            strcmp(ext, ".FLAC") == 0 ||
-            strcmp(ext, ".ogg") == 0 ||
-            strcmp(ext, ".OGG") == 0 ||
-            strcmp(ext, ".m4a") == 0 ||
-            strcmp(ext, ".M4A") == 0);
-}
-
-int main()
-{
-    MiniaudioPlayer player;
-    DIR *dir;
-    struct dirent *entry;
-    char **files = NULL;
-    int file_count = 0;
-    int i;
-
-    const char* music_dir = "/Users/hpapez27/Desktop/Musikk/TermusicFiles/Pink_Floyd_-_The_Dark_Side_of_the_Moon";
+    if (metricsAddress != NULL) {
+        exporting = metrics_exporter_start(&exporter, metricsAddress, player) == 0;
+        if (!exporting) {
+            printf("Cannot serve metrics on %s\n", metricsAddress);
+        }
+    }
 
-    dir = opendir(music_dir);
-    if (dir == NULL)
+    printf("Type a latency profile (low, balanced, powersave) to switch, pause to pause or resume, or press Enter to quit.\n");
+    player_load_sample(player, &loadFrom);
+    if (playlistPath != NULL)
     {
-        printf("No such directory.");
-        return -1;
+        // Queued as it is parsed, so the first entry plays right away.
+        if (playlist_load_start(&loader, player, playlistPath) != 0)
+        {
+            printf("\rCannot read playlist %s\n", playlistPath);
+        }
     }
-
-    while ((entry = readdir(dir)) != NULL)
+    else if (file_count > 0 && player_play_playlist(player, files, file_count) != 0)
     {
-        if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0))
-            continue;
+        printf("\rFailed to load file: %s\n", files[0]);
+    }
 
-        if (!is_audio_file(entry->d_name))
+    // Wait for Enter, waking up periodically to report track changes.
+    for (;;) {
+        fd_set readable;
+        struct timeval tick = { 0, 50000 };
+
+        FD_ZERO(&readable);
+        FD_SET(STDIN_FILENO, &readable);
+        if (select(STDIN_FILENO + 1, &readable, NULL, NULL, &tick) > 0) {
+            PlayerLatencyProfile requested;
+
+            if (fgets(line, sizeof(line), stdin) == NULL) {
+                break;
+            }
+            line[strcspn(line, "\n")] = '\0';
+            if (strcmp(line, "pause") == 0) {
+                // Each report covers one state, so wakeups can be compared.
+                print_latency_report(player, &loadFrom);
+                player_toggle_pause(player);
+                player_load_sample(player, &loadFrom);
+                continue;
+            }
+            if (player_parse_latency(line, &requested) != 0) {
+                break;
+            }
+
+            print_latency_report(player, &loadFrom);
+            player_set_latency(player, requested);
+            player_load_sample(player, &loadFrom);
             continue;
+        }
 
-        files = realloc(files, sizeof(char *) * (file_count + 1));
-        
-        // Allocate space for full path
-        size_t path_len = strlen(music_dir) + strlen(entry->d_name) + 2;
-        files[file_count] = malloc(path_len);
-        snprintf(files[file_count], path_len, "%s/%s", music_dir, entry->d_name);
-        
-        file_count++;
-    }
-    closedir(dir);
+        player_get_status(player, &status);
+        if (status.is_active && strcmp(status.filepath, lastPlayed) != 0)
+        {
+            snprintf(lastPlayed, sizeof(lastPlayed), "%s", status.filepath);
+            printf("\rNow playing: %s\n", get_filename(status.filepath));
+            print_track_stats(player, &status);
+        }
 
-    qsort(files, file_count, sizeof(char*), compare_strings);
+        int adapted = player_get_adaptations(player, lastAdaptation, adaptations, PLAYER_ADAPT_LOG);
+        for (i = 0; i < adapted; i++)
+        {
+            char description[256];
 
-    if (player_init(&player) != 0)
-    {
-        return 1;
+            player_describe_adaptation(&adaptations[i], description, sizeof(description));
+            printf("\r%s\n", description);
+            lastAdaptation = adaptations[i].serial;
+        }
     }
 
-    printf("Press Enter to quit.\n");
-    player_play_playlist(&player, files, file_count);
-
-    getchar();
-    player_cleanup(&player);
+    print_latency_report(player, &loadFrom);
+    playlist_load_stop(&loader);
+    if (exporting) {
+        metrics_exporter_stop(&exporter);
+    }
+    player_destroy(player);
     for (i = 0; i < file_count; i++)
     {
         free(files[i]);
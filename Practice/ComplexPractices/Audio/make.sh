@@ -1,4 +1,6 @@
 #!/bin/bash
 
 set -e
-gcc $@ -framework CoreAudio -framework AudioToolbox -framework CoreFoundation -o Audio
+cd "$(dirname "$0")"
+../PlayerCore/make.sh
+gcc $@ -I../PlayerCore Audio.c ../PlayerCore/build/libplayercore.a -lpthread -lm -ldl -o Audio
@@ -72,6 +72,17 @@ int main (void)
         wrefresh(win);
 
         key = getch();
+        if (key == KEY_RESIZE)
+        {
+            // Bounds follow the new terminal size
+            width = COLS / 2;
+            height = LINES - 3;
+            endX = startX + width;
+            endY = startY + height;
+            wresize(win, height + 3, width + 3);
+            if (x > endX) x=endX;
+            if (y > endY) y=endY;
+        }
         if (key == KEY_LEFT)
         {
             x--;
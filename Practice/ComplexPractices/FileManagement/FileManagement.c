@@ -102,6 +102,15 @@ int main(void)
         wrefresh(win);
 
         key = getch();
+        if (key == KEY_RESIZE)
+        {
+            // Bounds follow the new terminal size
+            width = COLS / 2;
+            height = LINES - 3;
+            endX = startX + width;
+            endY = startY + height;
+            wresize(win, height + 3, width + 3);
+        }
         if (key == KEY_UP)
         {
             y--;
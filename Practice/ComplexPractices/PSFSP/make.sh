@@ -0,0 +1,9 @@
+#!/bin/bash
+
+set -e
+cd "$(dirname "$0")"
+../PlayerCore/make.sh
+# UTF-8 names need the wide-character ncurses; on macOS plain ncurses is one.
+NCURSES=-lncurses
+[ "$(uname)" = "Linux" ] && NCURSES=-lncursesw
+gcc $@ -I../PlayerCore psfsp.c ../PlayerCore/build/libplayercore.a $NCURSES -lpthread -lm -ldl -o psfsp
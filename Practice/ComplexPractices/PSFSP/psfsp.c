@@ -1,40 +1,29 @@
-#define MINIAUDIO_IMPLEMENTATION
-#include "miniaudio.h"
+#include "player.h"
+#include "client.h"
+#include "daemon.h"
+#include "statuspage.h"
+#include "metrics.h"
+#include "library.h"
+#include "dircache.h"
+#include "waveform.h"
+#include "asyncvfs.h"
+#include "history.h"
+#include "playlist.h"
+#include "tags.h"
+#include "display.h"
 #include <stdio.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <ncurses.h>
-#include <dirent.h>
+#include <locale.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
-typedef struct
-{
-    ma_decoder decoder;
-    ma_bool32 is_active;
-    char filepath[512];
-} AudioTrack;
-
-typedef struct
-{
-    AudioTrack current;
-    AudioTrack next;
-    ma_device device;
-    char** playlist;
-    int playlist_count;
-    int current_index;
-    ma_bool32 auto_advance;
-    ma_bool32 is_paused;
-} MiniaudioPlayer;
-
-const char* get_filename(const char* filepath)
-{
-    const char* filename = strrchr(filepath, '/');
-    if (filename == NULL) {
-        return filepath;
-    }
-    return filename + 1;
-}
-
+// The name to show for a file: no extension, and no leading track number
+// ("01 ", "1. ", "03 - ") when there is one.
 const char* remove_extension(const char* filename)
 {
     if (strcmp(filename, ".") == 0)
@@ -43,342 +32,512 @@ const char* remove_extension(const char* filename)
     }
     static char buffer[256];
     const char* dot = strrchr(filename, '.');
+    const char* start = filename;
     
-    if (dot == NULL)
+    while (*start >= '0' && *start <= '9')
+        start++;
+    if (start > filename && (*start == ' ' || *start == '.' || *start == '-'))
     {
-        strncpy(buffer, filename, sizeof(buffer) - 4);
-        buffer[sizeof(buffer) - 1] = '\0';
-        return buffer + 3;
+        while (*start == ' ' || *start == '.' || *start == '-')
+            start++;
     }
+    if (start == filename || *start == '\0' || (dot != NULL && start >= dot))
+        start = filename;
     
-    size_t len = dot - filename;
+    size_t len = dot != NULL && dot > start ? (size_t)(dot - start) : strlen(start);
     if (len >= sizeof(buffer))
-        len = sizeof(buffer) - 4;
+        len = sizeof(buffer) - 1;
     
-    strncpy(buffer, filename, len);
+    memcpy(buffer, start, len);
     buffer[len] = '\0';
     
-    return buffer + 3;
+    return buffer;
 }
 
-void data_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount)
+double now_ms(void)
 {
-    MiniaudioPlayer* player = (MiniaudioPlayer*)pDevice->pUserData;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
 
-    if (!player->current.is_active || player->is_paused)
+// The directory shown in the file list: a cached listing, or a scan that is
+// still streaming in.
+typedef struct
+{
+    char path[PATH_MAX];
+    DirCache cache;
+    DirListing* listing;
+    LibraryScan scan;
+    int scanning;
+    int failed;
+    struct timespec mtime;
+    char** snapshot;            // sorted entries so far while scanning
+    int snapshot_count;
+    char select[NAME_MAX + 2];  // entry to put the cursor on once listed
+} Browser;
+
+void browser_open(Browser* browser, const char* path, const char* select)
+{
+    if (browser->scanning)
+        library_scan_free(&browser->scan);
+    browser->scanning = 0;
+    browser->failed = 0;
+    free(browser->snapshot);
+    browser->snapshot = NULL;
+    browser->snapshot_count = 0;
+
+    snprintf(browser->path, sizeof(browser->path), "%s", path);
+    snprintf(browser->select, sizeof(browser->select), "%s", select);
+    browser->listing = dircache_lookup(&browser->cache, path);
+    if (browser->listing != NULL)
+        return;
+
+    // The mtime is read first, so a change during the scan shows up as stale.
+    if (dircache_mtime(path, &browser->mtime) != 0 || library_scan_start(&browser->scan, path) != 0)
     {
-        memset(pOutput, 0, frameCount * ma_get_bytes_per_frame(pDevice->playback.format, pDevice->playback.channels));
+        browser->failed = 1;
         return;
     }
-    
-    ma_uint64 framesRead = 0;
-    ma_decoder_read_pcm_frames(&player->current.decoder, pOutput, frameCount, &framesRead);
-    
-    if (framesRead < frameCount)
+    browser->scanning = 1;
+}
+
+// Returns 1 once listed, 0 while scanning, -1 if the directory can't be read.
+int browser_poll(Browser* browser, char*** files, int* count)
+{
+    if (browser->scanning)
     {
-        size_t bytesPerFrame = ma_get_bytes_per_frame(pDevice->playback.format, pDevice->playback.channels);
-        memset((unsigned char*)pOutput + (framesRead * bytesPerFrame), 0, 
-               (frameCount - framesRead) * bytesPerFrame);
-        
-        if (player->auto_advance && player->next.is_active)
-        {
-            ma_decoder_uninit(&player->current.decoder);
-            player->current = player->next;
-            player->next.is_active = MA_FALSE;
-            player->current_index++;
-
-            if (player->current_index + 1 < player->playlist_count)
+        char** scanned;
+        int scannedCount;
+
+        if (library_scan_poll(&browser->scan, &scanned, &scannedCount))
+        {
+            free(browser->snapshot);
+            browser->snapshot = scanned;
+            browser->snapshot_count = scannedCount;
+        }
+
+        int state = library_scan_state(&browser->scan);
+        if (state == 1)
+        {
+            free(browser->snapshot);
+            browser->snapshot = NULL;
+            browser->snapshot_count = 0;
+            scannedCount = library_scan_take(&browser->scan, &scanned);
+            browser->listing = dircache_insert(&browser->cache, browser->path, &browser->mtime, scanned, scannedCount);
+            for (int i = 0; i < scannedCount && browser->select[0] != '\0'; i++)
             {
-                strcpy(player->next.filepath, player->playlist[player->current_index + 1]);
-                if (ma_decoder_init_file(player->next.filepath, NULL, &player->next.decoder) == MA_SUCCESS)
-                {
-                    player->next.is_active = MA_TRUE;
-                    fflush(stdout);
-                }
+                if (strcmp(scanned[i], browser->select) == 0)
+                    browser->listing->cursor = i;
             }
-        } else {
-            player->current.is_active = MA_FALSE;
+            browser->scanning = 0;
+        }
+        else if (state < 0)
+        {
+            library_scan_free(&browser->scan);
+            browser->scanning = 0;
+            browser->failed = 1;
         }
     }
-    
-    (void)pInput;
+
+    if (browser->listing != NULL)
+    {
+        *files = browser->listing->entries;
+        *count = browser->listing->count;
+        return 1;
+    }
+
+    *files = browser->snapshot;
+    *count = browser->snapshot_count;
+    return browser->failed ? -1 : 0;
+}
+
+void browser_free(Browser* browser)
+{
+    if (browser->scanning)
+        library_scan_free(&browser->scan);
+    free(browser->snapshot);
+    dircache_free(&browser->cache);
 }
 
-int player_init(MiniaudioPlayer* player)
+// Looks up an entry of the listed directory in the play history.
+int history_entry(History* history, const char* dir, const char* name, HistoryTrack* track)
 {
-    memset(player, 0, sizeof(MiniaudioPlayer));
+    char path[1024];
 
-    ma_device_config config = ma_device_config_init(ma_device_type_playback);
-    config.playback.format = ma_format_f32;
-    config.playback.channels = 2;
-    config.sampleRate = 48000;
-    config.dataCallback = data_callback;
-    config.pUserData = player;
+    if (!is_audio_file(name))
+        return 0;
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return history_lookup(history, path, track);
+}
 
-    if (ma_device_init(NULL, &config, &player->device) != MA_SUCCESS)
-    {
-        printf("\rFailed to initialize playback device.\n");
-        return -1;
-    }
+// Looks up an entry's tags, asking for them the first time it is shown.
+int tag_entry(TagReader* reader, const char* dir, const char* name, TrackTags* tags)
+{
+    char path[1024];
 
-    if (ma_device_start(&player->device) != MA_SUCCESS)
-    {
-        printf("\rFailed to start playback device.\n");
-        ma_device_uninit(&player->device);
-        return -1;
-    }
-    
-    return 0;
+    if (!is_audio_file(name))
+        return 0;
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    tag_reader_request(reader, path);
+    return tag_reader_get(reader, path, tags);
 }
 
-void player_toggle_pause(MiniaudioPlayer* player)
+// "3. Artist - Title (Album)" from whichever fields are there; the file name
+// stands in for a missing title.
+void tag_label(char* out, size_t size, const char* name, const TrackTags* tags)
 {
-    player->is_paused = !player->is_paused;
+    int used = 0;
+
+    if (tags->track > 0)
+        used += snprintf(out + used, size - used, "%d. ", tags->track);
+    if (tags->artist[0] != '\0' && (size_t)used < size)
+        used += snprintf(out + used, size - used, "%s - ", tags->artist);
+    if ((size_t)used < size)
+        used += snprintf(out + used, size - used, "%s", tags->title[0] != '\0' ? tags->title : name);
+    if (tags->album[0] != '\0' && (size_t)used < size)
+        snprintf(out + used, size - used, " (%s)", tags->album);
 }
 
-int player_skip_next(MiniaudioPlayer* player)
+// Where the panes go, worked out from the terminal size only when it changes:
+// the file list on the left with the status bar along its bottom border, and
+// on the right the now-playing pane above the stats pane.
+typedef struct
 {
-    if (!player->auto_advance || player->current_index + 1 >= player->playlist_count)
-        return -1;
+    int lines;
+    int cols;
+    int list_width;
+    int list_rows;                  // entries the list pane has room for
+    int status_y;                   // in the list window
+    int side_x;
+    int side_width;
+    int now_y;                      // track and status lines, then the waveform
+    int stats_y;                    // formats, latency, daemon, history, input
+} Layout;
+
+void layout_compute(Layout* layout, int lines, int cols)
+{
+    layout->lines = lines;
+    layout->cols = cols;
+    layout->list_width = cols / 2;
+    layout->list_rows = lines > 3 ? lines - 3 : 0;
+    layout->status_y = layout->list_rows + 2;
+    layout->side_x = cols / 2 + 3;
+    layout->side_width = cols - layout->side_x - 2;
+    layout->now_y = lines / 2 - 2;
+    layout->stats_y = lines / 2 + 1;
+}
 
-    ma_device_stop(&player->device);
-    
-    if (player->current.is_active)
-    {
-        ma_decoder_uninit(&player->current.decoder);
-        player->current.is_active = MA_FALSE;
-    }
-    
-    if (player->next.is_active)
+typedef struct
+{
+    DisplayText display;            // tags or file name, measured once
+    int tagged;                     // showing tags, which don't change
+    unsigned long long tags_read;   // reader progress when tags were last looked for
+    unsigned long long history_serial;
+    unsigned plays;
+} ListRow;
+
+// A display record per entry of the list, filled in the first time the entry
+// is shown and kept while the order stays the same. A new pane width only
+// moves the cut; new tags and history only touch the rows shown.
+typedef struct
+{
+    ListRow* rows;
+    int count;
+    char** files;
+    int stale;                      // set when the order changed
+    unsigned long long history_serial;  // bumped when the history changed
+} RowCache;
+
+void row_cache_free(RowCache* cache)
+{
+    for (int i = 0; i < cache->count; i++)
+        display_free(&cache->rows[i].display);
+    free(cache->rows);
+    cache->rows = NULL;
+    cache->count = 0;
+}
+
+// The record for files[index], brought up to date and cut to columns.
+ListRow* row_cache_row(RowCache* cache, TagReader* reader, History* history, const char* dir,
+                       char** files, int file_count, int index, int columns)
+{
+    const char* name = files[index];
+    unsigned long long tagsRead = tag_reader_progress(reader);
+    char label[512];
+    TrackTags tags;
+    HistoryTrack played;
+    ListRow* row;
+
+    if (cache->stale || cache->files != files || cache->count != file_count)
     {
-        player->current = player->next;
-        player->next.is_active = MA_FALSE;
-        player->current_index++;
+        row_cache_free(cache);
+        cache->rows = calloc(file_count, sizeof(ListRow));
+        if (cache->rows == NULL)
+            return NULL;
+        cache->count = file_count;
+        cache->files = files;
+        cache->stale = 0;
     }
-    else
+    row = &cache->rows[index];
+
+    // Tagged tracks show their tags; the rest, and tracks whose tags are still
+    // being read, show the file name.
+    if (row->display.text == NULL || (!row->tagged && row->tags_read != tagsRead))
     {
-        player->current_index++;
-        strcpy(player->current.filepath, player->playlist[player->current_index]);
-        if (ma_decoder_init_file(player->playlist[player->current_index], NULL, &player->current.decoder) != MA_SUCCESS)
+        row->tags_read = tagsRead;
+        if (tag_entry(reader, dir, name, &tags))
         {
-            player->current.is_active = MA_FALSE;
-            ma_device_start(&player->device);
-            return -1;
+            tag_label(label, sizeof(label), name, &tags);
+            row->tagged = display_set(&row->display, label) == 0;
         }
-    }
-    
-    player->current.is_active = MA_TRUE;
-    
-    if (player->current_index + 1 < player->playlist_count)
-    {
-        strcpy(player->next.filepath, player->playlist[player->current_index + 1]);
-        if (ma_decoder_init_file(player->next.filepath, NULL, &player->next.decoder) == MA_SUCCESS)
+        else if (row->display.text == NULL && display_set(&row->display, name) != 0)
         {
-            player->next.is_active = MA_TRUE;
+            return NULL;
         }
     }
-    
-    ma_device_start(&player->device);
-    return 0;
-}
+    display_fit(&row->display, columns);
 
-int player_skip_previous(MiniaudioPlayer* player)
-{
-    if (!player->auto_advance || player->current_index <= 0)
-        return -1;
-
-    ma_device_stop(&player->device);
-    
-    if (player->current.is_active)
-    {
-        ma_decoder_uninit(&player->current.decoder);
-        player->current.is_active = MA_FALSE;
-    }
-    
-    if (player->next.is_active)
-    {
-        ma_decoder_uninit(&player->next.decoder);
-        player->next.is_active = MA_FALSE;
-    }
-    
-    player->current_index--;
-    
-    strcpy(player->current.filepath, player->playlist[player->current_index]);
-    if (ma_decoder_init_file(player->playlist[player->current_index], NULL, &player->current.decoder) != MA_SUCCESS)
+    if (row->history_serial != cache->history_serial)
     {
-        player->current.is_active = MA_FALSE;
-        ma_device_start(&player->device);
-        return -1;
+        row->history_serial = cache->history_serial;
+        row->plays = history_entry(history, dir, name, &played) ? played.plays : 0;
     }
-    player->current.is_active = MA_TRUE;
-    
-    if (player->current_index + 1 < player->playlist_count)
-    {
-        strcpy(player->next.filepath, player->playlist[player->current_index + 1]);
-        if (ma_decoder_init_file(player->next.filepath, NULL, &player->next.decoder) == MA_SUCCESS)
-        {
-            player->next.is_active = MA_TRUE;
-        }
-    }
-    
-    ma_device_start(&player->device);
-    return 0;
+    return row;
 }
 
-int player_play_file(MiniaudioPlayer* player, const char* filepath)
+typedef struct
 {
-    ma_device_stop(&player->device);
-    
-    if (player->current.is_active)
-    {
-        ma_decoder_uninit(&player->current.decoder);
-        player->current.is_active = MA_FALSE;
-    }
-    
-    if (player->next.is_active)
-    {
-        ma_decoder_uninit(&player->next.decoder);
-        player->next.is_active = MA_FALSE;
-    }
+    char* name;
+    unsigned plays;
+    int index;
+} PlayOrder;
 
-    strcpy(player->current.filepath, filepath);
-    if (ma_decoder_init_file(filepath, NULL, &player->current.decoder) != MA_SUCCESS)
-    {
-        printf("\rFailed to load file: %s\n", filepath);
-        player->current.is_active = MA_FALSE;
-        ma_device_start(&player->device);
-        return -1;
-    }
-
-    player->current.is_active = MA_TRUE;
-    player->auto_advance = MA_FALSE;
-    player->is_paused = MA_FALSE;
-    
-    ma_device_start(&player->device);
+int play_order_compare(const void* a, const void* b)
+{
+    const PlayOrder* left = (const PlayOrder*)a;
+    const PlayOrder* right = (const PlayOrder*)b;
 
-    return 0;
+    if (left->plays != right->plays)
+        return left->plays < right->plays ? 1 : -1;
+    return left->index - right->index;
 }
 
-int player_play_playlist(MiniaudioPlayer* player, char** files, int count)
+// Fills sorted with files, most played first. "." stays on top, and entries
+// played equally often keep their listing order.
+void sort_by_plays(History* history, const char* dir, char** files, int count, char** sorted)
 {
-    if (count == 0) return -1;
-    
-    ma_device_stop(&player->device);
-    
-    if (player->current.is_active)
+    PlayOrder* order = malloc(sizeof(PlayOrder) * count);
+    HistoryTrack track;
+    int first = count > 0 && strcmp(files[0], ".") == 0;
+
+    for (int i = 0; i < count; i++)
     {
-        ma_decoder_uninit(&player->current.decoder);
-        player->current.is_active = MA_FALSE;
+        order[i].name = files[i];
+        order[i].plays = history_entry(history, dir, files[i], &track) ? track.plays : 0;
+        order[i].index = i;
     }
-    
-    if (player->next.is_active)
+    qsort(order + first, count - first, sizeof(PlayOrder), play_order_compare);
+    for (int i = 0; i < count; i++)
+        sorted[i] = order[i].name;
+    free(order);
+}
+
+void waveform_draw(WaveformWorker* worker, int row, int col, int width, ma_uint64 cursor)
+{
+    static const char levels[] = " .:-=+*#";
+    static WaveformOverview snapshot;
+    const WaveformOverview* overview = &snapshot;
+    int head = -1;
+
+    if (width <= 0)
+        return;
+
+    if (waveform_snapshot(worker, &snapshot) != 0)
     {
-        ma_decoder_uninit(&player->next.decoder);
-        player->next.is_active = MA_FALSE;
+        mvwprintw(stdscr, row, col, "%-*.*s", width, width, "[ building waveform... ]");
+        return;
     }
 
-    if (player->playlist != NULL)
+    head = (int)(cursor * (ma_uint64)width / overview->total_frames);
+    for (int c = 0; c < width; c++)
     {
-        for (int i = 0; i < player->playlist_count; i++)
+        int first = c * WAVEFORM_BUCKETS / width;
+        int last = (c + 1) * WAVEFORM_BUCKETS / width;
+        float peak = 0.0f;
+        if (last <= first)
+            last = first + 1;
+        for (int b = first; b < last; b++)
+        {
+            if (-overview->min[b] > peak) peak = -overview->min[b];
+            if (overview->max[b] > peak) peak = overview->max[b];
+        }
+        int level = (int)(peak * (sizeof(levels) - 2) + 0.5f);
+        if (level > (int)sizeof(levels) - 2) level = sizeof(levels) - 2;
+
+        if (c == head)
         {
-            free(player->playlist[i]);
+            attron(COLOR_PAIR(4));
+            mvaddch(row, col + c, '|');
+            attroff(COLOR_PAIR(4));
+        }
+        else
+        {
+            attron(COLOR_PAIR(c < head ? 2 : 3));
+            mvaddch(row, col + c, levels[level]);
+            attroff(COLOR_PAIR(c < head ? 2 : 3));
         }
-        free(player->playlist);
-        player->playlist = NULL;
     }
+}
 
-    player->playlist = malloc(sizeof(char*) * count);
-    for (int i = 0; i < count; i++)
+// Decodes every audio file in dir from a cold page cache once per VFS, timing
+// each period-sized read the way the audio callback would feel it. With
+// faults, the rules in that file play a flaky disk under each VFS. With
+// realtime, reads are paced like a device asking for 25 ms periods, and one
+// that finishes after its period is over counts as an underrun.
+int vfs_bench(const char* dir, const char* faults, int realtime)
+{
+    static const char* names[] = { "stdio", "io_uring", "threads" };
+    const double period = 1200 / 48.0;
+    FaultConfig config;
+    ma_uint64 reference = 0;
+    char** entries;
+    float* buffer;
+    int entry_count;
+
+    if (faults != NULL)
     {
-        player->playlist[i] = strdup(files[i]);
+        int line = fault_config_load(&config, faults);
+        if (line != 0)
+        {
+            fprintf(stderr, line < 0 ? "Cannot read %s\n" : "%s:%d: bad fault rule\n", faults, line);
+            return 1;
+        }
     }
 
-    player->playlist_count = count;
-    player->current_index = 0;
-    player->auto_advance = MA_TRUE;
-    player->is_paused = MA_FALSE;
-
-    strcpy(player->current.filepath, player->playlist[0]);
-    if (ma_decoder_init_file(player->playlist[0], NULL, &player->current.decoder) != MA_SUCCESS)
+    entry_count = library_list_directory(dir, &entries);
+    if (entry_count < 0)
     {
-        printf("\rFailed to load file: %s\n", player->playlist[0]);
-        player->current.is_active = MA_FALSE;
-        ma_device_start(&player->device);
-        return -1;
+        fprintf(stderr, "No such directory.\n");
+        return 1;
     }
-    player->current.is_active = MA_TRUE;
+    buffer = malloc(sizeof(float) * 2 * 1200);
 
-    if (count > 1)
+    for (int pass = 0; pass < 3; pass++)
     {
-        strcpy(player->next.filepath, player->playlist[1]);
-        if (ma_decoder_init_file(player->playlist[1], NULL, &player->next.decoder) == MA_SUCCESS)
+        AsyncVfs vfs;
+        AsyncVfsCounters io;
+        FaultVfs disk, top;
+        FaultTrackStats tracks[FAULT_VFS_TRACKS];
+        ma_uint64 frames = 0, hash = 1469598103934665603ull;
+        double total = 0, slowest = 0;
+        int files = 0, underruns = 0;
+
+        // io_uring can't read through a fault layer; the pool pass covers it.
+        if (pass == 1 && faults != NULL)
+            continue;
+        if (pass > 0 && async_vfs_init(&vfs, pass == 1 ? ASYNC_VFS_URING : ASYNC_VFS_THREADS) != 0)
         {
-            player->next.is_active = MA_TRUE;
+            printf("%-9s unavailable\n", names[pass]);
+            continue;
         }
-    }
-    
-    ma_device_start(&player->device);
 
-    return 0;
-}
+        // Faults go under the read-ahead, where a slow disk would be; top
+        // records what the decoder sees.
+        fault_vfs_init(&disk, NULL, faults != NULL ? &config : NULL);
+        if (pass > 0 && faults != NULL)
+            async_vfs_set_source(&vfs, (ma_vfs*)&disk);
+        fault_vfs_init(&top, pass > 0 ? (ma_vfs*)&vfs : (ma_vfs*)&disk, NULL);
 
-int player_stop(MiniaudioPlayer* player)
-{
-    ma_device_stop(&player->device);
-    
-    if (player->current.is_active)
-    {
-        ma_decoder_uninit(&player->current.decoder);
-        player->current.is_active = MA_FALSE;
-    }
-    if (player->next.is_active)
-    {
-        ma_decoder_uninit(&player->next.decoder);
-        player->next.is_active = MA_FALSE;
-    }
-    
-    ma_device_start(&player->device);
+        for (int i = 0; i < entry_count; i++)
+        {
+            ma_decoder_config decoderConfig = ma_decoder_config_init(ma_format_f32, 2, 48000);
+            ma_decoder decoder;
+            char path[1024];
 
-    return 0;
-}
+            if (!is_audio_file(entries[i]))
+                continue;
+            snprintf(path, sizeof(path), "%s/%s", dir, entries[i]);
 
-void player_cleanup(MiniaudioPlayer* player)
-{
-    player_stop(player);
-    
-    if (player->playlist != NULL)
-    {
-        for (int i = 0; i < player->playlist_count; i++)
+#ifdef POSIX_FADV_DONTNEED
+            int fd = open(path, O_RDONLY);
+            if (fd >= 0)
+            {
+                posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+                close(fd);
+            }
+#endif
+
+            double start = now_ms();
+            double due = start;
+            if (ma_decoder_init_vfs((ma_vfs*)&top, path, &decoderConfig, &decoder) != MA_SUCCESS)
+                continue;
+            for (;;)
+            {
+                ma_uint64 got = 0;
+                double readStart;
+
+                if (realtime)
+                {
+                    due += period;
+                    while (now_ms() < due - period)
+                        usleep(1000);
+                }
+                readStart = now_ms();
+                ma_decoder_read_pcm_frames(&decoder, buffer, 1200, &got);
+                if (now_ms() - readStart > slowest)
+                    slowest = now_ms() - readStart;
+                if (realtime && now_ms() > due)
+                {
+                    underruns++;
+                    due = now_ms();
+                }
+                if (got == 0)
+                    break;
+                for (size_t b = 0; b < got * 2 * sizeof(float); b++)
+                    hash = (hash ^ ((unsigned char*)buffer)[b]) * 1099511628211ull;
+                frames += got;
+            }
+            ma_decoder_uninit(&decoder);
+            total += now_ms() - start;
+            files++;
+        }
+
+        printf("%-9s %d files, %.1f s of audio in %.1f ms, slowest read %.2f ms", names[pass], files,
+               frames / 48000.0, total, slowest);
+        if (realtime)
+            printf(", %d underruns", underruns);
+        if (pass > 0)
         {
-            free(player->playlist[i]);
+            async_vfs_get_counters(&vfs, &io);
+            printf(", %llu of %llu reads stalled (%.1f ms)", (unsigned long long)io.stalls,
+                   (unsigned long long)io.reads, io.stall_ns / 1e6);
         }
-        free(player->playlist);
-        player->playlist = NULL;
-    }
-    
-    ma_device_uninit(&player->device);
-}
+        printf("%s\n", files > 0 && reference != 0 && hash != reference ? "  OUTPUT DIFFERS" : "");
+        if (files > 0 && reference == 0)
+            reference = hash;
 
-int compare_strings(const void* a, const void* b)
-{
-    return strcmp(*(const char**)a, *(const char**)b);
-}
+        if (faults != NULL)
+        {
+            int count = fault_vfs_tracks(&disk, tracks, FAULT_VFS_TRACKS);
+            for (int t = count - 1; t >= 0; t--)
+            {
+                printf("  %-24s %6llu reads %8.1f KB  avg %7.2f ms  max %7.2f ms  %llu faults\n",
+                       get_filename(tracks[t].path), (unsigned long long)tracks[t].reads, tracks[t].bytes / 1024.0,
+                       tracks[t].reads > 0 ? tracks[t].latency_ns / 1e6 / tracks[t].reads : 0.0,
+                       tracks[t].latency_max_ns / 1e6, (unsigned long long)tracks[t].injected);
+            }
+        }
 
-int is_audio_file(const char* filename)
-{
-    const char* ext = strrchr(filename, '.');
-    if (ext == NULL) return 0;
-    
-    return (strcmp(ext, ".mp3") == 0 ||
-            strcmp(ext, ".MP3") == 0 ||
-            strcmp(ext, ".wav") == 0 ||
-            strcmp(ext, ".WAV") == 0 ||
-            strcmp(ext, ".flac") == 0 ||
-            strcmp(ext, ".FLAC") == 0 ||
-            strcmp(ext, ".ogg") == 0 ||
-            strcmp(ext, ".OGG") == 0 ||
-            strcmp(ext, ".m4a") == 0 ||
-            strcmp(ext, ".M4A") == 0);
+        fault_vfs_uninit(&top);
+        if (pass > 0)
+            async_vfs_uninit(&vfs);
+        fault_vfs_uninit(&disk);
+    }
+
+    free(buffer);
+    library_free_list(entries, entry_count);
+    return 0;
 }
 
 
@@ -465,48 +624,256 @@ int is_audio_file(const char* filename)
 
 
 // -----------------------------------------------------------------------------------------------------------------------
-int main()
+int main(int argc, char** argv)
 {
-    MiniaudioPlayer player;
-    DIR *dir;
+    MiniaudioPlayer* player;
+    PlayerClient client, pendingClient;
+    ClientConnector connector;
+    Browser browser;
+    DirListing* shownListing = NULL;
+    const char* pathShown;
+    int scanCount = 0;
+    int scanState = 0, connectState = 0;
+    int startupTrace = 0;
+    int inputTimeout = 20;
+    int steps, next;
+    double inputIdle = 0, inputAt = 0;
+    double inputLatency = 0, inputLatencyMax = 0, inputLatencyTotal = 0;
+    int inputFrames = 0, inputKeys = 0;
+    double startTime = now_ms();
+    double firstFrame = 0, scanDone = 0, connected = 0, interactive = 0;
+    PlayerStatus status;
+    PlayerDeviceInfo device;
+    WaveformWorker waveform;
+    FaultVfs waveformIo;
+    FaultConfig waveformFaults;
     FILE *log;
     char *logFilepath = "/Users/hpapez27/Termusic/Practice/ComplexPractices/PSFSP/log.txt";
-    struct dirent *entry;
     char **files = NULL;
     char **filesToBePlayed = NULL;
     char *cfile = NULL;
+    char cfileName[256];
     char *songName = NULL;
-    char cfileFilePath[512];
+    char cfileFilePath[PATH_MAX];
     int file_count = 0;
-    int key, y, startY, startX, width, height, endX, endY, i;
-
+    int key, y, startY, startX, width, height, i;
+    PlayerFormatMode formatMode = PLAYER_FORMAT_FIXED;
+    PlayerLatencyProfile latency = PLAYER_LATENCY_BALANCED;
+    LoadSample loadFrom, loadNow;
+    LoadStats load;
+    const char* renderPath = NULL;
+    char socketPath[256];
+    const char* socketOverride = NULL;
+    int runDaemon = 0;
+    int pingCount = 0;
+    int vfsBench = 0;
+    int realtime = 0;
+    const char* ioFaults = NULL;
+    int monitor = 0;
+    History history;
+    char historyPath[512];
+    HistoryTrack played;
+    TagReader tagReader;
+    TrackTags tags;
+    char label[512];
+    char line[600];
+    Layout layout;
+    RowCache rowCache;
+    ListRow* row;
+    DisplayText nowPlaying;
+    int nowTagged = 0;
+    unsigned long long nowTagsRead = 0;
+    int top = 0;
+    double historyChecked = 0;
+    int sortByPlays = 0, resort = 0;
+    char **sortedFiles = NULL;
+    const char* metricsAddress = NULL;
+    int prefetchDepth = -1;
+    double prefetchMegabytes = PLAYER_PREFETCH_BUDGET / 1048576.0;
+    MetricsExporter exporter;
+    int exporting = 0;
     const char* music_dir = "/Users/hpapez27/Desktop/Musikk/TermusicFiles/Pink_Floyd_-_The_Dark_Side_of_the_Moon";
-    dir = opendir(music_dir);
-    if (dir == NULL)
+
+    // The library is sorted in the user's collation order. LC_NUMERIC stays "C"
+    // so numbers in the daemon protocol parse the same on both ends.
+    setlocale(LC_COLLATE, "");
+    setlocale(LC_CTYPE, "");
+
+    for (i = 1; i < argc; i++)
     {
-        fprintf(stderr, "No such directory.");
-        return 1;
+        if (strcmp(argv[i], "--native") == 0)
+            formatMode = PLAYER_FORMAT_NATIVE;
+        else if (strcmp(argv[i], "--bitperfect") == 0)
+            formatMode = PLAYER_FORMAT_BITPERFECT;
+        else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc)
+        {
+            if (player_parse_latency(argv[++i], &latency) != 0)
+            {
+                fprintf(stderr, "Unknown latency profile: %s (low, balanced, powersave)\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--render") == 0 && i + 1 < argc)
+            renderPath = argv[++i];
+        else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+            music_dir = argv[++i];
+        else if (strcmp(argv[i], "--daemon") == 0)
+            runDaemon = 1;
+        else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+            socketOverride = argv[++i];
+        else if (strcmp(argv[i], "--ping-bench") == 0 && i + 1 < argc)
+            pingCount = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--monitor") == 0)
+            monitor = 1;
+        else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc)
+            metricsAddress = argv[++i];
+        else if (strcmp(argv[i], "--startup-trace") == 0)
+            startupTrace = 1;
+        else if (strcmp(argv[i], "--vfs-bench") == 0)
+            vfsBench = 1;
+        else if (strcmp(argv[i], "--realtime") == 0)
+            realtime = 1;
+        else if (strcmp(argv[i], "--io-faults") == 0 && i + 1 < argc)
+            ioFaults = argv[++i];
+        else if (strcmp(argv[i], "--prefetch") == 0 && i + 1 < argc)
+            sscanf(argv[++i], "%d:%lf", &prefetchDepth, &prefetchMegabytes);
     }
 
-    while ((entry = readdir(dir)) != NULL)
+    if (monitor)
     {
-        if (strcmp(entry->d_name, "..") == 0)
-            continue;
+        // Reads the daemon's shared status page once a second; never talks to it.
+        PlayerStatusPage snapshot;
+        char pageName[64];
+        const PlayerStatusPage* page;
+
+        status_page_default_name(pageName, sizeof(pageName));
+        page = status_page_open(pageName);
+        if (page == NULL)
+        {
+            fprintf(stderr, "No status page at %s (is the daemon running?)\n", pageName);
+            return 1;
+        }
 
-        if (strcmp(entry->d_name, ".DS_Store") == 0)
-            continue;
+        for (;;)
+        {
+            if (status_page_read(page, &snapshot) != 0)
+            {
+                printf("status page stuck mid-update (did the daemon die?)\n");
+                fflush(stdout);
+                sleep(1);
+                continue;
+            }
+            double position = snapshot.sample_rate > 0 ? (double)snapshot.position_frames / snapshot.sample_rate : 0.0;
+            printf("track %llu [%d] %s %6.1f s  underruns %llu  callback p50 %u us p99 %u us max %u us  %s\n",
+                   (unsigned long long)snapshot.track_id, snapshot.playlist_index,
+                   !snapshot.active ? "--" : (snapshot.paused ? "||" : "|>"), position,
+                   (unsigned long long)snapshot.underruns, snapshot.callback_p50_us,
+                   snapshot.callback_p99_us, snapshot.callback_max_us, get_filename(snapshot.filepath));
+            fflush(stdout);
+            sleep(1);
+        }
+    }
+
+    // A daemon spawned by a client is told the socket that client waits on.
+    if (socketOverride != NULL)
+        snprintf(socketPath, sizeof(socketPath), "%s", socketOverride);
+    else
+        daemon_default_socket(socketPath, sizeof(socketPath));
+    if (runDaemon)
+    {
+        return player_daemon_run(socketPath, formatMode, latency, metricsAddress) == 0 ? 0 : 1;
+    }
 
-        files = realloc(files, sizeof(char *) * (file_count + 1));
-        
-        size_t path_len = strlen(music_dir) + strlen(entry->d_name) + 2;
-        files[file_count] = malloc(path_len);
-        snprintf(files[file_count], path_len, "%s", entry->d_name);
-        
-        file_count++;
+    if (pingCount > 0)
+    {
+        if (client_connect_or_spawn(&client, socketPath, formatMode, latency) != 0)
+        {
+            fprintf(stderr, "Cannot reach the player daemon at %s\n", socketPath);
+            return 1;
+        }
+        for (i = 0; i < pingCount; i++)
+            client_command(&client, "PING", NULL, 0);
+        printf("%llu round trips: min %.1f us, avg %.1f us, max %.1f us\n",
+               (unsigned long long)client.rtt_count, client.rtt_min * 1e6,
+               client.rtt_count > 0 ? client.rtt_total / client.rtt_count * 1e6 : 0.0, client.rtt_max * 1e6);
+        client_close(&client);
+        return 0;
     }
-    closedir(dir);
 
-    qsort(files, file_count, sizeof(char*), compare_strings);
+    // Players read this themselves, so a daemon spawned from here gets it too.
+    if (ioFaults != NULL)
+        setenv("PSFSP_IO_FAULTS", ioFaults, 1);
+    if (vfsBench)
+        return vfs_bench(music_dir, ioFaults, realtime);
+
+    if (renderPath != NULL)
+    {
+        // Same as selecting "." in the browser, but with no device and no UI.
+        RenderStats stats;
+        char **fullPaths;
+        int playlistCount = 0;
+        int result = 1;
+
+        file_count = library_list_directory(music_dir, &files);
+        if (file_count < 0)
+        {
+            fprintf(stderr, "No such directory.");
+            return 1;
+        }
+        fullPaths = malloc(sizeof(char*) * file_count);
+
+        for (i = 0; i < file_count; i++)
+        {
+            if (is_audio_file(files[i]))
+            {
+                size_t path_len = strlen(music_dir) + strlen(files[i]) + 2;
+                fullPaths[playlistCount] = malloc(path_len);
+                snprintf(fullPaths[playlistCount], path_len, "%s/%s", music_dir, files[i]);
+                playlistCount++;
+            }
+        }
+
+        player = player_create_offline(ma_format_f32, 2, 48000);
+        if (player != NULL && player_play_playlist(player, fullPaths, playlistCount) == 0 &&
+            player_render(player, renderPath, &stats) == 0)
+        {
+            printf("Rendered %d tracks, %llu frames (%.1f s of audio) in %.3f s: %.1fx realtime\n",
+                   playlistCount, (unsigned long long)stats.frames, (double)stats.frames / 48000,
+                   stats.seconds, stats.realtime_factor);
+            result = 0;
+        }
+        else
+        {
+            fprintf(stderr, "Render failed.\n");
+        }
+
+        if (player != NULL)
+            player_destroy(player);
+        for (i = 0; i < playlistCount; i++)
+            free(fullPaths[i]);
+        free(fullPaths);
+        library_free_list(files, file_count);
+        return result;
+    }
+
+    // Nothing slow happens before the first frame: the directory is listed and
+    // the daemon reached (or started, which opens the device) in the background.
+    // Playback runs in the daemon, so quitting the UI leaves the music playing.
+    // Until it answers, client has no connection and every request just fails.
+    memset(&client, 0, sizeof(client));
+    client.fd = -1;
+    memset(&browser, 0, sizeof(browser));
+    dircache_init(&browser.cache);
+    browser_open(&browser, music_dir, "");
+    history_default_path(historyPath, sizeof(historyPath));
+    history_open_readonly(&history, historyPath);
+    tag_reader_start(&tagReader);
+    client_connect_async(&connector, &pendingClient, socketPath, formatMode, latency);
+
+    // The UI process only has library counters; the player's are served by
+    // "psfsp --daemon --metrics".
+    if (metricsAddress != NULL)
+        exporting = metrics_exporter_start(&exporter, metricsAddress, NULL) == 0;
 
     initscr();
     start_color();
@@ -515,25 +882,29 @@ int main()
     cbreak();
     noecho();
     keypad(stdscr, TRUE);
+    timeout(inputTimeout);
 
     clear();
 
     y = 1;
 
-    width = COLS / 2;
-    height = LINES - 3;
+    layout_compute(&layout, LINES, COLS);
+    width = layout.list_width;
+    height = layout.list_rows;
     startY = 1;
     startX = 1;
-    endX = startX + width;
-    endY = startY + height;
 
     init_color(COLOR_CYAN, 1000, 1000, 1000);
     init_color(COLOR_BLACK, 263, 271, 271);
 
-    if (player_init(&player) != 0)
-    {
-        return 1;
-    }
+    // The overview pass reads whole files, so it is recorded, and slowed by
+    // the same fault rules as the player when they are set.
+    const char* faultRules = getenv("PSFSP_IO_FAULTS");
+    int faulty = faultRules != NULL && fault_config_load(&waveformFaults, faultRules) == 0;
+    fault_vfs_init(&waveformIo, NULL, faulty ? &waveformFaults : NULL);
+    waveform_worker_start(&waveform, (ma_vfs*)&waveformIo);
+    client_status(&client, &status, &device, &loadFrom);
+    client_load_stats(&device, &loadFrom, &loadFrom, &load);
 
     init_pair(1, COLOR_RED, -1);
     init_pair(2, COLOR_GREEN, -1);
@@ -541,89 +912,363 @@ int main()
     init_pair(4, COLOR_CYAN, COLOR_BLACK);
 
     WINDOW *win = newwin(height + 3, width + 3, startY - 1, startX - 1);
+    memset(&rowCache, 0, sizeof(rowCache));
+    rowCache.history_serial = 1;
+    memset(&nowPlaying, 0, sizeof(nowPlaying));
     
+    log = fopen(logFilepath, "a");
+    if (log == NULL)
+        log = fopen("/dev/null", "a");
+    fprintf(log, "Log Initialized\n");
+
     y = startY;
-    while (key != 'q')
+    while (key != 'q' && key != 'Q')
     {
-        log = fopen(logFilepath, "a");
-        fprintf(log, "Log Initialized\n");
+        scanState = browser_poll(&browser, &files, &file_count);
+        if (scanDone == 0 && scanState != 0)
+        {
+            scanDone = now_ms();
+            scanCount = file_count;
+        }
+        if (browser.listing != shownListing)
+        {
+            // Listed, or came back to a cached directory: restore its cursor.
+            shownListing = browser.listing;
+            if (shownListing != NULL)
+                y = startY + shownListing->cursor;
+            resort = 1;
+            rowCache.stale = 1;
+        }
+        // The daemon appends to the history; pick up its batches now and then.
+        if (now_ms() - historyChecked >= 1000)
+        {
+            historyChecked = now_ms();
+            if (history_refresh(&history))
+            {
+                resort = 1;
+                rowCache.history_serial++;
+            }
+        }
+        if (sortByPlays && shownListing != NULL)
+        {
+            if (resort)
+            {
+                sortedFiles = realloc(sortedFiles, sizeof(char*) * (file_count > 0 ? file_count : 1));
+                sort_by_plays(&history, browser.path, files, file_count, sortedFiles);
+                resort = 0;
+                rowCache.stale = 1;
+            }
+            files = sortedFiles;
+        }
+        if (connectState == 0 && (connectState = client_connect_state(&connector)) != 0)
+        {
+            connected = now_ms();
+            if (connectState == 1)
+            {
+                client = pendingClient;
+                if (prefetchDepth >= 0)
+                    client_set_prefetch(&client, prefetchDepth, (size_t)(prefetchMegabytes * 1048576));
+                client_status(&client, &status, &device, &loadFrom);
+            }
+        }
+        if (interactive == 0 && scanState != 0 && connectState != 0)
+        {
+            interactive = now_ms();
+            inputTimeout = 250;
+            timeout(inputTimeout);
+        }
 
-        clear();
-        wclear(win);
+        // erase, not clear: clear would repaint the whole terminal on every
+        // refresh instead of only the cells that changed.
+        erase();
+        werase(win);
         color_set(3, NULL);
 
         border(0, 0, 0, 0, 0, 0, 0, 0);
         box(win, 0, 0);
 
         wbkgd(win, COLOR_PAIR(1));
-        mvwprintw(win, startY - 1, startX + 1, "File Explor");
-        mvwprintw(win, endY + 1, startX + 1, "UP/DOWN navegate, return select, space pause, ,/. skip, q exit");
+        // Deep paths keep their tail, which is the part that changes.
+        pathShown = browser.path;
+        if ((int)strlen(pathShown) > width - 30)
+            pathShown += strlen(pathShown) - (width > 38 ? width - 30 : 8);
+        mvwprintw(win, startY - 1, startX + 1, "File Explor: %s%s", pathShown,
+                  scanState == 0 ? " - scanning..." : (scanState < 0 ? " - cannot read" : ""));
+        mvwprintw(win, layout.status_y, startX + 1, "UP/DOWN navegate, return select, BACKSPACE up, space pause, ,/. skip, LEFT/RIGHT seek, l latency, z shuffle, r repeat, s sort by plays, q exit, Q stop daemon");
         wbkgd(win, COLOR_PAIR(0));
-        for (i = 0; i < file_count; i++)
+        // The list scrolls to keep the cursor in view, and only the rows
+        // that fit are formatted.
+        if (y - startY < top)
+            top = y - startY;
+        if (height > 0 && y - startY >= top + height)
+            top = y - startY - height + 1;
+        if (top > file_count - 1)
+            top = file_count > 0 ? file_count - 1 : 0;
+        for (i = 0; i < height && top + i < file_count; i++)
         {
-            if (i == (y - startY))
+            // The play count keeps its column free.
+            row = row_cache_row(&rowCache, &tagReader, &history, browser.path, files, file_count, top + i, width > 7 ? width - 7 : 0);
+            if (row == NULL)
+                break;
+            if (top + i == (y - startY))
             {
                 wattron(win, COLOR_PAIR(4));
-                mvwprintw(win, i + 2, 2, "%s", files[i]);
-                mvwhline(win, i + 2, 2 + strlen(files[i]), ' ', width - 2 - strlen(files[i]));
+                mvwprintw(win, i + 2, 2, "%.*s", row->display.cut_bytes, row->display.text);
+                mvwhline(win, i + 2, 2 + row->display.cut_width, ' ', width - 2 - row->display.cut_width);
                 wattroff(win, COLOR_PAIR(4));
             }
-            if (i != (y - 1))
+            else
             {
                 wbkgd(win, COLOR_PAIR(2));
-                mvwprintw(win, i + 2, 2, "%s", files[i]);
+                mvwprintw(win, i + 2, 2, "%.*s", row->display.cut_bytes, row->display.text);
                 wbkgd(win, COLOR_PAIR(0));
             }
+            if (row->plays > 0)
+                mvwprintw(win, i + 2, width - 4, "%4u", row->plays);
         }
 
+        client_status(&client, &status, &device, &loadNow);
+
         wbkgd(win, COLOR_PAIR(3));
         if (cfile != NULL)
         {
-            mvwprintw(stdscr, LINES / 2 - 2, COLS / 2 + 3, "File: %s", remove_extension(cfile));
-            mvwprintw(stdscr, LINES / 2 - 1, COLS / 2 + 3, "Status: %s", player.is_paused ? "||" : "|>");
+            // Measured when the track is picked and again once its tags are in.
+            if (!nowTagged && nowTagsRead != tag_reader_progress(&tagReader))
+            {
+                nowTagsRead = tag_reader_progress(&tagReader);
+                if (tag_reader_get(&tagReader, cfileFilePath, &tags))
+                {
+                    tag_label(label, sizeof(label), cfile, &tags);
+                    snprintf(line, sizeof(line), "Track: %s", label);
+                    nowTagged = display_set(&nowPlaying, line) == 0;
+                }
+            }
+            display_fit(&nowPlaying, layout.side_width);
+            mvwprintw(stdscr, layout.now_y, layout.side_x, "%.*s", nowPlaying.cut_bytes, nowPlaying.text);
+            mvwprintw(stdscr, layout.now_y + 1, layout.side_x, "Status: %s  Shuffle: %s  Repeat: %s", status.is_paused ? "||" : "|>",
+                      status.shuffle ? "on" : "off", player_repeat_name(status.repeat));
         }
         else
         {
-            mvwprintw(stdscr, LINES / 2 - 2, COLS / 2 + 3, "File: None");
-            mvwprintw(stdscr, LINES / 2 - 1, COLS / 2 + 3, "Status: %s", player.is_paused ? "||" : "|>");
+            mvwprintw(stdscr, layout.now_y, layout.side_x, "File: None");
+            mvwprintw(stdscr, layout.now_y + 1, layout.side_x, "Status: %s  Shuffle: %s  Repeat: %s", status.is_paused ? "||" : "|>",
+                      status.shuffle ? "on" : "off", player_repeat_name(status.repeat));
         }
         wbkgd(win, COLOR_PAIR(0));
 
+        if (status.is_active)
+        {
+            waveform_request(&waveform, status.filepath);
+            waveform_draw(&waveform, layout.now_y + 2, layout.side_x, layout.side_width, status.cursor);
+
+            mvwprintw(stdscr, layout.stats_y, layout.side_x, "Source: %s %uch %u Hz  Decoder: %s%s",
+                      player_format_name(status.format.source_format),
+                      status.format.source_channels, status.format.source_rate,
+                      status.format.converted ? "convert " : "",
+                      status.format.resampled ? "resample" : (status.format.converted ? "" : "passthrough"));
+            mvwprintw(stdscr, layout.stats_y + 1, layout.side_x, "Device: %s %uch %u Hz  Backend: %s%s",
+                      player_format_name(device.format), device.channels, device.sample_rate,
+                      device.converted ? "convert " : "",
+                      device.resampled ? "resample" : (device.converted ? "" : "passthrough"));
+        }
+
+        if (loadNow.wall - loadFrom.wall >= 1.0)
+        {
+            client_load_stats(&device, &loadFrom, &loadNow, &load);
+            loadFrom = loadNow;
+        }
+        mvwprintw(stdscr, layout.stats_y + 2, layout.side_x, "Latency: %s  period %u frames (%.1f ms)  %.0f wakeups/s  CPU %.1f%%",
+                  player_latency_name(device.latency), load.period_frames, load.period_ms,
+                  load.wakeups_per_sec, load.cpu_percent);
+        if (client.fd >= 0)
+            mvwprintw(stdscr, layout.stats_y + 3, layout.side_x, "Daemon: round trip %.0f us  (avg %.0f us, max %.0f us)",
+                      client.rtt_last * 1e6, client.rtt_total / client.rtt_count * 1e6, client.rtt_max * 1e6);
+        else
+            mvwprintw(stdscr, layout.stats_y + 3, layout.side_x, connectState == 0 ? "Daemon: starting..." : "Daemon: disconnected");
+        if (file_count > 0 && y - startY < file_count && history_entry(&history, browser.path, files[y - startY], &played))
+        {
+            time_t lastPlayed = (time_t)(played.last_played / 1000);
+            char when[32] = "never";
+
+            if (played.last_played > 0)
+                strftime(when, sizeof(when), "%Y-%m-%d %H:%M", localtime(&lastPlayed));
+            mvwprintw(stdscr, layout.stats_y + 4, layout.side_x, "History: played %u, finished %u, skipped %u, last %s",
+                      played.plays, played.completions, played.skips, when);
+        }
+        if (history_most_skipped(&history, &played, 1) == 1)
+            mvwprintw(stdscr, layout.stats_y + 5, layout.side_x, "Most skipped: %s (%u)", get_filename(played.name), played.skips);
+        if (inputFrames > 0)
+            mvwprintw(stdscr, layout.stats_y + 6, layout.side_x, "Input: %.1f ms to screen (avg %.1f ms, max %.1f ms), %.1f keys per frame",
+                      inputLatency, inputLatencyTotal / inputFrames, inputLatencyMax, (double)inputKeys / inputFrames);
+
         refresh();
         wrefresh(win);
+        if (firstFrame == 0)
+            firstFrame = now_ms();
+        if (inputAt > 0)
+        {
+            // The frame showing the last input is on screen.
+            inputLatency = now_ms() - inputAt;
+            inputLatencyTotal += inputLatency;
+            if (inputLatency > inputLatencyMax)
+                inputLatencyMax = inputLatency;
+            inputFrames++;
+            inputAt = 0;
+        }
 
+        // A key that is already waiting came in while the last frame was
+        // drawn, so it is counted from when the input was last seen empty;
+        // one that has to be waited for is counted from when it arrives.
+        timeout(0);
         key = getch();
-        if (key == KEY_UP)
+        timeout(inputTimeout);
+        if (key != ERR)
         {
-            y--;
+            inputAt = inputIdle > 0 ? inputIdle : now_ms();
+        }
+        else
+        {
+            inputIdle = now_ms();
+            key = getch();
+            if (key != ERR)
+                inputAt = now_ms();
+            else
+                inputIdle = now_ms();
+        }
+        if (key != ERR)
+            inputKeys++;
+        if (key == KEY_UP || key == KEY_DOWN)
+        {
+            // A held arrow queues events faster than frames are drawn. Take
+            // every one already waiting and draw once; anything else goes
+            // back for the next pass.
+            steps = key == KEY_DOWN ? 1 : -1;
+            timeout(0);
+            while ((next = getch()) == KEY_UP || next == KEY_DOWN)
+            {
+                steps += next == KEY_DOWN ? 1 : -1;
+                inputKeys++;
+            }
+            if (next == ERR)
+                inputIdle = now_ms();
+            else
+                ungetch(next);
+            timeout(inputTimeout);
+
+            y += steps;
+            if (y > startY + file_count - 1 && file_count > 0) y = startY + file_count - 1;
             if (y < startY) y = startY;
         }
-        if (key == KEY_DOWN)
+        if (key == KEY_RESIZE)
         {
-            y++;
-            if (y > startY + file_count - 1) y = startY + file_count - 1;
+            // ncurses has taken the new size from SIGWINCH; the panes follow
+            // it and the list rows are reformatted to the new width.
+            layout_compute(&layout, LINES, COLS);
+            width = layout.list_width;
+            height = layout.list_rows;
+            wresize(win, height + 3, width + 3);
+            // The terminal's old contents are unknown now: repaint it all once.
+            clearok(curscr, TRUE);
         }
         if (key == ' ')
         {
-            player_toggle_pause(&player);
+            client_toggle_pause(&client);
         }
         if (key == '.')
         {
-            player_skip_next(&player);
+            client_skip_next(&client);
         }
         if (key == ',')
         {
-            player_skip_previous(&player);
+            client_skip_previous(&client);
+        }
+        if ((key == KEY_LEFT || key == KEY_RIGHT) && status.is_active && device.sample_rate > 0)
+        {
+            double position = (double)status.cursor / device.sample_rate;
+            client_seek(&client, position + (key == KEY_RIGHT ? 10.0 : -10.0));
+        }
+        if (key == 'l')
+        {
+            client_set_latency(&client, (PlayerLatencyProfile)((device.latency + 1) % PLAYER_LATENCY_COUNT));
+            client_status(&client, &status, &device, &loadFrom);
+        }
+        if (key == 'Q')
+        {
+            client_shutdown(&client);
+        }
+        if (key == 'z')
+        {
+            client_set_shuffle(&client, !status.shuffle);
+        }
+        if (key == 'r')
+        {
+            client_set_repeat(&client, (PlayerRepeatMode)((status.repeat + 1) % PLAYER_REPEAT_COUNT));
+        }
+        if (key == 's')
+        {
+            sortByPlays = !sortByPlays;
+            resort = 1;
         }
-        if (key == KEY_ENTER || key == '\n' || key == '\r')
+        if (key == KEY_BACKSPACE || key == 127 || key == 8)
         {
-            cfile = files[y - 1];
-            mvwprintw(stdscr, 15, COLS / 2 + 3, cfile);
-            snprintf(cfileFilePath, sizeof(cfileFilePath), "%s/%s", music_dir, cfile);
-            mvwprintw(win, LINES / 2 + 4, startX, cfile);
+            char parent[PATH_MAX];
+            char* slash;
+
+            snprintf(parent, sizeof(parent), "%s", browser.path);
+            slash = strrchr(parent, '/');
+            if (slash != NULL && slash[1] != '\0')
+            {
+                char child[NAME_MAX + 2];
+
+                snprintf(child, sizeof(child), "%s/", slash + 1);
+                if (slash == parent)
+                    slash++;
+                *slash = '\0';
+                if (browser.listing != NULL)
+                    browser.listing->cursor = y - startY;
+                browser_open(&browser, parent, child);
+                shownListing = NULL;
+                y = startY;
+                continue;
+            }
+        }
+        if ((key == KEY_ENTER || key == '\n' || key == '\r') && file_count > 0 &&
+            files[y - 1][strlen(files[y - 1]) - 1] == '/')
+        {
+            char child[PATH_MAX];
+            int len;
+
+            if (strcmp(browser.path, "/") == 0)
+                len = snprintf(child, sizeof(child), "/%s", files[y - 1]);
+            else
+                len = snprintf(child, sizeof(child), "%s/%s", browser.path, files[y - 1]);
+            // A cut-off path would open some other directory, or none.
+            if (len < 0 || (size_t)len >= sizeof(child))
+            {
+                beep();
+                continue;
+            }
+            child[len - 1] = '\0';
+            if (browser.listing != NULL)
+                browser.listing->cursor = y - startY;
+            browser_open(&browser, child, "");
+            shownListing = NULL;
+            y = startY;
+            continue;
+        }
+        if ((key == KEY_ENTER || key == '\n' || key == '\r') && file_count > 0)
+        {
+            // Copied: the listing it came from may be evicted while it plays.
+            snprintf(cfileName, sizeof(cfileName), "%s", files[y - 1]);
+            cfile = cfileName;
+            snprintf(line, sizeof(line), "File: %s", remove_extension(cfile));
+            display_set(&nowPlaying, line);
+            nowTagged = 0;
+            nowTagsRead = 0;
+            snprintf(cfileFilePath, sizeof(cfileFilePath), "%s/%s", browser.path, cfile);
             if (strcmp(cfile, ".") == 0)
             {
-                mvwprintw(stdscr, LINES / 2 - 3, COLS / 2 + 4, "Dot Detected.");
+                mvwprintw(stdscr, layout.now_y - 1, layout.side_x + 1, "Dot Detected.");
                 fprintf(log, "Dot Detected.\n");
                 
                 char **fullPaths = malloc(sizeof(char*) * (file_count - 1));
@@ -633,16 +1278,16 @@ int main()
                 {
                     if (is_audio_file(files[i]))
                     {
-                        size_t path_len = strlen(music_dir) + strlen(files[i]) + 2;
+                        size_t path_len = strlen(browser.path) + strlen(files[i]) + 2;
                         fullPaths[playlistCount] = malloc(path_len);
-                        snprintf(fullPaths[playlistCount], path_len, "%s/%s", music_dir, files[i]);
+                        snprintf(fullPaths[playlistCount], path_len, "%s/%s", browser.path, files[i]);
                         playlistCount++;
                     }
                 }
                 
                 if (playlistCount > 0)
                 {
-                    if (player_play_playlist(&player, fullPaths, playlistCount) == -1)
+                    if (client_play_playlist(&client, fullPaths, playlistCount) == -1)
                     {
                         fprintf(log, "ERROR: Failed to play playlist\n");
                     }
@@ -658,22 +1303,44 @@ int main()
                 }
                 free(fullPaths);
             }
+            else if (is_playlist_file(cfile))
+            {
+                client_load_playlist(&client, cfileFilePath);
+            }
             else
             {
-                player_play_file(&player, cfileFilePath);
+                client_play_file(&client, cfileFilePath);
             }
         }
-        fclose(log);
     }
+    fclose(log);
+
+    waveform_worker_stop(&waveform);
+    fault_vfs_uninit(&waveformIo);
+    client_connect_finish(&connector);
+    if (connectState == 0 && client_connect_state(&connector) == 1)
+        client_close(&pendingClient);
+    client_close(&client);
+    if (exporting)
+        metrics_exporter_stop(&exporter);
+    browser_free(&browser);
+    history_close(&history);
+    tag_reader_stop(&tagReader);
+    row_cache_free(&rowCache);
+    display_free(&nowPlaying);
+    free(sortedFiles);
 
-    player_cleanup(&player);
-    for (i = 0; i < file_count; i++)
+    endwin();
+
+    if (startupTrace)
     {
-        free(files[i]);
+        fprintf(stderr, "startup: first frame %.1f ms, library %.1f ms (%d entries), daemon %.1f ms, interactive %.1f ms\n",
+                firstFrame - startTime, scanDone - startTime, scanCount,
+                connected - startTime, interactive > 0 ? interactive - startTime : -1.0);
+        if (inputFrames > 0)
+            fprintf(stderr, "input: %d keys in %d frames, to screen avg %.1f ms, max %.1f ms\n",
+                    inputKeys, inputFrames, inputLatencyTotal / inputFrames, inputLatencyMax);
     }
-    free(files);
-
-    endwin();
 
     return 0;
 }
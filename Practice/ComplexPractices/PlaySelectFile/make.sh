@@ -0,0 +1,6 @@
+#!/bin/bash
+
+set -e
+cd "$(dirname "$0")"
+../PlayerCore/make.sh
+gcc $@ -I../PlayerCore psf.c ../PlayerCore/build/libplayercore.a -lncurses -lpthread -lm -ldl -o psf
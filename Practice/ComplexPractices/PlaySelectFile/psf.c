@@ -1,5 +1,65 @@
 #include <stdio.h>
 #include <ncurses.h>
-#include "miniaudio.h"
+#include "player.h"
+#include "library.h"
 
+int main(int argc, char** argv)
+{
+    MiniaudioPlayer* player;
+    PlayerStatus status;
+    PlayerDeviceInfo device;
+    int key = 0;
 
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <audio file>\n", argv[0]);
+        return 1;
+    }
+
+    player = player_create(PLAYER_FORMAT_FIXED, PLAYER_LATENCY_BALANCED);
+    if (player == NULL)
+    {
+        fprintf(stderr, "Failed to initialize playback device.\n");
+        return 1;
+    }
+
+    if (player_play_file(player, argv[1]) != 0)
+    {
+        fprintf(stderr, "Failed to load file: %s\n", argv[1]);
+        player_destroy(player);
+        return 1;
+    }
+
+    initscr();
+    curs_set(0);
+    cbreak();
+    noecho();
+    keypad(stdscr, TRUE);
+    timeout(250);
+
+    while (key != 'q')
+    {
+        player_get_status(player, &status);
+        player_get_device_info(player, &device);
+
+        ma_uint64 seconds = device.sample_rate > 0 ? status.cursor / device.sample_rate : 0;
+
+        clear();
+        mvprintw(1, 2, "File: %s", get_filename(argv[1]));
+        mvprintw(2, 2, "Time: %llu:%02llu", (unsigned long long)(seconds / 60), (unsigned long long)(seconds % 60));
+        mvprintw(3, 2, "Status: %s", !status.is_active ? "done" : (status.is_paused ? "||" : "|>"));
+        mvprintw(5, 2, "space pause, q exit");
+        refresh();
+
+        key = getch();
+        if (key == ' ')
+        {
+            player_toggle_pause(player);
+        }
+    }
+
+    endwin();
+    player_destroy(player);
+
+    return 0;
+}
@@ -0,0 +1,156 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Each block starts with its size, so realloc knows how much to copy.
+#define ARENA_ALIGN 16
+#define ARENA_HEADER ARENA_ALIGN
+
+static __thread int arena_audio_thread;
+
+void arena_enter_audio_thread(void)
+{
+    arena_audio_thread = 1;
+}
+
+int arena_on_audio_thread(void)
+{
+    return arena_audio_thread;
+}
+
+static void arena_count(DecoderArena* arena, int system)
+{
+    ArenaCounters* counters = arena->counters;
+
+    if (counters == NULL)
+        return;
+    __atomic_add_fetch(system ? &counters->system_allocs : &counters->allocs, 1, __ATOMIC_RELAXED);
+    if (arena_audio_thread)
+        __atomic_add_fetch(system ? &counters->audio_system_allocs : &counters->audio_allocs, 1, __ATOMIC_RELAXED);
+}
+
+static int arena_owns(DecoderArena* arena, void* p)
+{
+    return (unsigned char*)p >= arena->base && (unsigned char*)p < arena->base + arena->size;
+}
+
+static size_t arena_block_size(void* p)
+{
+    return *(size_t*)((unsigned char*)p - ARENA_HEADER);
+}
+
+static void* arena_malloc(size_t size, void* user)
+{
+    DecoderArena* arena = (DecoderArena*)user;
+    size_t need = ARENA_HEADER + ((size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1));
+
+    if (arena->base == NULL || need > arena->size - arena->used)
+    {
+        arena_count(arena, 1);
+        return malloc(size);
+    }
+
+    unsigned char* block = arena->base + arena->used;
+    *(size_t*)block = size;
+    arena->last = arena->used;
+    arena->used += need;
+    if (arena->used > arena->peak)
+        arena->peak = arena->used;
+    arena_count(arena, 0);
+    return block + ARENA_HEADER;
+}
+
+static void arena_free(void* p, void* user)
+{
+    DecoderArena* arena = (DecoderArena*)user;
+
+    if (p == NULL)
+        return;
+    if (!arena_owns(arena, p))
+    {
+        free(p);
+        return;
+    }
+    // Only the newest block can be given back before the reset.
+    if ((unsigned char*)p - ARENA_HEADER == arena->base + arena->last)
+        arena->used = arena->last;
+}
+
+static void* arena_realloc(void* p, size_t size, void* user)
+{
+    DecoderArena* arena = (DecoderArena*)user;
+
+    if (p == NULL)
+        return arena_malloc(size, user);
+    if (!arena_owns(arena, p))
+    {
+        arena_count(arena, 1);
+        return realloc(p, size);
+    }
+
+    size_t old = arena_block_size(p);
+    size_t need = ARENA_HEADER + ((size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1));
+
+    // The newest block grows or shrinks where it is.
+    if ((unsigned char*)p - ARENA_HEADER == arena->base + arena->last && need <= arena->size - arena->last)
+    {
+        *(size_t*)((unsigned char*)p - ARENA_HEADER) = size;
+        arena->used = arena->last + need;
+        if (arena->used > arena->peak)
+            arena->peak = arena->used;
+        arena_count(arena, 0);
+        return p;
+    }
+    if (size <= old)
+        return p;
+
+    void* moved = arena_malloc(size, user);
+    if (moved != NULL)
+        memcpy(moved, p, old);
+    return moved;
+}
+
+int arena_init(DecoderArena* arena, size_t size, ArenaCounters* counters)
+{
+    memset(arena, 0, sizeof(*arena));
+    arena->counters = counters;
+    arena->base = malloc(size);
+    if (arena->base == NULL)
+        return -1;
+    // Touched now so the audio thread never takes the page faults.
+    memset(arena->base, 0, size);
+    arena->size = size;
+    return 0;
+}
+
+void arena_uninit(DecoderArena* arena)
+{
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+}
+
+void arena_reset(DecoderArena* arena)
+{
+    arena->used = 0;
+    arena->last = 0;
+}
+
+ma_allocation_callbacks arena_callbacks(DecoderArena* arena)
+{
+    ma_allocation_callbacks callbacks;
+
+    callbacks.pUserData = arena;
+    callbacks.onMalloc = arena_malloc;
+    callbacks.onRealloc = arena_realloc;
+    callbacks.onFree = arena_free;
+    return callbacks;
+}
+
+void arena_get_counters(const ArenaCounters* counters, ArenaCounters* out)
+{
+    out->allocs = __atomic_load_n(&counters->allocs, __ATOMIC_RELAXED);
+    out->audio_allocs = __atomic_load_n(&counters->audio_allocs, __ATOMIC_RELAXED);
+    out->system_allocs = __atomic_load_n(&counters->system_allocs, __ATOMIC_RELAXED);
+    out->audio_system_allocs = __atomic_load_n(&counters->audio_system_allocs, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,43 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "miniaudio.h"
+
+// Memory for one decoder: a block allocated and touched up front, handed out
+// by bumping an offset and given back all at once when the decoder closes.
+// It is passed to miniaudio as allocation callbacks, so a decoder never calls
+// malloc or free itself, whichever thread it happens to run on. A request the
+// block can't hold goes to malloc and is counted.
+
+#define ARENA_SIZE (2u << 20)
+
+typedef struct
+{
+    ma_uint64 allocs;               // served from arenas
+    ma_uint64 audio_allocs;         // of those, on the audio thread
+    ma_uint64 system_allocs;        // arena full: passed on to malloc
+    ma_uint64 audio_system_allocs;  // of those, on the audio thread; should stay 0
+} ArenaCounters;
+
+typedef struct
+{
+    unsigned char* base;
+    size_t size;
+    size_t used;
+    size_t last;                    // offset of the newest block, which can grow in place
+    size_t peak;
+    ArenaCounters* counters;        // shared by a player's arenas
+} DecoderArena;
+
+int arena_init(DecoderArena* arena, size_t size, ArenaCounters* counters);
+void arena_uninit(DecoderArena* arena);
+// Forgets every block; call once the decoder using it is uninitialised.
+void arena_reset(DecoderArena* arena);
+ma_allocation_callbacks arena_callbacks(DecoderArena* arena);
+
+// Marks the calling thread as the audio thread for the counters.
+void arena_enter_audio_thread(void);
+int arena_on_audio_thread(void);
+void arena_get_counters(const ArenaCounters* counters, ArenaCounters* out);
+
+#endif
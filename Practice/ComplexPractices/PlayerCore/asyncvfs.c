@@ -0,0 +1,883 @@
+#include "asyncvfs.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define ASYNC_VFS_HAVE_URING
+#endif
+
+enum
+{
+    BLOCK_EMPTY,
+    BLOCK_PENDING,
+    BLOCK_READY
+};
+
+typedef struct AsyncFile AsyncFile;
+
+// The reading thread owns a block while it is empty or ready and the I/O
+// threads while it is pending. state is stored with release and loaded with
+// acquire, which hands the other fields over with it.
+struct AsyncBlock
+{
+    AsyncFile* file;
+    AsyncBlock* queued_next;
+    ma_uint64 offset;
+    size_t length;              // valid bytes once ready
+    int state;
+    int error;
+    struct iovec iov;
+    unsigned char* data;
+};
+
+#ifdef ASYNC_VFS_HAVE_URING
+// Just enough of io_uring for reads, without liburing.
+typedef struct
+{
+    int fd;
+    void* sq_ptr;
+    size_t sq_size;
+    void* cq_ptr;
+    size_t cq_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+} UringRing;
+#endif
+
+struct AsyncFile
+{
+    AsyncVfs* vfs;
+    AsyncFile* next;            // in vfs->files
+    int fd;
+    ma_uint64 size;
+    ma_uint64 position;
+    AsyncBlock blocks[ASYNC_VFS_MAX_DEPTH];
+    unsigned char* data;
+    // Blocks to read, by index: the reading thread is the only producer and
+    // the dispatcher the only consumer. A block is requested again only after
+    // it landed, so the ring cannot overflow.
+    int requests[ASYNC_VFS_MAX_DEPTH];
+    unsigned request_head;      // dispatcher's
+    unsigned request_tail;
+    // With a source VFS there is no fd; its seek and read must go together.
+    ma_vfs_file source_file;
+    pthread_mutex_t source_lock;
+    // Completions broadcast here for a reader that ran out of data.
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+#ifdef ASYNC_VFS_HAVE_URING
+    UringRing ring;
+    int uring;
+#endif
+};
+
+static ma_uint64 async_vfs_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (ma_uint64)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Two decoders may read on different threads, so these are read-modify-writes.
+static void async_vfs_count(ma_uint64* counter, ma_uint64 amount)
+{
+    __atomic_add_fetch(counter, amount, __ATOMIC_RELAXED);
+}
+
+#ifdef ASYNC_VFS_HAVE_URING
+static void uring_free(UringRing* ring)
+{
+    if (ring->sqes != NULL)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_size);
+    if (ring->sq_ptr != NULL)
+        munmap(ring->sq_ptr, ring->sq_size);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+static int uring_setup(UringRing* ring, unsigned entries)
+{
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+        return -1;
+
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_size > ring->sq_size)
+            ring->sq_size = ring->cq_size;
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+    {
+        ring->sq_ptr = NULL;
+        uring_free(ring);
+        return -1;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        ring->cq_ptr = ring->sq_ptr;
+    else
+    {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED)
+        {
+            ring->cq_ptr = NULL;
+            uring_free(ring);
+            return -1;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        ring->sqes = NULL;
+        uring_free(ring);
+        return -1;
+    }
+
+    ring->sq_tail = (unsigned*)((char*)ring->sq_ptr + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)((char*)ring->sq_ptr + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)((char*)ring->sq_ptr + params.sq_off.array);
+    ring->cq_head = (unsigned*)((char*)ring->cq_ptr + params.cq_off.head);
+    ring->cq_tail = (unsigned*)((char*)ring->cq_ptr + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)((char*)ring->cq_ptr + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)((char*)ring->cq_ptr + params.cq_off.cqes);
+
+    return 0;
+}
+
+static int uring_enter(UringRing* ring, unsigned submit, unsigned wait)
+{
+    for (;;)
+    {
+        long result = syscall(__NR_io_uring_enter, ring->fd, submit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (result >= 0)
+            return 0;
+        if (errno != EINTR)
+            return -1;
+    }
+}
+
+// Completions post to the dispatcher's eventfd, so one wait covers new
+// requests and finished reads (kernel 5.2 and later).
+static int uring_register_wake(UringRing* ring, int wake_fd)
+{
+    return syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_EVENTFD, &wake_fd, 1) == 0 ? 0 : -1;
+}
+
+// READV rather than READ so kernels back to 5.1 can run it. There are never
+// more reads in flight than ring entries, so the ring cannot overflow.
+static int uring_submit_read(UringRing* ring, int fd, AsyncBlock* block, ma_uint64 user_data)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)&block->iov;
+    sqe->len = 1;
+    sqe->off = block->offset;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    return uring_enter(ring, 1, 0);
+}
+
+static int uring_probe(void)
+{
+    UringRing ring;
+
+    if (uring_setup(&ring, 1) != 0)
+        return -1;
+    uring_free(&ring);
+    return 0;
+}
+#endif
+
+// Runs on the I/O threads. The lock is only for a reader asleep in
+// async_file_wait; one that finds the block ready never takes it.
+static void async_block_complete(AsyncFile* file, AsyncBlock* block, long result)
+{
+    pthread_mutex_lock(&file->lock);
+    block->error = result < 0;
+    block->length = result > 0 ? (size_t)result : 0;
+    __atomic_store_n(&block->state, BLOCK_READY, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&file->done);
+    pthread_mutex_unlock(&file->lock);
+}
+
+#ifdef ASYNC_VFS_HAVE_URING
+// Dispatcher only.
+static void async_file_reap(AsyncFile* file)
+{
+    UringRing* ring = &file->ring;
+    unsigned head = *ring->cq_head;
+
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+        async_block_complete(file, &file->blocks[cqe->user_data], cqe->res);
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+#endif
+
+// Fills the block from the file, or from the source VFS. Returns the bytes
+// read, -1 on error.
+static long async_block_read(AsyncBlock* block)
+{
+    AsyncFile* file = block->file;
+    ma_vfs* source = file->vfs->source;
+    size_t total = 0;
+
+    if (file->source_file != NULL)
+    {
+        ma_result result = MA_SUCCESS;
+
+        pthread_mutex_lock(&file->source_lock);
+        if (ma_vfs_seek(source, file->source_file, (ma_int64)block->offset, ma_seek_origin_start) != MA_SUCCESS)
+            result = MA_IO_ERROR;
+        while (result == MA_SUCCESS && total < ASYNC_VFS_BLOCK)
+        {
+            size_t n = 0;
+            result = ma_vfs_read(source, file->source_file, block->data + total, ASYNC_VFS_BLOCK - total, &n);
+            total += n;
+            if (n == 0)
+                break;
+        }
+        pthread_mutex_unlock(&file->source_lock);
+        return result == MA_SUCCESS || result == MA_AT_END ? (long)total : -1;
+    }
+
+    while (total < ASYNC_VFS_BLOCK)
+    {
+        ssize_t n = pread(file->fd, block->data + total, ASYNC_VFS_BLOCK - total, block->offset + total);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        total += n;
+    }
+    return (long)total;
+}
+
+static void* async_vfs_worker(void* arg)
+{
+    AsyncVfs* vfs = (AsyncVfs*)arg;
+
+    for (;;)
+    {
+        AsyncBlock* block;
+
+        pthread_mutex_lock(&vfs->lock);
+        while (vfs->queue_head == NULL && !vfs->quit)
+            pthread_cond_wait(&vfs->work, &vfs->lock);
+        block = vfs->queue_head;
+        if (block == NULL)
+        {
+            pthread_mutex_unlock(&vfs->lock);
+            break;
+        }
+        vfs->queue_head = block->queued_next;
+        if (vfs->queue_head == NULL)
+            vfs->queue_tail = NULL;
+        pthread_mutex_unlock(&vfs->lock);
+
+        async_block_complete(block->file, block, async_block_read(block));
+    }
+
+    return NULL;
+}
+
+// Never blocks: the counter cannot come near overflowing, and a full pipe
+// already means a wake is pending. Not for the read path, which the
+// dispatcher polls instead, except for a reader that is about to wait anyway.
+static void async_vfs_wake(AsyncVfs* vfs)
+{
+#ifdef __linux__
+    eventfd_write(vfs->wake_fd[1], 1);
+#else
+    char byte = 1;
+    ssize_t ignored = write(vfs->wake_fd[1], &byte, 1);
+    (void)ignored;
+#endif
+}
+
+// Sleeps until woken or timeout_ms passes (-1: no timeout).
+static void async_vfs_wait_wake(AsyncVfs* vfs, int timeout_ms)
+{
+    struct pollfd wake = { vfs->wake_fd[0], POLLIN, 0 };
+
+    if (poll(&wake, 1, timeout_ms) <= 0 || (wake.revents & POLLIN) == 0)
+        return;
+#ifdef __linux__
+    eventfd_t value;
+    while (eventfd_read(vfs->wake_fd[0], &value) != 0 && errno == EINTR)
+        ;
+#else
+    char drain[64];
+    while (read(vfs->wake_fd[0], drain, sizeof(drain)) < 0 && errno == EINTR)
+        ;
+#endif
+}
+
+// Called with vfs->lock held.
+static void async_vfs_dispatch(AsyncVfs* vfs, AsyncFile* file, AsyncBlock* block)
+{
+#ifdef ASYNC_VFS_HAVE_URING
+    if (file->uring)
+    {
+        if (uring_submit_read(&file->ring, file->fd, block, (ma_uint64)(block - file->blocks)) != 0)
+            async_block_complete(file, block, -1);
+        return;
+    }
+#endif
+
+    block->queued_next = NULL;
+    if (vfs->queue_tail != NULL)
+        vfs->queue_tail->queued_next = block;
+    else
+        vfs->queue_head = block;
+    vfs->queue_tail = block;
+    pthread_cond_signal(&vfs->work);
+}
+
+// Takes requests off every open file's ring and starts them, and with
+// io_uring reaps what finished. Everything that can block in this VFS
+// happens here or on the pool. Readers don't wake it for read-ahead, so while
+// files are open it looks at their rings every interval, which doubles from
+// ASYNC_VFS_POLL_MIN_MS to ASYNC_VFS_POLL_MAX_MS while nothing is asked for.
+static void* async_vfs_dispatcher(void* arg)
+{
+    AsyncVfs* vfs = (AsyncVfs*)arg;
+    int interval = ASYNC_VFS_POLL_MIN_MS;
+    int timeout = -1;
+
+    for (;;)
+    {
+        int dispatched = 0;
+
+        async_vfs_wait_wake(vfs, timeout);
+
+        pthread_mutex_lock(&vfs->lock);
+        if (vfs->quit)
+        {
+            pthread_mutex_unlock(&vfs->lock);
+            break;
+        }
+        for (AsyncFile* file = vfs->files; file != NULL; file = file->next)
+        {
+            unsigned tail = __atomic_load_n(&file->request_tail, __ATOMIC_ACQUIRE);
+
+#ifdef ASYNC_VFS_HAVE_URING
+            if (file->uring)
+                async_file_reap(file);
+#endif
+            while (file->request_head != tail)
+            {
+                int index = file->requests[file->request_head % ASYNC_VFS_MAX_DEPTH];
+                file->request_head++;
+                async_vfs_dispatch(vfs, file, &file->blocks[index]);
+                dispatched = 1;
+            }
+        }
+        if (dispatched)
+            interval = ASYNC_VFS_POLL_MIN_MS;
+        else if (interval < ASYNC_VFS_POLL_MAX_MS)
+            interval *= 2;
+        timeout = vfs->files != NULL ? interval : -1;
+        pthread_mutex_unlock(&vfs->lock);
+    }
+
+    return NULL;
+}
+
+// Called with vfs->lock held. The pool is only needed by files that don't
+// have a ring of their own.
+static int async_vfs_start_threads(AsyncVfs* vfs, int pool)
+{
+    if (!vfs->dispatching)
+    {
+        if (pthread_create(&vfs->dispatcher, NULL, async_vfs_dispatcher, vfs) != 0)
+            return -1;
+        vfs->dispatching = 1;
+    }
+    while (pool && vfs->worker_count < ASYNC_VFS_WORKERS)
+    {
+        if (pthread_create(&vfs->workers[vfs->worker_count], NULL, async_vfs_worker, vfs) != 0)
+            break;
+        vfs->worker_count++;
+    }
+    return !pool || vfs->worker_count > 0 ? 0 : -1;
+}
+
+// Queues a read of the block for the dispatcher, which picks it up on its next
+// poll. The reading thread does no more than this, so it takes no lock and
+// makes no syscall.
+static void async_file_request(AsyncFile* file, AsyncBlock* block, ma_uint64 offset)
+{
+    unsigned tail = __atomic_load_n(&file->request_tail, __ATOMIC_RELAXED);
+
+    block->offset = offset;
+    block->length = 0;
+    block->error = 0;
+    __atomic_store_n(&block->state, BLOCK_PENDING, __ATOMIC_RELAXED);
+    file->requests[tail % ASYNC_VFS_MAX_DEPTH] = (int)(block - file->blocks);
+    __atomic_store_n(&file->request_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static int async_block_state(AsyncBlock* block)
+{
+    return __atomic_load_n(&block->state, __ATOMIC_ACQUIRE);
+}
+
+// Sleeps until a pending read lands. The read may still be on the ring, so
+// the dispatcher is woken rather than left to its next poll.
+static void async_file_wait(AsyncFile* file, AsyncBlock* block)
+{
+    if (async_block_state(block) != BLOCK_PENDING)
+        return;
+
+    async_vfs_wake(file->vfs);
+    pthread_mutex_lock(&file->lock);
+    while (async_block_state(block) == BLOCK_PENDING)
+        pthread_cond_wait(&file->done, &file->lock);
+    pthread_mutex_unlock(&file->lock);
+}
+
+// async_file_wait on the read path, where it means the reader outran the
+// disk.
+static void async_file_stall(AsyncFile* file, AsyncBlock* block)
+{
+    AsyncVfs* vfs = file->vfs;
+    ma_uint64 start = async_vfs_now();
+
+    async_file_wait(file, block);
+    async_vfs_count(&vfs->counters.stalls, 1);
+    async_vfs_count(&vfs->counters.stall_ns, async_vfs_now() - start);
+}
+
+static AsyncBlock* async_file_find(AsyncFile* file, ma_uint64 offset)
+{
+    for (int i = 0; i < ASYNC_VFS_MAX_DEPTH; i++)
+    {
+        AsyncBlock* block = &file->blocks[i];
+        if (async_block_state(block) != BLOCK_EMPTY && block->offset == offset)
+            return block;
+    }
+    return NULL;
+}
+
+// A block outside [start, end) to reuse. The window is at most as many blocks
+// as the file has, so one is always outside it when a block in it is missing,
+// but it
+// may still be a read left over from before a seek. Its buffer is the I/O
+// threads' until it lands: read-ahead skips it (NULL), a read that needs it
+// waits.
+static AsyncBlock* async_file_claim(AsyncFile* file, ma_uint64 start, ma_uint64 end, int wait)
+{
+    AsyncBlock* pending = NULL;
+
+    for (int i = 0; i < ASYNC_VFS_MAX_DEPTH; i++)
+    {
+        AsyncBlock* block = &file->blocks[i];
+        int state = async_block_state(block);
+
+        if (state == BLOCK_EMPTY)
+            return block;
+        if (block->offset >= start && block->offset < end)
+            continue;
+        if (state == BLOCK_READY)
+            return block;
+        pending = block;
+    }
+
+    if (!wait)
+        return NULL;
+    async_file_stall(file, pending);
+    return pending;
+}
+
+// Makes sure the block at base and the depth - 1 after it are read or being
+// read, and returns the one at base.
+static AsyncBlock* async_file_fill(AsyncFile* file, ma_uint64 base)
+{
+    int depth = __atomic_load_n(&file->vfs->depth, __ATOMIC_RELAXED);
+    ma_uint64 end = base + (ma_uint64)depth * ASYNC_VFS_BLOCK;
+
+    for (ma_uint64 offset = base; offset < end && offset < file->size; offset += ASYNC_VFS_BLOCK)
+    {
+        if (async_file_find(file, offset) == NULL)
+        {
+            AsyncBlock* block = async_file_claim(file, base, end, offset == base);
+            if (block == NULL)
+                break;
+            async_file_request(file, block, offset);
+        }
+    }
+
+    return async_file_find(file, base);
+}
+
+static void async_file_release(AsyncFile* file)
+{
+    if (file->source_file != NULL)
+        ma_vfs_close(file->vfs->source, file->source_file);
+    if (file->fd >= 0)
+        close(file->fd);
+    free(file->data);
+    free(file);
+}
+
+static ma_result async_vfs_open(ma_vfs* pVFS, const char* pFilePath, ma_uint32 openMode, ma_vfs_file* pFile)
+{
+    AsyncVfs* vfs = (AsyncVfs*)pVFS;
+    AsyncFile* file;
+    struct stat info;
+
+    *pFile = NULL;
+    if ((openMode & MA_OPEN_MODE_WRITE) != 0)
+        return MA_NOT_IMPLEMENTED;
+
+    file = calloc(1, sizeof(AsyncFile));
+    if (file == NULL)
+        return MA_OUT_OF_MEMORY;
+
+    file->vfs = vfs;
+    file->fd = -1;
+    if (vfs->source != NULL)
+    {
+        ma_file_info sourceInfo;
+        ma_result result = ma_vfs_open(vfs->source, pFilePath, MA_OPEN_MODE_READ, &file->source_file);
+
+        if (result == MA_SUCCESS && ma_vfs_info(vfs->source, file->source_file, &sourceInfo) != MA_SUCCESS)
+        {
+            ma_vfs_close(vfs->source, file->source_file);
+            result = MA_ERROR;
+        }
+        if (result != MA_SUCCESS)
+        {
+            free(file);
+            return result;
+        }
+        file->size = sourceInfo.sizeInBytes;
+    }
+    else
+    {
+        file->fd = open(pFilePath, O_RDONLY | O_CLOEXEC);
+        if (file->fd < 0)
+        {
+            ma_result result = errno == ENOENT ? MA_DOES_NOT_EXIST : MA_ERROR;
+            free(file);
+            return result;
+        }
+        if (fstat(file->fd, &info) != 0)
+        {
+            close(file->fd);
+            free(file);
+            return MA_ERROR;
+        }
+        file->size = (ma_uint64)info.st_size;
+    }
+    file->data = malloc((size_t)ASYNC_VFS_MAX_DEPTH * ASYNC_VFS_BLOCK);
+    if (file->data == NULL)
+    {
+        async_file_release(file);
+        return MA_OUT_OF_MEMORY;
+    }
+    pthread_mutex_init(&file->source_lock, NULL);
+    pthread_mutex_init(&file->lock, NULL);
+    pthread_cond_init(&file->done, NULL);
+
+    for (int i = 0; i < ASYNC_VFS_MAX_DEPTH; i++)
+    {
+        AsyncBlock* block = &file->blocks[i];
+        block->file = file;
+        block->data = file->data + (size_t)i * ASYNC_VFS_BLOCK;
+        block->iov.iov_base = block->data;
+        block->iov.iov_len = ASYNC_VFS_BLOCK;
+    }
+
+    int pool = 1;
+#ifdef ASYNC_VFS_HAVE_URING
+    file->ring.fd = -1;
+    if (vfs->backend == ASYNC_VFS_URING && file->source_file == NULL && uring_setup(&file->ring, ASYNC_VFS_MAX_DEPTH) == 0)
+    {
+        file->uring = uring_register_wake(&file->ring, vfs->wake_fd[0]) == 0;
+        if (!file->uring)
+            uring_free(&file->ring);
+    }
+    pool = !file->uring;
+#endif
+
+    // A ring can still fail here (locked-memory limits on older kernels); the
+    // pool then takes this file.
+    pthread_mutex_lock(&vfs->lock);
+    int ready = async_vfs_start_threads(vfs, pool);
+    if (ready == 0)
+    {
+        file->next = vfs->files;
+        vfs->files = file;
+    }
+    pthread_mutex_unlock(&vfs->lock);
+    // Out of a wait with no timeout, now that there is a file to poll.
+    async_vfs_wake(vfs);
+    if (ready != 0)
+    {
+#ifdef ASYNC_VFS_HAVE_URING
+        if (file->uring)
+            uring_free(&file->ring);
+#endif
+        pthread_cond_destroy(&file->done);
+        pthread_mutex_destroy(&file->lock);
+        pthread_mutex_destroy(&file->source_lock);
+        async_file_release(file);
+        return MA_ERROR;
+    }
+
+    *pFile = file;
+    return MA_SUCCESS;
+}
+
+static ma_result async_vfs_close(ma_vfs* pVFS, ma_vfs_file handle)
+{
+    AsyncVfs* vfs = (AsyncVfs*)pVFS;
+    AsyncFile* file = (AsyncFile*)handle;
+
+    // Outstanding reads still write into our buffers. Once they have all
+    // landed the dispatcher has nothing left of this file but the link.
+    for (int i = 0; i < ASYNC_VFS_MAX_DEPTH; i++)
+        async_file_wait(file, &file->blocks[i]);
+
+    pthread_mutex_lock(&vfs->lock);
+    for (AsyncFile** link = &vfs->files; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == file)
+        {
+            *link = file->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&vfs->lock);
+
+#ifdef ASYNC_VFS_HAVE_URING
+    if (file->uring)
+        uring_free(&file->ring);
+#endif
+    pthread_cond_destroy(&file->done);
+    pthread_mutex_destroy(&file->lock);
+    pthread_mutex_destroy(&file->source_lock);
+    async_file_release(file);
+
+    return MA_SUCCESS;
+}
+
+static ma_result async_vfs_read(ma_vfs* pVFS, ma_vfs_file handle, void* pDst, size_t sizeInBytes, size_t* pBytesRead)
+{
+    AsyncVfs* vfs = (AsyncVfs*)pVFS;
+    AsyncFile* file = (AsyncFile*)handle;
+    size_t total = 0;
+    ma_result result = MA_SUCCESS;
+
+    async_vfs_count(&vfs->counters.reads, 1);
+
+    while (total < sizeInBytes && file->position < file->size)
+    {
+        ma_uint64 base = file->position - file->position % ASYNC_VFS_BLOCK;
+        AsyncBlock* block = async_file_fill(file, base);
+
+        if (async_block_state(block) == BLOCK_PENDING)
+            async_file_stall(file, block);
+
+        // A short read that isn't at the end of the file is an I/O error.
+        ma_uint64 end = block->offset + block->length;
+        if (block->error || file->position >= end)
+        {
+            __atomic_store_n(&block->state, BLOCK_EMPTY, __ATOMIC_RELAXED);
+            result = MA_IO_ERROR;
+            break;
+        }
+
+        size_t available = (size_t)(end - file->position);
+        size_t n = sizeInBytes - total < available ? sizeInBytes - total : available;
+        memcpy((unsigned char*)pDst + total, block->data + (file->position - block->offset), n);
+        total += n;
+        file->position += n;
+    }
+
+    async_vfs_count(&vfs->counters.bytes, total);
+    if (pBytesRead != NULL)
+        *pBytesRead = total;
+    if (total == 0 && result == MA_SUCCESS && sizeInBytes > 0)
+        return MA_AT_END;
+
+    return result;
+}
+
+static ma_result async_vfs_write(ma_vfs* pVFS, ma_vfs_file file, const void* pSrc, size_t sizeInBytes, size_t* pBytesWritten)
+{
+    (void)pVFS; (void)file; (void)pSrc; (void)sizeInBytes; (void)pBytesWritten;
+    return MA_NOT_IMPLEMENTED;
+}
+
+static ma_result async_vfs_seek(ma_vfs* pVFS, ma_vfs_file handle, ma_int64 offset, ma_seek_origin origin)
+{
+    AsyncFile* file = (AsyncFile*)handle;
+    ma_int64 position;
+
+    if (origin == ma_seek_origin_start)
+        position = offset;
+    else if (origin == ma_seek_origin_current)
+        position = (ma_int64)file->position + offset;
+    else
+        position = (ma_int64)file->size + offset;
+
+    if (position < 0)
+        return MA_INVALID_ARGS;
+
+    file->position = (ma_uint64)position;
+    (void)pVFS;
+    return MA_SUCCESS;
+}
+
+static ma_result async_vfs_tell(ma_vfs* pVFS, ma_vfs_file handle, ma_int64* pCursor)
+{
+    *pCursor = (ma_int64)((AsyncFile*)handle)->position;
+    (void)pVFS;
+    return MA_SUCCESS;
+}
+
+static ma_result async_vfs_info(ma_vfs* pVFS, ma_vfs_file handle, ma_file_info* pInfo)
+{
+    pInfo->sizeInBytes = ((AsyncFile*)handle)->size;
+    (void)pVFS;
+    return MA_SUCCESS;
+}
+
+int async_vfs_init(AsyncVfs* vfs, AsyncVfsBackend backend)
+{
+    memset(vfs, 0, sizeof(*vfs));
+    vfs->cb.onOpen = async_vfs_open;
+    vfs->cb.onClose = async_vfs_close;
+    vfs->cb.onRead = async_vfs_read;
+    vfs->cb.onWrite = async_vfs_write;
+    vfs->cb.onSeek = async_vfs_seek;
+    vfs->cb.onTell = async_vfs_tell;
+    vfs->cb.onInfo = async_vfs_info;
+    vfs->depth = ASYNC_VFS_DEPTH;
+
+    vfs->backend = ASYNC_VFS_THREADS;
+#ifdef ASYNC_VFS_HAVE_URING
+    if (backend != ASYNC_VFS_THREADS && uring_probe() == 0)
+        vfs->backend = ASYNC_VFS_URING;
+#endif
+    if (backend == ASYNC_VFS_URING && vfs->backend != ASYNC_VFS_URING)
+        return -1;
+
+#ifdef __linux__
+    vfs->wake_fd[0] = vfs->wake_fd[1] = eventfd(0, EFD_CLOEXEC);
+    if (vfs->wake_fd[0] < 0)
+        return -1;
+#else
+    if (pipe(vfs->wake_fd) != 0)
+        return -1;
+    fcntl(vfs->wake_fd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(vfs->wake_fd[1], F_SETFD, FD_CLOEXEC);
+    fcntl(vfs->wake_fd[1], F_SETFL, O_NONBLOCK);
+#endif
+
+    pthread_mutex_init(&vfs->lock, NULL);
+    pthread_cond_init(&vfs->work, NULL);
+    return 0;
+}
+
+void async_vfs_uninit(AsyncVfs* vfs)
+{
+    pthread_mutex_lock(&vfs->lock);
+    vfs->quit = 1;
+    pthread_cond_broadcast(&vfs->work);
+    pthread_mutex_unlock(&vfs->lock);
+    async_vfs_wake(vfs);
+
+    if (vfs->dispatching)
+        pthread_join(vfs->dispatcher, NULL);
+    for (int i = 0; i < vfs->worker_count; i++)
+        pthread_join(vfs->workers[i], NULL);
+    pthread_cond_destroy(&vfs->work);
+    pthread_mutex_destroy(&vfs->lock);
+    close(vfs->wake_fd[0]);
+    if (vfs->wake_fd[1] != vfs->wake_fd[0])
+        close(vfs->wake_fd[1]);
+}
+
+void async_vfs_set_source(AsyncVfs* vfs, ma_vfs* source)
+{
+    vfs->source = source;
+}
+
+void async_vfs_set_depth(AsyncVfs* vfs, int depth)
+{
+    if (depth < 1)
+        depth = 1;
+    if (depth > ASYNC_VFS_MAX_DEPTH)
+        depth = ASYNC_VFS_MAX_DEPTH;
+    __atomic_store_n(&vfs->depth, depth, __ATOMIC_RELAXED);
+}
+
+int async_vfs_get_depth(AsyncVfs* vfs)
+{
+    return __atomic_load_n(&vfs->depth, __ATOMIC_RELAXED);
+}
+
+const char* async_vfs_backend_name(AsyncVfsBackend backend)
+{
+    switch (backend)
+    {
+        case ASYNC_VFS_URING:   return "io_uring";
+        case ASYNC_VFS_THREADS: return "threads";
+        default:                return "auto";
+    }
+}
+
+void async_vfs_get_counters(AsyncVfs* vfs, AsyncVfsCounters* counters)
+{
+    counters->reads = __atomic_load_n(&vfs->counters.reads, __ATOMIC_RELAXED);
+    counters->bytes = __atomic_load_n(&vfs->counters.bytes, __ATOMIC_RELAXED);
+    counters->stalls = __atomic_load_n(&vfs->counters.stalls, __ATOMIC_RELAXED);
+    counters->stall_ns = __atomic_load_n(&vfs->counters.stall_ns, __ATOMIC_RELAXED);
+}
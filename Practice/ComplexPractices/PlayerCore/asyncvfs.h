@@ -0,0 +1,84 @@
+#ifndef ASYNCVFS_H
+#define ASYNCVFS_H
+
+#include "miniaudio.h"
+#include <pthread.h>
+
+// An ma_vfs for decoders that keeps several large reads in flight per open
+// file, so the decoder copies out of buffers that were filled ahead of it
+// instead of waiting on the disk for every fread. Reads go through a per-file
+// io_uring where the kernel has one, else through a small pool of threads
+// doing pread. Read-only: files cannot be opened for writing.
+//
+// The decoder may run on the audio thread, so reading takes no locks and makes
+// no syscalls while the data is there: it copies out of blocks it sees ready
+// with an acquire load and queues refills on a per-file ring. A dispatcher
+// thread polls the rings of open files, every ASYNC_VFS_POLL_MIN_MS while they
+// ask for reads and backing off to ASYNC_VFS_POLL_MAX_MS while they don't.
+// Only a read the disk hasn't kept up with wakes it and waits, and it is
+// counted as a stall. Open and close may block.
+
+#define ASYNC_VFS_BLOCK (256 * 1024)
+#define ASYNC_VFS_DEPTH 4           // blocks read ahead per file, at first
+#define ASYNC_VFS_MAX_DEPTH 16      // blocks each file has, so the most it can read ahead
+#define ASYNC_VFS_WORKERS 2
+#define ASYNC_VFS_POLL_MIN_MS 2
+#define ASYNC_VFS_POLL_MAX_MS 128
+
+typedef enum
+{
+    ASYNC_VFS_AUTO,                 // io_uring if it works here, else threads
+    ASYNC_VFS_URING,
+    ASYNC_VFS_THREADS
+} AsyncVfsBackend;
+
+typedef struct
+{
+    ma_uint64 reads;                // onRead calls
+    ma_uint64 bytes;
+    ma_uint64 stalls;               // reads that had to wait for I/O
+    ma_uint64 stall_ns;
+} AsyncVfsCounters;
+
+typedef struct AsyncBlock AsyncBlock;
+typedef struct AsyncFile AsyncFile;
+
+typedef struct
+{
+    ma_vfs_callbacks cb;            // first, so an AsyncVfs* is an ma_vfs*
+    AsyncVfsBackend backend;
+    ma_vfs* source;                 // read through this instead of the file itself
+    int depth;                      // blocks read ahead; read by every file on each read
+    // Starts requested reads and reaps io_uring completions. Completions,
+    // stalled readers, open and quit wake it through wake_fd: an eventfd in
+    // both slots on Linux, else a pipe.
+    pthread_t dispatcher;
+    int dispatching;
+    int wake_fd[2];
+    AsyncFile* files;               // open, for the dispatcher
+    // Thread-pool backend: blocks waiting for a worker.
+    pthread_t workers[ASYNC_VFS_WORKERS];
+    int worker_count;
+    pthread_mutex_t lock;           // I/O threads, open and close; never a read
+    pthread_cond_t work;
+    AsyncBlock* queue_head;
+    AsyncBlock* queue_tail;
+    int quit;
+    AsyncVfsCounters counters;
+} AsyncVfs;
+
+// AUTO or URING probe io_uring first; URING fails if it is not available.
+int async_vfs_init(AsyncVfs* vfs, AsyncVfsBackend backend);
+// Every file must be closed first.
+void async_vfs_uninit(AsyncVfs* vfs);
+// Reads files through another VFS (e.g. a FaultVfs) on the thread pool. Only
+// files opened afterwards use it.
+void async_vfs_set_source(AsyncVfs* vfs, ma_vfs* source);
+// How many blocks each file keeps read or being read ahead of its position,
+// clamped to 1..ASYNC_VFS_MAX_DEPTH. Open files follow it from their next read.
+void async_vfs_set_depth(AsyncVfs* vfs, int depth);
+int async_vfs_get_depth(AsyncVfs* vfs);
+const char* async_vfs_backend_name(AsyncVfsBackend backend);
+void async_vfs_get_counters(AsyncVfs* vfs, AsyncVfsCounters* counters);
+
+#endif
@@ -0,0 +1,508 @@
+#include "client.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#endif
+
+static double client_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int client_connect(PlayerClient* client, const char* socket_path)
+{
+    struct sockaddr_un addr;
+
+    memset(client, 0, sizeof(*client));
+    client->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (client->fd < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+
+    if (connect(client->fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        close(client->fd);
+        client->fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Path of the running program, so the daemon is the same build as its client.
+static int client_executable_path(char* out, size_t out_size)
+{
+#ifdef __APPLE__
+    uint32_t size = (uint32_t)out_size;
+    return _NSGetExecutablePath(out, &size) == 0 ? 0 : -1;
+#else
+    ssize_t len = readlink("/proc/self/exe", out, out_size - 1);
+    if (len <= 0)
+        return -1;
+    out[len] = '\0';
+    return 0;
+#endif
+}
+
+int client_connect_or_spawn(PlayerClient* client, const char* socket_path, PlayerFormatMode mode, PlayerLatencyProfile latency)
+{
+    char exe[PATH_MAX];
+    char* argv[8];
+    int argc = 0;
+    struct rlimit limit;
+    int max_fd = 1024;
+    pid_t pid;
+    int attempt;
+
+    if (client_connect(client, socket_path) == 0)
+        return 0;
+
+    if (client_executable_path(exe, sizeof(exe)) != 0)
+        return -1;
+    argv[argc++] = exe;
+    argv[argc++] = "--daemon";
+    argv[argc++] = "--socket";
+    argv[argc++] = (char*)socket_path;
+    if (mode != PLAYER_FORMAT_FIXED)
+        argv[argc++] = mode == PLAYER_FORMAT_NATIVE ? "--native" : "--bitperfect";
+    argv[argc++] = "--latency";
+    argv[argc++] = (char*)player_latency_name(latency);
+    argv[argc] = NULL;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < 65536)
+        max_fd = (int)limit.rlim_cur;
+
+    // The caller has threads, so the children only make async-signal-safe
+    // calls until exec starts the daemon afresh. Double fork so it is
+    // reparented to init and outlives this process.
+    pid = fork();
+    if (pid < 0)
+        return -1;
+    if (pid == 0)
+    {
+        if (fork() != 0)
+            _exit(0);
+
+        int null_fd = open("/dev/null", O_RDWR);
+        setsid();
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        // Nothing of ours (log files, sockets, the terminal) stays open in it.
+        for (int fd = STDERR_FILENO + 1; fd < max_fd; fd++)
+            close(fd);
+        execv(exe, argv);
+        _exit(127);
+    }
+    waitpid(pid, NULL, 0);
+
+    for (attempt = 0; attempt < 200; attempt++)
+    {
+        if (client_connect(client, socket_path) == 0)
+            return 0;
+        usleep(10000);
+    }
+
+    return -1;
+}
+
+static void* client_connect_thread(void* arg)
+{
+    ClientConnector* connector = (ClientConnector*)arg;
+    int result = client_connect_or_spawn(connector->client, connector->socket_path, connector->mode, connector->latency);
+
+    __atomic_store_n(&connector->state, result == 0 ? 1 : -1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+int client_connect_async(ClientConnector* connector, PlayerClient* client, const char* socket_path,
+                         PlayerFormatMode mode, PlayerLatencyProfile latency)
+{
+    memset(connector, 0, sizeof(*connector));
+    connector->client = client;
+    connector->mode = mode;
+    connector->latency = latency;
+    snprintf(connector->socket_path, sizeof(connector->socket_path), "%s", socket_path);
+    client->fd = -1;
+
+    if (pthread_create(&connector->thread, NULL, client_connect_thread, connector) != 0)
+    {
+        connector->state = -1;
+        connector->joined = 1;
+        return -1;
+    }
+
+    return 0;
+}
+
+int client_connect_state(ClientConnector* connector)
+{
+    int state = __atomic_load_n(&connector->state, __ATOMIC_ACQUIRE);
+
+    if (state != 0 && !connector->joined)
+    {
+        pthread_join(connector->thread, NULL);
+        connector->joined = 1;
+    }
+
+    return state;
+}
+
+void client_connect_finish(ClientConnector* connector)
+{
+    if (!connector->joined)
+    {
+        pthread_join(connector->thread, NULL);
+        connector->joined = 1;
+    }
+}
+
+void client_close(PlayerClient* client)
+{
+    if (client->fd >= 0)
+        close(client->fd);
+    client->fd = -1;
+}
+
+static int client_send(PlayerClient* client, const char* data, size_t len)
+{
+    size_t sent = 0;
+
+    while (sent < len)
+    {
+        ssize_t n = send(client->fd, data + sent, len - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        sent += n;
+    }
+
+    return 0;
+}
+
+// Reads one reply line into reply (NUL terminated, newline stripped).
+static int client_read_line(PlayerClient* client, char* reply, size_t reply_size)
+{
+    for (;;)
+    {
+        char* newline = memchr(client->buffer, '\n', client->used);
+        if (newline != NULL)
+        {
+            size_t len = newline - client->buffer;
+            size_t copy = len < reply_size - 1 ? len : reply_size - 1;
+
+            memcpy(reply, client->buffer, copy);
+            reply[copy] = '\0';
+            client->used -= len + 1;
+            memmove(client->buffer, newline + 1, client->used);
+            return 0;
+        }
+
+        if (client->used == sizeof(client->buffer))
+            return -1;
+
+        ssize_t n = recv(client->fd, client->buffer + client->used, sizeof(client->buffer) - client->used, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        client->used += n;
+    }
+}
+
+static void client_record_rtt(PlayerClient* client, double rtt)
+{
+    client->rtt_last = rtt;
+    if (client->rtt_count == 0 || rtt < client->rtt_min)
+        client->rtt_min = rtt;
+    if (rtt > client->rtt_max)
+        client->rtt_max = rtt;
+    client->rtt_total += rtt;
+    client->rtt_count++;
+}
+
+int client_command(PlayerClient* client, const char* line, char* reply, size_t reply_size)
+{
+    char request[1024];
+    char scratch[64];
+    int len;
+
+    if (client->fd < 0)
+        return -1;
+
+    len = snprintf(request, sizeof(request), "%s\n", line);
+    if (len <= 0 || (size_t)len >= sizeof(request))
+        return -1;
+
+    if (reply == NULL)
+    {
+        reply = scratch;
+        reply_size = sizeof(scratch);
+    }
+
+    double start = client_now();
+    if (client_send(client, request, len) != 0 || client_read_line(client, reply, reply_size) != 0)
+    {
+        client_close(client);
+        return -1;
+    }
+    client_record_rtt(client, client_now() - start);
+
+    return strncmp(reply, "OK", 2) == 0 ? 0 : -1;
+}
+
+// Paths travel as the rest of a line, so they cannot contain a newline.
+static int client_path_command(PlayerClient* client, const char* verb, const char* filepath)
+{
+    char line[1024];
+
+    if (strchr(filepath, '\n') != NULL)
+        return -1;
+    if ((size_t)snprintf(line, sizeof(line), "%s %s", verb, filepath) >= sizeof(line))
+        return -1;
+
+    return client_command(client, line, NULL, 0);
+}
+
+int client_play_file(PlayerClient* client, const char* filepath)
+{
+    return client_path_command(client, "PLAY", filepath);
+}
+
+int client_queue_file(PlayerClient* client, const char* filepath)
+{
+    return client_path_command(client, "QUEUE", filepath);
+}
+
+int client_load_playlist(PlayerClient* client, const char* playlist_path)
+{
+    return client_path_command(client, "LOAD", playlist_path);
+}
+
+// Reads the replies to the requests sent since the last flush. Returns -1 when
+// the connection broke, 1 when any of them failed.
+static int client_flush_batch(PlayerClient* client, const char* batch, size_t batch_len, int pending)
+{
+    char reply[64];
+    int failed = 0;
+
+    if (client_send(client, batch, batch_len) != 0)
+        return -1;
+
+    while (pending-- > 0)
+    {
+        if (client_read_line(client, reply, sizeof(reply)) != 0)
+            return -1;
+        if (strncmp(reply, "OK", 2) != 0)
+            failed = 1;
+    }
+
+    return failed;
+}
+
+int client_play_playlist(PlayerClient* client, char** files, int count)
+{
+    char* batch;
+    size_t batch_len = 0;
+    size_t batch_size = CLIENT_BATCH_LINES * 1032;
+    int result = 0;
+    int pending = 0;
+    int i;
+
+    if (client->fd < 0 || count <= 0)
+        return -1;
+
+    batch = malloc(batch_size);
+    if (batch == NULL)
+        return -1;
+
+    // STOP empties the queue, so the first QUEUE starts a fresh one.
+    batch_len += sprintf(batch + batch_len, "STOP\n");
+    pending++;
+
+    double start = client_now();
+    for (i = 0; i <= count; i++)
+    {
+        // The daemon answers with blocking writes, so only a window of
+        // requests goes out before their replies are read. Writing the whole
+        // batch first deadlocks once both socket buffers are full.
+        if (pending > 0 && (i == count || pending == CLIENT_BATCH_LINES))
+        {
+            int flushed = client_flush_batch(client, batch, batch_len, pending);
+            if (flushed < 0)
+            {
+                free(batch);
+                client_close(client);
+                return -1;
+            }
+            if (flushed > 0)
+                result = -1;
+            batch_len = 0;
+            pending = 0;
+        }
+        if (i == count)
+            break;
+
+        // Same limits as client_path_command.
+        if (strchr(files[i], '\n') != NULL || strlen(files[i]) > 1016)
+        {
+            result = -1;
+            continue;
+        }
+        batch_len += sprintf(batch + batch_len, "QUEUE %s\n", files[i]);
+        pending++;
+    }
+    free(batch);
+    client_record_rtt(client, client_now() - start);
+
+    return result;
+}
+
+int client_skip_next(PlayerClient* client)
+{
+    return client_command(client, "NEXT", NULL, 0);
+}
+
+int client_skip_previous(PlayerClient* client)
+{
+    return client_command(client, "PREV", NULL, 0);
+}
+
+int client_toggle_pause(PlayerClient* client)
+{
+    return client_command(client, "PAUSE", NULL, 0);
+}
+
+int client_stop(PlayerClient* client)
+{
+    return client_command(client, "STOP", NULL, 0);
+}
+
+int client_seek(PlayerClient* client, double seconds)
+{
+    char line[64];
+
+    snprintf(line, sizeof(line), "SEEK %.3f", seconds < 0 ? 0.0 : seconds);
+    return client_command(client, line, NULL, 0);
+}
+
+int client_set_latency(PlayerClient* client, PlayerLatencyProfile latency)
+{
+    char line[64];
+
+    snprintf(line, sizeof(line), "LATENCY %s", player_latency_name(latency));
+    return client_command(client, line, NULL, 0);
+}
+
+int client_set_shuffle(PlayerClient* client, ma_bool32 shuffle)
+{
+    return client_command(client, shuffle ? "SHUFFLE on" : "SHUFFLE off", NULL, 0);
+}
+
+int client_set_repeat(PlayerClient* client, PlayerRepeatMode repeat)
+{
+    char line[64];
+
+    snprintf(line, sizeof(line), "REPEAT %s", player_repeat_name(repeat));
+    return client_command(client, line, NULL, 0);
+}
+
+int client_set_prefetch(PlayerClient* client, int depth, size_t budget_bytes)
+{
+    char line[64];
+
+    snprintf(line, sizeof(line), "PREFETCH %d %zu", depth, budget_bytes);
+    return client_command(client, line, NULL, 0);
+}
+
+int client_shutdown(PlayerClient* client)
+{
+    return client_command(client, "SHUTDOWN", NULL, 0);
+}
+
+int client_status(PlayerClient* client, PlayerStatus* status, PlayerDeviceInfo* device, LoadSample* load)
+{
+    char reply[2048];
+    char* path;
+    char* token;
+    char* save = NULL;
+    int format, source_format, latency, repeat;
+
+    memset(status, 0, sizeof(*status));
+    memset(device, 0, sizeof(*device));
+    memset(load, 0, sizeof(*load));
+
+    if (client_command(client, "STATUS", reply, sizeof(reply)) != 0)
+        return -1;
+
+    // path= is last and may contain spaces, so cut it off before tokenising.
+    path = strstr(reply, " path=");
+    if (path != NULL)
+    {
+        *path = '\0';
+        snprintf(status->filepath, sizeof(status->filepath), "%s", path + 6);
+    }
+
+    for (token = strtok_r(reply + 2, " ", &save); token != NULL; token = strtok_r(NULL, " ", &save))
+    {
+        unsigned long long value;
+
+        if (sscanf(token, "active=%u", &status->is_active) == 1) continue;
+        if (sscanf(token, "paused=%u", &status->is_paused) == 1) continue;
+        if (sscanf(token, "auto=%u", &status->auto_advance) == 1) continue;
+        if (sscanf(token, "index=%d", &status->current_index) == 1) continue;
+        if (sscanf(token, "count=%d", &status->playlist_count) == 1) continue;
+        if (sscanf(token, "cursor=%llu", &value) == 1) { status->cursor = value; continue; }
+        if (sscanf(token, "src=%d/%u/%u", &source_format, &status->format.source_channels, &status->format.source_rate) == 3)
+        {
+            status->format.source_format = (ma_format)source_format;
+            continue;
+        }
+        if (sscanf(token, "conv=%u", &status->format.converted) == 1) continue;
+        if (sscanf(token, "resamp=%u", &status->format.resampled) == 1) continue;
+        if (sscanf(token, "dev=%d/%u/%u", &format, &device->channels, &device->sample_rate) == 3)
+        {
+            device->format = (ma_format)format;
+            continue;
+        }
+        if (sscanf(token, "devconv=%u", &device->converted) == 1) continue;
+        if (sscanf(token, "devresamp=%u", &device->resampled) == 1) continue;
+        if (sscanf(token, "latency=%d", &latency) == 1) { device->latency = (PlayerLatencyProfile)latency; continue; }
+        if (sscanf(token, "period=%u", &device->period_frames) == 1) continue;
+        if (sscanf(token, "irate=%u", &device->internal_rate) == 1) continue;
+        if (sscanf(token, "callbacks=%llu", &value) == 1) { device->callback_count = load->callbacks = value; continue; }
+        if (sscanf(token, "wall=%lf", &load->wall) == 1) continue;
+        if (sscanf(token, "cpu=%lf", &load->cpu) == 1) continue;
+        if (sscanf(token, "shuffle=%u", &status->shuffle) == 1) continue;
+        if (sscanf(token, "repeat=%d", &repeat) == 1) { status->repeat = (PlayerRepeatMode)repeat; continue; }
+    }
+
+    return 0;
+}
+
+void client_load_stats(const PlayerDeviceInfo* device, const LoadSample* from, const LoadSample* to, LoadStats* stats)
+{
+    double elapsed = to->wall - from->wall;
+
+    stats->period_frames = device->period_frames;
+    stats->period_ms = device->internal_rate > 0 ? 1000.0 * device->period_frames / device->internal_rate : 0.0;
+    stats->wakeups_per_sec = elapsed > 0 ? (to->callbacks - from->callbacks) / elapsed : 0.0;
+    stats->cpu_percent = elapsed > 0 ? 100.0 * (to->cpu - from->cpu) / elapsed : 0.0;
+}
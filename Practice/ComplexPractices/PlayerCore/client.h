@@ -0,0 +1,82 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include "player.h"
+#include <pthread.h>
+
+#define CLIENT_BATCH_LINES 64       // requests written before their replies are read
+
+// Client side of the daemon protocol (see daemon.h). Mirrors the player_*
+// control functions so a front-end can switch between the two with little change.
+
+typedef struct
+{
+    int fd;
+    char buffer[4096];
+    size_t used;
+    // Round-trip times of every request, in seconds.
+    double rtt_last;
+    double rtt_min;
+    double rtt_max;
+    double rtt_total;
+    ma_uint64 rtt_count;
+} PlayerClient;
+
+int client_connect(PlayerClient* client, const char* socket_path);
+// Connects, starting a detached daemon first if none is listening. The daemon
+// is this same program run as "<program> --daemon --socket <path>
+// [--native|--bitperfect] --latency <profile>", so a program using this must
+// answer that command line with player_daemon_run.
+int client_connect_or_spawn(PlayerClient* client, const char* socket_path, PlayerFormatMode mode, PlayerLatencyProfile latency);
+void client_close(PlayerClient* client);
+
+// client_connect_or_spawn on a background thread, since starting a daemon
+// waits for its device to open. The client must not be used until
+// client_connect_state reports 1.
+typedef struct
+{
+    pthread_t thread;
+    PlayerClient* client;
+    char socket_path[108];
+    PlayerFormatMode mode;
+    PlayerLatencyProfile latency;
+    int state;              // 0 connecting, 1 connected, -1 failed
+    int joined;
+} ClientConnector;
+
+int client_connect_async(ClientConnector* connector, PlayerClient* client, const char* socket_path,
+                         PlayerFormatMode mode, PlayerLatencyProfile latency);
+int client_connect_state(ClientConnector* connector);
+// Waits for a pending connect; call before discarding the connector.
+void client_connect_finish(ClientConnector* connector);
+
+// Sends one request line (without the newline) and waits for its reply.
+// Returns 0 when the daemon answered OK.
+int client_command(PlayerClient* client, const char* line, char* reply, size_t reply_size);
+
+int client_play_file(PlayerClient* client, const char* filepath);
+// Replaces the queue. Requests go out in windows of CLIENT_BATCH_LINES, each in
+// one write with its replies read afterwards, so the cost is one round trip per
+// window rather than one per file.
+int client_play_playlist(PlayerClient* client, char** files, int count);
+int client_queue_file(PlayerClient* client, const char* filepath);
+// The daemon reads the playlist itself (see playlist.h); playback starts with
+// its first entry while the rest is still being queued.
+int client_load_playlist(PlayerClient* client, const char* playlist_path);
+int client_skip_next(PlayerClient* client);
+int client_skip_previous(PlayerClient* client);
+int client_toggle_pause(PlayerClient* client);
+int client_stop(PlayerClient* client);
+int client_seek(PlayerClient* client, double seconds);
+int client_set_latency(PlayerClient* client, PlayerLatencyProfile latency);
+int client_set_shuffle(PlayerClient* client, ma_bool32 shuffle);
+int client_set_repeat(PlayerClient* client, PlayerRepeatMode repeat);
+int client_set_prefetch(PlayerClient* client, int depth, size_t budget_bytes);
+int client_shutdown(PlayerClient* client);
+
+// One STATUS request filled into the same structs the engine uses. load is
+// sampled on the daemon's side.
+int client_status(PlayerClient* client, PlayerStatus* status, PlayerDeviceInfo* device, LoadSample* load);
+void client_load_stats(const PlayerDeviceInfo* device, const LoadSample* from, const LoadSample* to, LoadStats* stats);
+
+#endif
@@ -0,0 +1,382 @@
+#include "daemon.h"
+#include "statuspage.h"
+#include "metrics.h"
+#include "playlist.h"
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define DAEMON_LINE_MAX 1024
+#define DAEMON_LOG_MS 1000          // how often buffering changes are logged
+
+typedef struct
+{
+    int fd;
+    char buffer[DAEMON_LINE_MAX];
+    size_t used;
+} DaemonClient;
+
+static volatile sig_atomic_t daemon_stop_requested = 0;
+// The playlist being queued by LOAD, if any. Anything that replaces the queue
+// stops it first.
+static PlaylistLoader daemon_loader;
+
+static void daemon_on_signal(int sig)
+{
+    (void)sig;
+    daemon_stop_requested = 1;
+}
+
+void daemon_default_socket(char* out, size_t out_size)
+{
+    const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+
+    if (runtime_dir != NULL && runtime_dir[0] != '\0')
+        snprintf(out, out_size, "%s/psfsp.sock", runtime_dir);
+    else
+        snprintf(out, out_size, "/tmp/psfsp-%u.sock", (unsigned)getuid());
+}
+
+static int daemon_listen(const char* socket_path)
+{
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+
+    // A socket file nobody answers on is left over from a crash.
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0)
+    {
+        close(fd);
+        return -1;
+    }
+    unlink(socket_path);
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void daemon_format_status(MiniaudioPlayer* player, char* out, size_t out_size)
+{
+    PlayerStatus status;
+    PlayerDeviceInfo device;
+    LoadSample load;
+
+    player_get_status(player, &status);
+    player_get_device_info(player, &device);
+    player_load_sample(player, &load);
+
+    snprintf(out, out_size,
+             "OK active=%d paused=%d auto=%d index=%d count=%d cursor=%llu "
+             "src=%d/%u/%u conv=%d resamp=%d "
+             "dev=%d/%u/%u devconv=%d devresamp=%d latency=%d period=%u irate=%u "
+             "callbacks=%llu wall=%.6f cpu=%.6f shuffle=%d repeat=%d path=%s\n",
+             status.is_active, status.is_paused, status.auto_advance, status.current_index,
+             status.playlist_count, (unsigned long long)status.cursor,
+             status.format.source_format, status.format.source_channels, status.format.source_rate,
+             status.format.converted, status.format.resampled,
+             device.format, device.channels, device.sample_rate, device.converted, device.resampled,
+             device.latency, device.period_frames, device.internal_rate,
+             (unsigned long long)device.callback_count, load.wall, load.cpu,
+             status.shuffle, status.repeat, status.filepath);
+}
+
+// Handles one request line. Returns 1 when the daemon should shut down.
+static int daemon_handle(MiniaudioPlayer* player, char* line, char* reply, size_t reply_size)
+{
+    char* arg = strchr(line, ' ');
+    int result = 0;
+
+    if (arg != NULL)
+        *arg++ = '\0';
+    else
+        arg = "";
+
+    snprintf(reply, reply_size, "OK\n");
+
+    if (strcmp(line, "PING") == 0)
+    {
+    }
+    else if (strcmp(line, "STATUS") == 0)
+    {
+        daemon_format_status(player, reply, reply_size);
+    }
+    else if (strcmp(line, "PLAY") == 0)
+    {
+        playlist_load_stop(&daemon_loader);
+        result = player_play_file(player, arg);
+    }
+    else if (strcmp(line, "LOAD") == 0)
+    {
+        playlist_load_stop(&daemon_loader);
+        result = playlist_load_start(&daemon_loader, player, arg);
+    }
+    else if (strcmp(line, "QUEUE") == 0)
+    {
+        result = player_queue_file(player, arg);
+    }
+    else if (strcmp(line, "NEXT") == 0)
+    {
+        result = player_skip_next(player);
+    }
+    else if (strcmp(line, "PREV") == 0)
+    {
+        result = player_skip_previous(player);
+    }
+    else if (strcmp(line, "PAUSE") == 0)
+    {
+        player_toggle_pause(player);
+    }
+    else if (strcmp(line, "STOP") == 0)
+    {
+        playlist_load_stop(&daemon_loader);
+        result = player_stop(player);
+    }
+    else if (strcmp(line, "SEEK") == 0)
+    {
+        PlayerDeviceInfo device;
+        double seconds = atof(arg);
+
+        player_get_device_info(player, &device);
+        result = player_seek(player, (ma_uint64)(seconds > 0 ? seconds * device.sample_rate : 0));
+    }
+    else if (strcmp(line, "LATENCY") == 0)
+    {
+        PlayerLatencyProfile latency;
+        result = player_parse_latency(arg, &latency) == 0 ? player_set_latency(player, latency) : -1;
+    }
+    else if (strcmp(line, "SHUFFLE") == 0)
+    {
+        if (strcmp(arg, "on") == 0 || strcmp(arg, "off") == 0)
+            result = player_set_shuffle(player, strcmp(arg, "on") == 0);
+        else
+            result = -1;
+    }
+    else if (strcmp(line, "REPEAT") == 0)
+    {
+        PlayerRepeatMode repeat;
+        result = player_parse_repeat(arg, &repeat) == 0 ? player_set_repeat(player, repeat) : -1;
+    }
+    else if (strcmp(line, "PREFETCH") == 0)
+    {
+        int depth;
+        unsigned long long budget;
+
+        if (sscanf(arg, "%d %llu", &depth, &budget) == 2)
+            result = player_set_prefetch(player, depth, (size_t)budget);
+        else
+            result = -1;
+    }
+    else if (strcmp(line, "SHUTDOWN") == 0)
+    {
+        return 1;
+    }
+    else
+    {
+        snprintf(reply, reply_size, "ERR unknown command\n");
+        return 0;
+    }
+
+    if (result != 0)
+        snprintf(reply, reply_size, "ERR %s failed\n", line);
+
+    return 0;
+}
+
+static void daemon_send(int fd, const char* reply)
+{
+    size_t len = strlen(reply);
+    size_t sent = 0;
+
+    while (sent < len)
+    {
+        ssize_t n = send(fd, reply + sent, len - sent, MSG_NOSIGNAL);
+        if (n <= 0 && errno != EINTR)
+            return;
+        if (n > 0)
+            sent += n;
+    }
+}
+
+// Reads what is available and answers each complete line. Returns -1 when the
+// client went away, 1 on SHUTDOWN.
+static int daemon_serve_client(MiniaudioPlayer* player, DaemonClient* client)
+{
+    char reply[DAEMON_LINE_MAX + 512];
+    ssize_t n = recv(client->fd, client->buffer + client->used, sizeof(client->buffer) - client->used, 0);
+
+    if (n <= 0)
+        return (n < 0 && errno == EINTR) ? 0 : -1;
+    client->used += n;
+
+    for (;;)
+    {
+        char* newline = memchr(client->buffer, '\n', client->used);
+        if (newline == NULL)
+        {
+            // A line longer than the buffer can never complete.
+            if (client->used == sizeof(client->buffer))
+                return -1;
+            return 0;
+        }
+
+        *newline = '\0';
+        if (newline > client->buffer && newline[-1] == '\r')
+            newline[-1] = '\0';
+
+        int shutdown = daemon_handle(player, client->buffer, reply, sizeof(reply));
+        daemon_send(client->fd, reply);
+        if (shutdown)
+            return 1;
+
+        size_t consumed = newline + 1 - client->buffer;
+        memmove(client->buffer, newline + 1, client->used - consumed);
+        client->used -= consumed;
+    }
+}
+
+int player_daemon_run(const char* socket_path, PlayerFormatMode mode, PlayerLatencyProfile latency,
+                      const char* metrics_address)
+{
+    DaemonClient clients[DAEMON_MAX_CLIENTS];
+    MetricsExporter exporter;
+    int exporting = 0;
+    History history;
+    int recording = 0;
+    struct pollfd fds[DAEMON_MAX_CLIENTS + 1];
+    MiniaudioPlayer* player;
+    int listen_fd;
+    int client_count = 0;
+    PlayerAdaptation adaptations[PLAYER_ADAPT_LOG];
+    ma_uint64 last_adaptation = 0;
+    int i;
+
+    listen_fd = daemon_listen(socket_path);
+    if (listen_fd < 0)
+    {
+        fprintf(stderr, "Cannot listen on %s (already running?)\n", socket_path);
+        return -1;
+    }
+
+    player = player_create(mode, latency);
+    if (player == NULL)
+    {
+        fprintf(stderr, "Failed to initialize playback device.\n");
+        close(listen_fd);
+        unlink(socket_path);
+        return -1;
+    }
+
+    // Monitoring reads the status page instead of polling STATUS.
+    char page_name[64];
+    status_page_default_name(page_name, sizeof(page_name));
+    if (player_publish_status(player, page_name) != 0)
+        fprintf(stderr, "Cannot publish the status page %s\n", page_name);
+
+    // Plays, skips and completions, for the browser's play counts.
+    char history_path[512];
+    history_default_path(history_path, sizeof(history_path));
+    recording = history_open(&history, history_path) == 0;
+    if (recording)
+        player_set_history(player, &history);
+    else
+        fprintf(stderr, "Cannot open the play history %s\n", history_path);
+
+    if (metrics_address != NULL)
+    {
+        exporting = metrics_exporter_start(&exporter, metrics_address, player) == 0;
+        if (!exporting)
+            fprintf(stderr, "Cannot serve metrics on %s\n", metrics_address);
+    }
+
+    signal(SIGTERM, daemon_on_signal);
+    signal(SIGINT, daemon_on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    while (!daemon_stop_requested)
+    {
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for (i = 0; i < client_count; i++)
+        {
+            fds[i + 1].fd = clients[i].fd;
+            fds[i + 1].events = POLLIN;
+        }
+
+        if (poll(fds, client_count + 1, DAEMON_LOG_MS) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        int adapted = player_get_adaptations(player, last_adaptation, adaptations, PLAYER_ADAPT_LOG);
+        for (i = 0; i < adapted; i++)
+        {
+            char description[256];
+
+            player_describe_adaptation(&adaptations[i], description, sizeof(description));
+            fprintf(stderr, "%s\n", description);
+            last_adaptation = adaptations[i].serial;
+        }
+
+        for (i = client_count - 1; i >= 0; i--)
+        {
+            if (fds[i + 1].revents == 0)
+                continue;
+
+            int result = daemon_serve_client(player, &clients[i]);
+            if (result == 1)
+                daemon_stop_requested = 1;
+            if (result != 0)
+            {
+                close(clients[i].fd);
+                clients[i] = clients[--client_count];
+            }
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd >= 0 && client_count < DAEMON_MAX_CLIENTS)
+            {
+                clients[client_count].fd = fd;
+                clients[client_count].used = 0;
+                client_count++;
+            }
+            else if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+    }
+
+    for (i = 0; i < client_count; i++)
+        close(clients[i].fd);
+    close(listen_fd);
+    unlink(socket_path);
+    if (exporting)
+        metrics_exporter_stop(&exporter);
+    playlist_load_stop(&daemon_loader);
+    player_destroy(player);
+    if (recording)
+        history_close(&history);
+
+    return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "player.h"
+
+// Headless player: owns a MiniaudioPlayer and serves a line protocol on a Unix
+// domain socket. Every request is one line and gets exactly one reply line,
+// "OK[ payload]" or "ERR message", so clients may pipeline requests.
+//
+//   PING                  OK
+//   PLAY <path>           play a single file
+//   QUEUE <path>          append to the queue (starts it when idle)
+//   LOAD <path>           replace the queue with an M3U, PLS or XSPF playlist;
+//                         answers once it is open and queues the rest behind it
+//   NEXT / PREV           skip within the queue
+//   PAUSE                 toggle pause
+//   SEEK <seconds>        seek the current track
+//   LATENCY <profile>     low, balanced or powersave
+//   SHUFFLE on|off        play the queue in a random order
+//   REPEAT off|one|all
+//   PREFETCH <n> <bytes>  read ahead the next n queue entries within a byte budget
+//   STOP                  stop playback
+//   STATUS                OK key=value ... path=<path>  (path is always last)
+//   SHUTDOWN              stop the daemon
+//
+// The daemon also publishes a shared-memory status page (statuspage.h) for
+// monitors that must not wake it, and records what it plays in the play
+// history (history.h) at history_default_path.
+
+#define DAEMON_MAX_CLIENTS 16
+
+void daemon_default_socket(char* out, size_t out_size);
+// Runs until SHUTDOWN or SIGTERM/SIGINT. Returns 0 on a clean exit.
+// metrics_address, if not NULL, starts a metrics exporter (see metrics.h).
+int player_daemon_run(const char* socket_path, PlayerFormatMode mode, PlayerLatencyProfile latency,
+                      const char* metrics_address);
+
+#endif
@@ -0,0 +1,103 @@
+#include "dircache.h"
+#include "library.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+void dircache_init(DirCache* cache)
+{
+    memset(cache, 0, sizeof(*cache));
+}
+
+static void dircache_release(DirListing* listing)
+{
+    library_free_list(listing->entries, listing->count);
+    listing->entries = NULL;
+    listing->count = 0;
+}
+
+void dircache_free(DirCache* cache)
+{
+    for (int i = 0; i < cache->used; i++)
+        dircache_release(&cache->slots[i]);
+    cache->used = 0;
+}
+
+int dircache_mtime(const char* path, struct timespec* mtime)
+{
+    struct stat info;
+
+    if (stat(path, &info) != 0)
+        return -1;
+    *mtime = info.st_mtim;
+    return 0;
+}
+
+static DirListing* dircache_find(DirCache* cache, const char* path)
+{
+    for (int i = 0; i < cache->used; i++)
+    {
+        if (strcmp(cache->slots[i].path, path) == 0)
+            return &cache->slots[i];
+    }
+    return NULL;
+}
+
+DirListing* dircache_lookup(DirCache* cache, const char* path)
+{
+    DirListing* listing = dircache_find(cache, path);
+    struct timespec mtime;
+
+    if (listing == NULL || listing->entries == NULL)
+    {
+        cache->misses++;
+        return NULL;
+    }
+
+    if (dircache_mtime(path, &mtime) != 0 ||
+        mtime.tv_sec != listing->mtime.tv_sec || mtime.tv_nsec != listing->mtime.tv_nsec)
+    {
+        dircache_release(listing);
+        cache->misses++;
+        return NULL;
+    }
+
+    listing->last_used = ++cache->clock;
+    cache->hits++;
+    return listing;
+}
+
+DirListing* dircache_insert(DirCache* cache, const char* path, const struct timespec* mtime, char** entries, int count)
+{
+    DirListing* listing = dircache_find(cache, path);
+    int cursor = 0;
+
+    if (listing != NULL)
+    {
+        cursor = listing->cursor;
+        dircache_release(listing);
+    }
+    else if (cache->used < DIRCACHE_CAPACITY)
+    {
+        listing = &cache->slots[cache->used++];
+    }
+    else
+    {
+        listing = &cache->slots[0];
+        for (int i = 1; i < cache->used; i++)
+        {
+            if (cache->slots[i].last_used < listing->last_used)
+                listing = &cache->slots[i];
+        }
+        dircache_release(listing);
+    }
+
+    snprintf(listing->path, sizeof(listing->path), "%s", path);
+    listing->mtime = *mtime;
+    listing->entries = entries;
+    listing->count = count;
+    listing->cursor = cursor < count ? cursor : 0;
+    listing->last_used = ++cache->clock;
+
+    return listing;
+}
@@ -0,0 +1,45 @@
+#ifndef DIRCACHE_H
+#define DIRCACHE_H
+
+#include <limits.h>
+#include <time.h>
+
+// Recently visited directory listings, keyed by path and the directory's
+// mtime. A hit costs one stat: no readdir and no sort. The entries come from
+// library_list_directory or library_scan_take, so they are already sorted and
+// directories end in '/'.
+
+#define DIRCACHE_CAPACITY 32
+
+typedef struct
+{
+    char path[PATH_MAX];
+    struct timespec mtime;
+    char** entries;
+    int count;
+    int cursor;                 // selection to restore when coming back
+    unsigned long long last_used;
+} DirListing;
+
+typedef struct
+{
+    DirListing slots[DIRCACHE_CAPACITY];
+    int used;
+    unsigned long long clock;
+    unsigned long long hits;
+    unsigned long long misses;
+} DirCache;
+
+void dircache_init(DirCache* cache);
+void dircache_free(DirCache* cache);
+
+// Reads the directory's mtime; returns -1 if it cannot be stat'ed.
+int dircache_mtime(const char* path, struct timespec* mtime);
+// The cached listing for path if it is still current, else NULL. A stale
+// listing is dropped, but its cursor is kept for the replacement.
+DirListing* dircache_lookup(DirCache* cache, const char* path);
+// Takes ownership of entries, evicting the least recently used listing if full.
+// mtime should be read before the directory was listed.
+DirListing* dircache_insert(DirCache* cache, const char* path, const struct timespec* mtime, char** entries, int count);
+
+#endif
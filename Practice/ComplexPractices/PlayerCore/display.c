@@ -0,0 +1,95 @@
+#define _XOPEN_SOURCE 700
+#include "display.h"
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+// Width of the character at text, and its length in bytes.
+static int display_char(const char* text, size_t length, int* bytes)
+{
+    mbstate_t state;
+    wchar_t c;
+    size_t size;
+    int width;
+
+    if ((unsigned char)text[0] < 0x80)
+    {
+        *bytes = 1;
+        // ncurses shows control characters as ^X.
+        return (unsigned char)text[0] < 0x20 || text[0] == 0x7F ? 2 : 1;
+    }
+
+    memset(&state, 0, sizeof(state));
+    size = mbrtowc(&c, text, length, &state);
+    if (size == (size_t)-1 || size == (size_t)-2 || size == 0)
+    {
+        *bytes = 1;
+        return 1;
+    }
+    *bytes = (int)size;
+    width = wcwidth(c);
+    return width < 0 ? 1 : width;
+}
+
+int display_columns(const char* text, size_t length)
+{
+    int columns = 0;
+    size_t at = 0;
+
+    while (at < length)
+    {
+        int bytes;
+        columns += display_char(text + at, length - at, &bytes);
+        at += (size_t)bytes;
+    }
+    return columns;
+}
+
+int display_set(DisplayText* display, const char* text)
+{
+    char* copy = strdup(text);
+
+    if (copy == NULL)
+        return -1;
+    free(display->text);
+    display->text = copy;
+    display->bytes = (int)strlen(copy);
+    display->columns = display_columns(copy, (size_t)display->bytes);
+    display->cut_columns = -1;
+    return 0;
+}
+
+void display_free(DisplayText* display)
+{
+    free(display->text);
+    memset(display, 0, sizeof(*display));
+}
+
+void display_fit(DisplayText* display, int columns)
+{
+    int used = 0;
+    int at = 0;
+
+    if (display->cut_columns == columns)
+        return;
+    display->cut_columns = columns;
+
+    if (display->columns <= columns)
+    {
+        display->cut_bytes = display->bytes;
+        display->cut_width = display->columns;
+        return;
+    }
+
+    while (at < display->bytes)
+    {
+        int bytes;
+        int width = display_char(display->text + at, (size_t)(display->bytes - at), &bytes);
+        if (used + width > columns)
+            break;
+        used += width;
+        at += bytes;
+    }
+    display->cut_bytes = at;
+    display->cut_width = used;
+}
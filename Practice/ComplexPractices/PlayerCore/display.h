@@ -0,0 +1,31 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <stddef.h>
+
+// UTF-8 text with its width in terminal columns, measured once with wcwidth so
+// drawing never walks the string again. CJK and most emoji take two columns,
+// combining marks none. Needs setlocale(LC_CTYPE, "") with a UTF-8 locale.
+
+typedef struct
+{
+    char* text;
+    int bytes;
+    int columns;
+    // Where the text is cut to fit cut_columns: cut_bytes of it, taking
+    // cut_width columns, which is one short when a wide character won't fit.
+    int cut_columns;
+    int cut_bytes;
+    int cut_width;
+} DisplayText;
+
+// Columns text takes; bytes that aren't valid UTF-8 count one each.
+int display_columns(const char* text, size_t length);
+
+// Copies and measures text; the cut is worked out by display_fit.
+int display_set(DisplayText* display, const char* text);
+void display_free(DisplayText* display);
+// Cuts the text to columns, walking it only when the width has changed.
+void display_fit(DisplayText* display, int columns);
+
+#endif
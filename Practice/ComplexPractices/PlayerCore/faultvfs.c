@@ -0,0 +1,319 @@
+#include "faultvfs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct FaultFile
+{
+    ma_vfs_file inner;
+    ma_uint64 serial;
+    ma_uint64 position;
+    ma_uint64 reads;
+    unsigned random;            // for the short and error rolls
+    int faulty;                 // a config was given and the path matched
+    int stalled;
+    // Written only by the thread reading the file, with atomic stores so
+    // fault_vfs_tracks can read them while it does.
+    FaultTrackStats stats;
+};
+
+static ma_uint64 fault_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (ma_uint64)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static void fault_sleep_ms(ma_uint32 ms)
+{
+    struct timespec delay = { ms / 1000, (long)(ms % 1000) * 1000000 };
+    while (nanosleep(&delay, &delay) != 0)
+        ;
+}
+
+static int fault_parse_size(const char* text, ma_uint64* size)
+{
+    char* end;
+    double value = strtod(text, &end);
+
+    if (end == text || value < 0)
+        return -1;
+    if (*end == 'K' || *end == 'k')
+        value *= 1024, end++;
+    else if (*end == 'M' || *end == 'm')
+        value *= 1024 * 1024, end++;
+    if (*end != '\0')
+        return -1;
+
+    *size = (ma_uint64)value;
+    return 0;
+}
+
+int fault_config_load(FaultConfig* config, const char* path)
+{
+    char line[256];
+    int number = 0;
+    FILE* file = fopen(path, "r");
+
+    memset(config, 0, sizeof(*config));
+    config->seed = 1;
+    if (file == NULL)
+        return -1;
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char word[16], first[128], second[16], third[32];
+        int fields;
+
+        number++;
+        line[strcspn(line, "#\r\n")] = '\0';
+        fields = sscanf(line, "%15s %127s %15s %31s", word, first, second, third);
+        if (fields <= 0)
+            continue;
+
+        int ok = 0;
+        if (strcmp(word, "match") == 0 && fields == 2)
+        {
+            snprintf(config->match, sizeof(config->match), "%s", first);
+            ok = 1;
+        }
+        else if (strcmp(word, "delay") == 0 && (fields == 2 || (fields == 4 && strcmp(second, "every") == 0)))
+        {
+            config->delay_ms = (ma_uint32)atoi(first);
+            config->delay_every = fields == 4 ? (ma_uint32)atoi(third) : 1;
+            ok = config->delay_every > 0;
+        }
+        else if (strcmp(word, "stall") == 0 && fields == 4 && strcmp(second, "at") == 0)
+        {
+            config->stall_ms = (ma_uint32)atoi(first);
+            ok = fault_parse_size(third, &config->stall_at) == 0;
+        }
+        else if (strcmp(word, "short") == 0 && fields == 2)
+        {
+            config->short_percent = atof(first);
+            ok = 1;
+        }
+        else if (strcmp(word, "error") == 0 && fields == 2)
+        {
+            config->error_percent = atof(first);
+            ok = 1;
+        }
+        else if (strcmp(word, "seed") == 0 && fields == 2)
+        {
+            config->seed = (unsigned)strtoul(first, NULL, 10);
+            ok = 1;
+        }
+
+        if (!ok)
+        {
+            fclose(file);
+            return number;
+        }
+    }
+
+    fclose(file);
+    return 0;
+}
+
+static int fault_roll(FaultFile* file, double percent)
+{
+    return percent > 0 && (rand_r(&file->random) % 1000000) < percent * 10000;
+}
+
+static void fault_add(ma_uint64* counter, ma_uint64 amount)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + amount, __ATOMIC_RELAXED);
+}
+
+// Each number is read whole, though not all at the same instant.
+static void fault_copy_stats(FaultTrackStats* out, const FaultTrackStats* in)
+{
+    memcpy(out->path, in->path, sizeof(out->path));
+    out->open = in->open;
+    out->reads = __atomic_load_n(&in->reads, __ATOMIC_RELAXED);
+    out->bytes = __atomic_load_n(&in->bytes, __ATOMIC_RELAXED);
+    out->latency_ns = __atomic_load_n(&in->latency_ns, __ATOMIC_RELAXED);
+    out->latency_max_ns = __atomic_load_n(&in->latency_max_ns, __ATOMIC_RELAXED);
+    out->injected = __atomic_load_n(&in->injected, __ATOMIC_RELAXED);
+}
+
+static ma_result fault_vfs_open(ma_vfs* pVFS, const char* pFilePath, ma_uint32 openMode, ma_vfs_file* pFile)
+{
+    FaultVfs* vfs = (FaultVfs*)pVFS;
+    FaultFile* file = calloc(1, sizeof(FaultFile));
+    ma_result result;
+
+    *pFile = NULL;
+    if (file == NULL)
+        return MA_OUT_OF_MEMORY;
+
+    result = ma_vfs_open(vfs->inner, pFilePath, openMode, &file->inner);
+    if (result != MA_SUCCESS)
+    {
+        free(file);
+        return result;
+    }
+    file->faulty = vfs->faults && strstr(pFilePath, vfs->config.match) != NULL;
+    snprintf(file->stats.path, sizeof(file->stats.path), "%s", pFilePath);
+    file->stats.open = 1;
+
+    // The slot points at the open file; its numbers are copied in at close.
+    pthread_mutex_lock(&vfs->lock);
+    file->serial = ++vfs->opened;
+    file->random = vfs->config.seed + (unsigned)file->serial;
+    int slot = (int)(file->serial % FAULT_VFS_TRACKS);
+    vfs->live[slot] = file;
+    pthread_mutex_unlock(&vfs->lock);
+
+    *pFile = file;
+    return MA_SUCCESS;
+}
+
+static ma_result fault_vfs_close(ma_vfs* pVFS, ma_vfs_file handle)
+{
+    FaultVfs* vfs = (FaultVfs*)pVFS;
+    FaultFile* file = (FaultFile*)handle;
+    int slot = (int)(file->serial % FAULT_VFS_TRACKS);
+
+    // A newer file may have taken the slot already.
+    pthread_mutex_lock(&vfs->lock);
+    if (vfs->live[slot] == file)
+    {
+        fault_copy_stats(&vfs->tracks[slot], &file->stats);
+        vfs->tracks[slot].open = 0;
+        vfs->live[slot] = NULL;
+    }
+    pthread_mutex_unlock(&vfs->lock);
+
+    ma_result result = ma_vfs_close(vfs->inner, file->inner);
+    free(file);
+    return result;
+}
+
+static ma_result fault_vfs_read(ma_vfs* pVFS, ma_vfs_file handle, void* pDst, size_t sizeInBytes, size_t* pBytesRead)
+{
+    FaultVfs* vfs = (FaultVfs*)pVFS;
+    FaultFile* file = (FaultFile*)handle;
+    const FaultConfig* config = &vfs->config;
+    ma_uint64 start = fault_now();
+    ma_uint32 delay = 0;
+    size_t bytesRead = 0;
+    int injected = 0, fail = 0;
+    ma_result result;
+
+    file->reads++;
+    if (file->faulty)
+    {
+        if (config->delay_ms > 0 && file->reads % config->delay_every == 0)
+        {
+            delay += config->delay_ms;
+            injected++;
+        }
+        if (config->stall_ms > 0 && !file->stalled && file->position + sizeInBytes > config->stall_at)
+        {
+            delay += config->stall_ms;
+            file->stalled = 1;
+            injected++;
+        }
+
+        fail = fault_roll(file, config->error_percent);
+        if (!fail && sizeInBytes > 1 && fault_roll(file, config->short_percent))
+        {
+            sizeInBytes /= 2;
+            injected++;
+        }
+        injected += fail;
+    }
+
+    if (delay > 0)
+        fault_sleep_ms(delay);
+
+    if (fail)
+        result = MA_IO_ERROR;
+    else
+        result = ma_vfs_read(vfs->inner, file->inner, pDst, sizeInBytes, &bytesRead);
+    file->position += bytesRead;
+    if (pBytesRead != NULL)
+        *pBytesRead = bytesRead;
+
+    ma_uint64 latency = fault_now() - start;
+    fault_add(&file->stats.reads, 1);
+    fault_add(&file->stats.bytes, bytesRead);
+    fault_add(&file->stats.latency_ns, latency);
+    if (latency > file->stats.latency_max_ns)
+        __atomic_store_n(&file->stats.latency_max_ns, latency, __ATOMIC_RELAXED);
+    if (injected > 0)
+        fault_add(&file->stats.injected, (ma_uint64)injected);
+
+    return result;
+}
+
+static ma_result fault_vfs_write(ma_vfs* pVFS, ma_vfs_file handle, const void* pSrc, size_t sizeInBytes, size_t* pBytesWritten)
+{
+    return ma_vfs_write(((FaultVfs*)pVFS)->inner, ((FaultFile*)handle)->inner, pSrc, sizeInBytes, pBytesWritten);
+}
+
+static ma_result fault_vfs_seek(ma_vfs* pVFS, ma_vfs_file handle, ma_int64 offset, ma_seek_origin origin)
+{
+    FaultVfs* vfs = (FaultVfs*)pVFS;
+    FaultFile* file = (FaultFile*)handle;
+    ma_int64 position;
+    ma_result result = ma_vfs_seek(vfs->inner, file->inner, offset, origin);
+
+    if (result == MA_SUCCESS && ma_vfs_tell(vfs->inner, file->inner, &position) == MA_SUCCESS)
+        file->position = (ma_uint64)position;
+    return result;
+}
+
+static ma_result fault_vfs_tell(ma_vfs* pVFS, ma_vfs_file handle, ma_int64* pCursor)
+{
+    return ma_vfs_tell(((FaultVfs*)pVFS)->inner, ((FaultFile*)handle)->inner, pCursor);
+}
+
+static ma_result fault_vfs_info(ma_vfs* pVFS, ma_vfs_file handle, ma_file_info* pInfo)
+{
+    return ma_vfs_info(((FaultVfs*)pVFS)->inner, ((FaultFile*)handle)->inner, pInfo);
+}
+
+void fault_vfs_init(FaultVfs* vfs, ma_vfs* inner, const FaultConfig* config)
+{
+    memset(vfs, 0, sizeof(*vfs));
+    vfs->cb.onOpen = fault_vfs_open;
+    vfs->cb.onClose = fault_vfs_close;
+    vfs->cb.onRead = fault_vfs_read;
+    vfs->cb.onWrite = fault_vfs_write;
+    vfs->cb.onSeek = fault_vfs_seek;
+    vfs->cb.onTell = fault_vfs_tell;
+    vfs->cb.onInfo = fault_vfs_info;
+
+    ma_default_vfs_init(&vfs->stdio, NULL);
+    vfs->inner = inner != NULL ? inner : (ma_vfs*)&vfs->stdio;
+    if (config != NULL)
+        vfs->config = *config;
+    vfs->faults = config != NULL;
+    pthread_mutex_init(&vfs->lock, NULL);
+}
+
+void fault_vfs_uninit(FaultVfs* vfs)
+{
+    pthread_mutex_destroy(&vfs->lock);
+}
+
+int fault_vfs_tracks(FaultVfs* vfs, FaultTrackStats* tracks, int max)
+{
+    int count = 0;
+
+    pthread_mutex_lock(&vfs->lock);
+    for (ma_uint64 serial = vfs->opened; serial > 0 && count < max && count < FAULT_VFS_TRACKS; serial--)
+    {
+        int slot = (int)(serial % FAULT_VFS_TRACKS);
+        if (vfs->live[slot] != NULL)
+            fault_copy_stats(&tracks[count++], &vfs->live[slot]->stats);
+        else
+            tracks[count++] = vfs->tracks[slot];
+    }
+    pthread_mutex_unlock(&vfs->lock);
+
+    return count;
+}
@@ -0,0 +1,75 @@
+#ifndef FAULTVFS_H
+#define FAULTVFS_H
+
+#include "miniaudio.h"
+#include <pthread.h>
+
+// An ma_vfs that passes through to another one, recording reads, bytes and
+// read latency per file, and optionally injecting the faults a flaky NAS
+// produces: delays, one long stall per file, short reads and errors.
+//
+// Faults come from a config file, one rule per line, '#' for comments:
+//
+//   match <text>            only files whose path contains text
+//   delay <ms> [every <n>]  sleep before every (or every n-th) read
+//   stall <ms> at <bytes>   sleep once per file, on the read that reaches the
+//                           offset; K and M suffixes allowed
+//   short <percent>         reads that return half of what was asked
+//   error <percent>         reads that fail with MA_IO_ERROR
+//   seed <n>                for the short and error rolls
+
+#define FAULT_VFS_TRACKS 16
+
+typedef struct
+{
+    char match[128];
+    ma_uint32 delay_ms;
+    ma_uint32 delay_every;
+    ma_uint32 stall_ms;
+    ma_uint64 stall_at;
+    double short_percent;
+    double error_percent;
+    unsigned seed;
+} FaultConfig;
+
+typedef struct
+{
+    char path[512];
+    int open;
+    ma_uint64 reads;
+    ma_uint64 bytes;
+    ma_uint64 latency_ns;           // total, including injected delays
+    ma_uint64 latency_max_ns;
+    ma_uint64 injected;             // delays, stalls, short reads and errors
+} FaultTrackStats;
+
+typedef struct FaultFile FaultFile;
+
+// Reads take no lock: each file keeps its own numbers, and lock is only for
+// open, close and fault_vfs_tracks.
+typedef struct
+{
+    ma_vfs_callbacks cb;            // first, so a FaultVfs* is an ma_vfs*
+    ma_vfs* inner;
+    ma_default_vfs stdio;           // the inner VFS when none is given
+    FaultConfig config;
+    int faults;                     // a config was given; else only record
+    pthread_mutex_t lock;
+    // The most recently opened files, oldest overwritten first. A slot whose
+    // file is still open reads that file's live numbers.
+    FaultTrackStats tracks[FAULT_VFS_TRACKS];
+    FaultFile* live[FAULT_VFS_TRACKS];
+    ma_uint64 opened;
+} FaultVfs;
+
+// Returns 0, or the number of the first line that could not be parsed (-1 if
+// the file could not be read).
+int fault_config_load(FaultConfig* config, const char* path);
+
+// inner may be NULL for miniaudio's stdio VFS, and config NULL to only record.
+void fault_vfs_init(FaultVfs* vfs, ma_vfs* inner, const FaultConfig* config);
+void fault_vfs_uninit(FaultVfs* vfs);
+// Copies up to max files, newest first. Returns the number copied.
+int fault_vfs_tracks(FaultVfs* vfs, FaultTrackStats* tracks, int max);
+
+#endif
@@ -0,0 +1,683 @@
+#include "history.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// On disk, little-endian:
+//   header  "PSFH" u32 version
+//   record  u32 crc32 (of everything after it), u16 payload length, u8 type, u8 0, payload
+//
+//   PLAY, SKIP, COMPLETE  u64 id, u64 time_ms, u32 position_ms
+//   NAME                  u64 id, path bytes (no terminator)
+//   SUMMARY               u64 id, u32 plays, u32 skips, u32 completions, u64 last_played
+//
+// Unknown record types are skipped, so newer logs still load.
+
+#define HISTORY_MAGIC "PSFH"
+#define HISTORY_VERSION 1
+#define HISTORY_HEADER 8
+#define HISTORY_RECORD_HEADER 8
+#define HISTORY_RECORD_NAME 16
+#define HISTORY_RECORD_SUMMARY 17
+
+typedef struct
+{
+    unsigned char* data;
+    size_t used;
+    size_t capacity;
+} HistoryBuffer;
+
+static unsigned history_crc32(const unsigned char* data, size_t size)
+{
+    unsigned crc = 0xFFFFFFFFu;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static void history_put32(unsigned char* out, unsigned value)
+{
+    for (int i = 0; i < 4; i++)
+        out[i] = (unsigned char)(value >> (8 * i));
+}
+
+static void history_put64(unsigned char* out, unsigned long long value)
+{
+    for (int i = 0; i < 8; i++)
+        out[i] = (unsigned char)(value >> (8 * i));
+}
+
+static unsigned history_get32(const unsigned char* in)
+{
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((unsigned)in[3] << 24);
+}
+
+static unsigned long long history_get64(const unsigned char* in)
+{
+    return history_get32(in) | ((unsigned long long)history_get32(in + 4) << 32);
+}
+
+static unsigned long long history_now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Appends one record; the payload is given in up to two pieces.
+static int history_put(HistoryBuffer* buffer, int type, const unsigned char* payload, size_t size,
+                       const char* tail, size_t tail_size)
+{
+    size_t length = size + tail_size;
+    size_t needed = buffer->used + HISTORY_RECORD_HEADER + length;
+
+    if (length > 0xFFFF)
+        return -1;
+    if (needed > buffer->capacity)
+    {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+        while (capacity < needed)
+            capacity *= 2;
+        unsigned char* grown = realloc(buffer->data, capacity);
+        if (grown == NULL)
+            return -1;
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+
+    unsigned char* record = buffer->data + buffer->used;
+    record[4] = (unsigned char)length;
+    record[5] = (unsigned char)(length >> 8);
+    record[6] = (unsigned char)type;
+    record[7] = 0;
+    memcpy(record + HISTORY_RECORD_HEADER, payload, size);
+    memcpy(record + HISTORY_RECORD_HEADER + size, tail, tail_size);
+    history_put32(record, history_crc32(record + 4, 4 + length));
+    buffer->used = needed;
+    return 0;
+}
+
+static int history_write_all(int fd, const unsigned char* data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return -1;
+        data += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+void history_default_path(char* out, size_t out_size)
+{
+    const char* data_dir = getenv("XDG_DATA_HOME");
+    const char* home = getenv("HOME");
+
+    if (data_dir != NULL && data_dir[0] != '\0')
+        snprintf(out, out_size, "%s/psfsp/history.log", data_dir);
+    else
+        snprintf(out, out_size, "%s/.local/share/psfsp/history.log", home != NULL ? home : ".");
+}
+
+unsigned long long history_track_id(const char* path)
+{
+    unsigned long long hash = 0xcbf29ce484222325ull;
+
+    while (*path != '\0')
+    {
+        hash ^= (unsigned char)*path++;
+        hash *= 0x100000001b3ull;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+// --- Index. Callers hold the lock. ---
+
+static HistoryTrack* history_find(History* history, unsigned long long id)
+{
+    if (history->capacity == 0)
+        return NULL;
+
+    size_t mask = history->capacity - 1;
+    for (size_t i = (size_t)(id ^ (id >> 32)) & mask; history->slots[i].id != 0; i = (i + 1) & mask)
+    {
+        if (history->slots[i].id == id)
+            return &history->slots[i];
+    }
+    return NULL;
+}
+
+static HistoryTrack* history_insert(History* history, unsigned long long id)
+{
+    HistoryTrack* track = history_find(history, id);
+    if (track != NULL)
+        return track;
+
+    if ((history->count + 1) * 4 > history->capacity * 3)
+    {
+        size_t capacity = history->capacity ? history->capacity * 2 : 256;
+        HistoryTrack* slots = calloc(capacity, sizeof(HistoryTrack));
+        if (slots == NULL)
+            return NULL;
+
+        for (size_t i = 0; i < history->capacity; i++)
+        {
+            if (history->slots[i].id == 0)
+                continue;
+            size_t j = (size_t)(history->slots[i].id ^ (history->slots[i].id >> 32)) & (capacity - 1);
+            while (slots[j].id != 0)
+                j = (j + 1) & (capacity - 1);
+            slots[j] = history->slots[i];
+        }
+        free(history->slots);
+        history->slots = slots;
+        history->capacity = capacity;
+    }
+
+    size_t mask = history->capacity - 1;
+    size_t i = (size_t)(id ^ (id >> 32)) & mask;
+    while (history->slots[i].id != 0)
+        i = (i + 1) & mask;
+    history->slots[i].id = id;
+    history->count++;
+    return &history->slots[i];
+}
+
+static void history_clear(History* history)
+{
+    for (size_t i = 0; i < history->capacity; i++)
+        free(history->slots[i].name);
+    free(history->slots);
+    history->slots = NULL;
+    history->capacity = 0;
+    history->count = 0;
+}
+
+static void history_apply(History* history, int type, const unsigned char* payload, size_t length)
+{
+    HistoryTrack* track;
+
+    if (length < 8 || (track = history_insert(history, history_get64(payload))) == NULL)
+        return;
+
+    switch (type)
+    {
+        case HISTORY_PLAY:
+        case HISTORY_SKIP:
+        case HISTORY_COMPLETE:
+            if (length < 20)
+                return;
+            if (type == HISTORY_PLAY)
+            {
+                unsigned long long time_ms = history_get64(payload + 8);
+                track->plays++;
+                if (time_ms > track->last_played)
+                    track->last_played = time_ms;
+            }
+            else if (type == HISTORY_SKIP)
+                track->skips++;
+            else
+                track->completions++;
+            break;
+        case HISTORY_RECORD_NAME:
+            if (track->name == NULL && length > 8)
+            {
+                track->name = malloc(length - 8 + 1);
+                if (track->name != NULL)
+                {
+                    memcpy(track->name, payload + 8, length - 8);
+                    track->name[length - 8] = '\0';
+                }
+            }
+            break;
+        case HISTORY_RECORD_SUMMARY:
+            if (length < 28)
+                return;
+            track->plays += history_get32(payload + 8);
+            track->skips += history_get32(payload + 12);
+            track->completions += history_get32(payload + 16);
+            if (history_get64(payload + 20) > track->last_played)
+                track->last_played = history_get64(payload + 20);
+            break;
+    }
+}
+
+// Applies the whole records from history->offset to the end of the file.
+// Returns the number applied; *torn is set if bytes after the last one are
+// not a whole, valid record.
+static int history_read_records(History* history, int* torn)
+{
+    struct stat info;
+    unsigned char* data;
+    size_t size, at = 0;
+    int applied = 0;
+
+    *torn = 0;
+    if (fstat(history->fd, &info) != 0 || (unsigned long long)info.st_size <= history->offset)
+        return 0;
+
+    size = (size_t)(info.st_size - history->offset);
+    data = malloc(size);
+    if (data == NULL)
+        return 0;
+    for (size_t got = 0; got < size; )
+    {
+        ssize_t count = pread(history->fd, data + got, size - got, (off_t)(history->offset + got));
+        if (count <= 0)
+        {
+            size = got;
+            break;
+        }
+        got += (size_t)count;
+    }
+
+    pthread_mutex_lock(&history->lock);
+    while (at + HISTORY_RECORD_HEADER <= size)
+    {
+        const unsigned char* record = data + at;
+        size_t length = record[4] | (record[5] << 8);
+
+        if (at + HISTORY_RECORD_HEADER + length > size ||
+            history_get32(record) != history_crc32(record + 4, 4 + length))
+            break;
+        history_apply(history, record[6], record + HISTORY_RECORD_HEADER, length);
+        at += HISTORY_RECORD_HEADER + length;
+        applied++;
+    }
+    pthread_mutex_unlock(&history->lock);
+
+    *torn = at < size;
+    history->offset += at;
+    free(data);
+    return applied;
+}
+
+static int history_check_header(int fd)
+{
+    unsigned char header[HISTORY_HEADER];
+
+    return pread(fd, header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+           memcmp(header, HISTORY_MAGIC, 4) == 0 && history_get32(header + 4) == HISTORY_VERSION;
+}
+
+static int history_write_header(int fd)
+{
+    unsigned char header[HISTORY_HEADER];
+
+    memcpy(header, HISTORY_MAGIC, 4);
+    history_put32(header + 4, HISTORY_VERSION);
+    return history_write_all(fd, header, sizeof(header));
+}
+
+// --- Writer ---
+
+static void history_fsync_dir(const char* path)
+{
+    char dir[512];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char* slash = strrchr(dir, '/');
+    if (slash == NULL)
+        snprintf(dir, sizeof(dir), ".");
+    else
+        *slash = '\0';
+
+    int fd = open(dir[0] != '\0' ? dir : "/", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+static void history_put_summary(HistoryBuffer* buffer, const HistoryTrack* track)
+{
+    unsigned char payload[28];
+
+    history_put64(payload, track->id);
+    if (track->name != NULL)
+        history_put(buffer, HISTORY_RECORD_NAME, payload, 8, track->name, strlen(track->name));
+    history_put32(payload + 8, track->plays);
+    history_put32(payload + 12, track->skips);
+    history_put32(payload + 16, track->completions);
+    history_put64(payload + 20, track->last_played);
+    history_put(buffer, HISTORY_RECORD_SUMMARY, payload, sizeof(payload), NULL, 0);
+}
+
+// Rewrites the log as one summary per track. The writer is the only thread
+// that changes the index, so it reads it here without the lock.
+static void history_compact(History* history)
+{
+    HistoryBuffer buffer = { NULL, 0, 0 };
+    char temp[520];
+    int fd;
+
+    snprintf(temp, sizeof(temp), "%s.tmp", history->path);
+    fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return;
+
+    for (size_t i = 0; i < history->capacity; i++)
+    {
+        if (history->slots[i].id != 0)
+            history_put_summary(&buffer, &history->slots[i]);
+    }
+
+    if (history_write_header(fd) != 0 || history_write_all(fd, buffer.data, buffer.used) != 0 ||
+        fsync(fd) != 0 || rename(temp, history->path) != 0)
+    {
+        close(fd);
+        unlink(temp);
+        free(buffer.data);
+        return;
+    }
+    close(fd);
+    history_fsync_dir(history->path);
+
+    fd = open(history->path, O_RDWR | O_APPEND | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        close(history->fd);
+        history->fd = fd;
+        history->offset = HISTORY_HEADER + buffer.used;
+        history->appended = 0;
+    }
+    free(buffer.data);
+}
+
+// Updates the index and appends the batch with a single write and sync.
+static void history_append(History* history, const HistoryEvent* events, int count)
+{
+    HistoryBuffer buffer = { NULL, 0, 0 };
+    unsigned char payload[20];
+
+    for (int i = 0; i < count; i++)
+    {
+        const HistoryEvent* event = &events[i];
+        unsigned long long id = history_track_id(event->path);
+
+        history_put64(payload, id);
+        history_put64(payload + 8, event->time_ms);
+        history_put32(payload + 16, event->position_ms);
+
+        pthread_mutex_lock(&history->lock);
+        HistoryTrack* track = history_insert(history, id);
+        if (track != NULL && track->name == NULL)
+        {
+            track->name = strdup(event->path);
+            history_put(&buffer, HISTORY_RECORD_NAME, payload, 8, event->path, strlen(event->path));
+        }
+        history_apply(history, event->type, payload, sizeof(payload));
+        pthread_mutex_unlock(&history->lock);
+
+        history_put(&buffer, event->type, payload, sizeof(payload), NULL, 0);
+    }
+
+    // A failed write must not leave half a record for later ones to follow.
+    if (history_write_all(history->fd, buffer.data, buffer.used) != 0 || fdatasync(history->fd) != 0)
+    {
+        fprintf(stderr, "Cannot write %s: %s\n", history->path, strerror(errno));
+        if (ftruncate(history->fd, (off_t)history->offset) != 0)
+            history->writable = 0;
+    }
+    else
+    {
+        history->offset += buffer.used;
+        history->appended += count;
+    }
+    free(buffer.data);
+}
+
+static void* history_writer(void* arg)
+{
+    History* history = (History*)arg;
+    HistoryEvent* batch = malloc(sizeof(HistoryEvent) * HISTORY_QUEUE);
+    int quit = 0;
+
+    while (batch != NULL && !quit)
+    {
+        int count;
+
+        pthread_mutex_lock(&history->lock);
+        while (history->queue_count == 0 && !history->quit)
+            pthread_cond_wait(&history->wake, &history->lock);
+
+        // Let the batch fill for a while, so one sync covers several events.
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += HISTORY_BATCH_MS / 1000;
+        deadline.tv_nsec += (HISTORY_BATCH_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (!history->quit && history->queue_count < HISTORY_QUEUE / 2)
+        {
+            if (pthread_cond_timedwait(&history->wake, &history->lock, &deadline) == ETIMEDOUT)
+                break;
+        }
+
+        count = history->queue_count;
+        for (int i = 0; i < count; i++)
+            batch[i] = history->queue[(history->queue_head + i) % HISTORY_QUEUE];
+        history->queue_head = 0;
+        history->queue_count = 0;
+        quit = history->quit;
+        pthread_mutex_unlock(&history->lock);
+
+        if (count > 0 && history->writable)
+            history_append(history, batch, count);
+        if (history->appended >= HISTORY_COMPACT_EVENTS && history->writable)
+            history_compact(history);
+    }
+
+    free(batch);
+    return NULL;
+}
+
+static int history_make_dirs(const char* path)
+{
+    char dir[512];
+
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (char* slash = strchr(dir + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+            return -1;
+        *slash = '/';
+    }
+    return 0;
+}
+
+static void history_init(History* history, const char* path)
+{
+    memset(history, 0, sizeof(*history));
+    snprintf(history->path, sizeof(history->path), "%s", path);
+    history->fd = -1;
+    pthread_mutex_init(&history->lock, NULL);
+    pthread_cond_init(&history->wake, NULL);
+}
+
+int history_open(History* history, const char* path)
+{
+    struct stat info;
+    int torn;
+
+    history_init(history, path);
+    history_make_dirs(path);
+    history->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (history->fd < 0 || fstat(history->fd, &info) != 0)
+        goto fail;
+
+    if (info.st_size == 0)
+    {
+        if (history_write_header(history->fd) != 0 || fdatasync(history->fd) != 0)
+            goto fail;
+    }
+    else if (!history_check_header(history->fd))
+    {
+        fprintf(stderr, "%s is not a play history log\n", path);
+        goto fail;
+    }
+
+    history->offset = HISTORY_HEADER;
+    int records = history_read_records(history, &torn);
+    if (torn)
+    {
+        fprintf(stderr, "%s: dropping a damaged tail after %d records\n", path, records);
+        if (ftruncate(history->fd, (off_t)history->offset) != 0)
+            goto fail;
+    }
+    // Counting what is already there lets the first batch compact an overgrown log.
+    history->appended = (unsigned long long)records;
+    history->writable = 1;
+
+    if (pthread_create(&history->thread, NULL, history_writer, history) != 0)
+        goto fail;
+    return 0;
+
+fail:
+    if (history->fd >= 0)
+        close(history->fd);
+    history_clear(history);
+    pthread_cond_destroy(&history->wake);
+    pthread_mutex_destroy(&history->lock);
+    return -1;
+}
+
+int history_open_readonly(History* history, const char* path)
+{
+    history_init(history, path);
+    history_refresh(history);
+    return 0;
+}
+
+int history_refresh(History* history)
+{
+    struct stat info;
+    int torn, changed = 0;
+
+    if (history->writable || stat(history->path, &info) != 0)
+        return 0;
+
+    if (history->fd < 0 || (unsigned long long)info.st_ino != history->inode ||
+        (unsigned long long)info.st_size < history->offset)
+    {
+        int fd = open(history->path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0 || fstat(fd, &info) != 0 || !history_check_header(fd))
+        {
+            if (fd >= 0)
+                close(fd);
+            return 0;
+        }
+        if (history->fd >= 0)
+            close(history->fd);
+        history->fd = fd;
+        history->inode = (unsigned long long)info.st_ino;
+        history->offset = HISTORY_HEADER;
+        pthread_mutex_lock(&history->lock);
+        changed = history->count > 0;
+        history_clear(history);
+        pthread_mutex_unlock(&history->lock);
+    }
+
+    // A torn tail is usually a batch still being written; it is read next time.
+    return history_read_records(history, &torn) > 0 || changed;
+}
+
+void history_close(History* history)
+{
+    if (history->writable)
+    {
+        pthread_mutex_lock(&history->lock);
+        history->quit = 1;
+        pthread_cond_signal(&history->wake);
+        pthread_mutex_unlock(&history->lock);
+        pthread_join(history->thread, NULL);
+    }
+    if (history->fd >= 0)
+        close(history->fd);
+    history_clear(history);
+    pthread_cond_destroy(&history->wake);
+    pthread_mutex_destroy(&history->lock);
+}
+
+void history_record(History* history, HistoryEventType type, const char* path, unsigned position_ms)
+{
+    pthread_mutex_lock(&history->lock);
+    if (history->queue_count == HISTORY_QUEUE)
+    {
+        history->dropped++;
+    }
+    else
+    {
+        HistoryEvent* event = &history->queue[(history->queue_head + history->queue_count) % HISTORY_QUEUE];
+        event->type = type;
+        event->position_ms = position_ms;
+        event->time_ms = history_now_ms();
+        snprintf(event->path, sizeof(event->path), "%s", path);
+        if (++history->queue_count == 1 || history->queue_count == HISTORY_QUEUE / 2)
+            pthread_cond_signal(&history->wake);
+    }
+    pthread_mutex_unlock(&history->lock);
+}
+
+int history_lookup(History* history, const char* path, HistoryTrack* track)
+{
+    unsigned long long id = history_track_id(path);
+    int found = 0;
+
+    pthread_mutex_lock(&history->lock);
+    HistoryTrack* entry = history_find(history, id);
+    if (entry != NULL)
+    {
+        *track = *entry;
+        track->name = NULL;
+        found = 1;
+    }
+    pthread_mutex_unlock(&history->lock);
+
+    return found;
+}
+
+int history_most_skipped(History* history, HistoryTrack* tracks, int max)
+{
+    int count = 0;
+
+    pthread_mutex_lock(&history->lock);
+    for (size_t i = 0; i < history->capacity; i++)
+    {
+        const HistoryTrack* entry = &history->slots[i];
+        if (entry->id == 0 || entry->skips == 0)
+            continue;
+        if (count == max && (max == 0 || entry->skips <= tracks[max - 1].skips))
+            continue;
+
+        // Insertion into the sorted top list.
+        int at = count < max ? count++ : max - 1;
+        while (at > 0 && tracks[at - 1].skips < entry->skips)
+        {
+            tracks[at] = tracks[at - 1];
+            at--;
+        }
+        tracks[at] = *entry;
+    }
+    pthread_mutex_unlock(&history->lock);
+
+    return count;
+}
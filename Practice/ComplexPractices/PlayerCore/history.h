@@ -0,0 +1,96 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+// Play history: every play, skip and completion, appended to a binary log and
+// summarised in an in-memory index keyed by track ID (a hash of the path).
+//
+// The log is a header followed by records, each carrying a CRC32, so a torn
+// write at the end is detected on open and cut off. A writer thread appends
+// queued events in batches and syncs once per batch; once enough events have
+// piled up it compacts the log into one summary record per track, written to a
+// temporary file that is renamed over the old one.
+//
+// Lookups take the index lock and never touch the disk. Another process can
+// follow the same log read-only and pick up new records with history_refresh.
+
+#define HISTORY_QUEUE 256               // events waiting for the writer; more are dropped
+#define HISTORY_BATCH_MS 1000           // how long the writer lets a batch collect
+#define HISTORY_COMPACT_EVENTS 4096     // events appended since the last compaction
+
+typedef enum
+{
+    HISTORY_PLAY = 1,                   // a track started
+    HISTORY_SKIP,                       // left before its end
+    HISTORY_COMPLETE                    // played to its end
+} HistoryEventType;
+
+typedef struct
+{
+    unsigned long long id;
+    unsigned plays;
+    unsigned skips;
+    unsigned completions;
+    unsigned long long last_played;     // Unix time in ms, 0 if never
+    char* name;                         // path, NULL until a record names it
+} HistoryTrack;
+
+typedef struct
+{
+    int type;
+    unsigned position_ms;               // how far the track got
+    unsigned long long time_ms;
+    char path[512];
+} HistoryEvent;
+
+typedef struct
+{
+    char path[512];
+    int fd;
+    int writable;
+    unsigned long long offset;          // end of the last whole record read or written
+    unsigned long long inode;           // readers reload when compaction replaces the file
+    unsigned long long appended;        // events since the last compaction
+    // Open addressing on id; the writer (or refreshing reader) is the only mutator.
+    pthread_mutex_t lock;
+    HistoryTrack* slots;
+    size_t capacity;
+    size_t count;
+    // Writer thread and its queue.
+    pthread_t thread;
+    pthread_cond_t wake;
+    HistoryEvent queue[HISTORY_QUEUE];
+    int queue_head;
+    int queue_count;
+    int quit;
+    unsigned long long dropped;
+} History;
+
+// $XDG_DATA_HOME/psfsp/history.log, or ~/.local/share/psfsp/history.log.
+void history_default_path(char* out, size_t out_size);
+unsigned long long history_track_id(const char* path);
+
+// Loads the log, truncating a torn tail, and starts the writer thread.
+// Creates the file and its directory if needed.
+int history_open(History* history, const char* path);
+// Loads the log if there is one; history_refresh keeps following it.
+int history_open_readonly(History* history, const char* path);
+// Writes out what is still queued, then stops the writer.
+void history_close(History* history);
+
+// Queues an event without touching the disk; drops it if the queue is full.
+void history_record(History* history, HistoryEventType type, const char* path, unsigned position_ms);
+// Readers only: applies records appended since the last call, or reloads the
+// whole log if it was compacted. Returns 1 if anything changed.
+int history_refresh(History* history);
+
+// Copies the track's entry (without its name). Returns 0 if it has none.
+int history_lookup(History* history, const char* path, HistoryTrack* track);
+// The tracks skipped most often, most first, with names. Returns the number
+// copied; names point into the index, so they last until it is reloaded by
+// history_refresh or freed by history_close.
+int history_most_skipped(History* history, HistoryTrack* tracks, int max);
+
+#endif
@@ -0,0 +1,300 @@
+#include "library.h"
+#include "sortkey.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static LibraryCounters library_counters;
+
+const char* get_filename(const char* filepath)
+{
+    const char* filename = strrchr(filepath, '/');
+    if (filename == NULL) {
+        return filepath;
+    }
+    return filename + 1;
+}
+
+int compare_strings(const void* a, const void* b)
+{
+    return strcmp(*(const char**)a, *(const char**)b);
+}
+
+int is_audio_file(const char* filename)
+{
+    const char* ext = strrchr(filename, '.');
+    if (ext == NULL) return 0;
+
+    return (strcmp(ext, ".mp3") == 0 ||
+            strcmp(ext, ".MP3") == 0 ||
+            strcmp(ext, ".wav") == 0 ||
+            strcmp(ext, ".WAV") == 0 ||
+            strcmp(ext, ".flac") == 0 ||
+            strcmp(ext, ".FLAC") == 0 ||
+            strcmp(ext, ".ogg") == 0 ||
+            strcmp(ext, ".OGG") == 0 ||
+            strcmp(ext, ".m4a") == 0 ||
+            strcmp(ext, ".M4A") == 0);
+}
+
+static int library_skip_entry(const char* name)
+{
+    return strcmp(name, "..") == 0 || strcmp(name, ".DS_Store") == 0;
+}
+
+// Copies the entry name, with a trailing '/' for directories. d_type saves a
+// stat per entry on filesystems that fill it in.
+static char* library_entry_name(const char* dirpath, const struct dirent* entry)
+{
+    int is_dir = entry->d_type == DT_DIR;
+    size_t length = strlen(entry->d_name);
+    char* name;
+
+    if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK)
+    {
+        char path[PATH_MAX];
+        struct stat info;
+
+        snprintf(path, sizeof(path), "%s/%s", dirpath, entry->d_name);
+        is_dir = stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+    }
+    if (strcmp(entry->d_name, ".") == 0)
+        is_dir = 0;
+
+    name = malloc(length + 2);
+    memcpy(name, entry->d_name, length);
+    if (is_dir)
+        name[length++] = '/';
+    name[length] = '\0';
+
+    return name;
+}
+
+// Natural order, with "." (the play-all entry) kept on top.
+static void library_sort_entries(char** list, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(list[i], ".") == 0)
+        {
+            char* dot = list[i];
+            list[i] = list[0];
+            list[0] = dot;
+            natural_sort_strings(list + 1, count - 1);
+            return;
+        }
+    }
+    natural_sort_strings(list, count);
+}
+
+static void library_count_scan(int files)
+{
+    __atomic_add_fetch(&library_counters.directories_scanned, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&library_counters.files_scanned, files, __ATOMIC_RELAXED);
+}
+
+int library_list_directory(const char* path, char*** files)
+{
+    DIR* dir = opendir(path);
+    struct dirent* entry;
+    char** list = NULL;
+    int count = 0;
+
+    if (dir == NULL)
+        return -1;
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (library_skip_entry(entry->d_name))
+            continue;
+
+        list = realloc(list, sizeof(char*) * (count + 1));
+        list[count++] = library_entry_name(path, entry);
+    }
+    closedir(dir);
+
+    library_sort_entries(list, count);
+
+    library_count_scan(count);
+
+    *files = list;
+    return count;
+}
+
+void library_free_list(char** files, int count)
+{
+    for (int i = 0; i < count; i++)
+        free(files[i]);
+    free(files);
+}
+
+static void* library_scan_thread(void* arg)
+{
+    LibraryScan* scan = (LibraryScan*)arg;
+    DIR* dir = opendir(scan->path);
+    struct dirent* entry;
+
+    if (dir == NULL)
+    {
+        __atomic_store_n(&scan->state, -1, __ATOMIC_RELEASE);
+        return NULL;
+    }
+
+    while (!__atomic_load_n(&scan->cancel, __ATOMIC_RELAXED) && (entry = readdir(dir)) != NULL)
+    {
+        if (library_skip_entry(entry->d_name))
+            continue;
+
+        char* name = library_entry_name(scan->path, entry);
+        pthread_mutex_lock(&scan->lock);
+        if (scan->count == scan->capacity)
+        {
+            scan->capacity = scan->capacity ? scan->capacity * 2 : 256;
+            scan->entries = realloc(scan->entries, sizeof(char*) * scan->capacity);
+        }
+        scan->entries[scan->count++] = name;
+        pthread_mutex_unlock(&scan->lock);
+    }
+    closedir(dir);
+
+    library_count_scan(scan->count);
+    __atomic_store_n(&scan->state, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+int library_scan_start(LibraryScan* scan, const char* path)
+{
+    memset(scan, 0, sizeof(*scan));
+    snprintf(scan->path, sizeof(scan->path), "%s", path);
+    pthread_mutex_init(&scan->lock, NULL);
+    sortkeys_init(&scan->keys);
+
+    if (pthread_create(&scan->thread, NULL, library_scan_thread, scan) != 0)
+    {
+        pthread_mutex_destroy(&scan->lock);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Keys the entries up to found that have none yet and merges them into the
+// order. Returns -1 if that ran out of memory; the next call catches up.
+static int library_scan_merge(LibraryScan* scan, int found)
+{
+    for (int i = scan->keyed; i < found; i++)
+    {
+        const char* name = scan->entries[i];
+
+        if (strcmp(name, ".") == 0)
+        {
+            scan->dot = scan->entries[i];
+            continue;
+        }
+        sortkeys_begin(&scan->keys, (size_t)i);
+        sortkeys_text(&scan->keys, name);
+        sortkeys_bytes(&scan->keys, name, strlen(name));
+    }
+    scan->keyed = found;
+
+    if (sortkeys_merge(&scan->keys, scan->merged) != 0)
+        return -1;
+    scan->merged = scan->keys.count;
+    return 0;
+}
+
+// Fills out with the entries keyed so far, in order.
+static void library_scan_order(LibraryScan* scan, char** out)
+{
+    int n = 0;
+
+    if (scan->dot != NULL)
+        out[n++] = scan->dot;
+    for (size_t i = 0; i < scan->keys.count; i++)
+        out[n++] = scan->entries[scan->keys.keys[i].index];
+}
+
+int library_scan_poll(LibraryScan* scan, char*** files, int* count)
+{
+    char** sorted;
+    int found;
+
+    // Under the lock: the scan thread may move entries as it grows it.
+    pthread_mutex_lock(&scan->lock);
+    found = scan->count;
+    if (found == scan->published)
+    {
+        pthread_mutex_unlock(&scan->lock);
+        return 0;
+    }
+    sorted = malloc(sizeof(char*) * found);
+    if (sorted == NULL || library_scan_merge(scan, found) != 0)
+    {
+        pthread_mutex_unlock(&scan->lock);
+        free(sorted);
+        return 0;
+    }
+    library_scan_order(scan, sorted);
+    scan->published = found;
+    pthread_mutex_unlock(&scan->lock);
+
+    *files = sorted;
+    *count = found;
+
+    return 1;
+}
+
+int library_scan_state(LibraryScan* scan)
+{
+    return __atomic_load_n(&scan->state, __ATOMIC_ACQUIRE);
+}
+
+int library_scan_take(LibraryScan* scan, char*** files)
+{
+    char** sorted;
+    int count;
+
+    pthread_join(scan->thread, NULL);
+    pthread_mutex_destroy(&scan->lock);
+
+    // Only what arrived since the last poll still needs sorting. Short of
+    // memory for that, sort the lot in place.
+    sorted = malloc(sizeof(char*) * (scan->count > 0 ? scan->count : 1));
+    if (sorted != NULL && library_scan_merge(scan, scan->count) == 0)
+    {
+        library_scan_order(scan, sorted);
+        free(scan->entries);
+        scan->entries = sorted;
+    }
+    else
+    {
+        free(sorted);
+        library_sort_entries(scan->entries, scan->count);
+    }
+    sortkeys_free(&scan->keys);
+    *files = scan->entries;
+    count = scan->count;
+    scan->entries = NULL;
+    scan->count = 0;
+
+    return count;
+}
+
+void library_scan_free(LibraryScan* scan)
+{
+    __atomic_store_n(&scan->cancel, 1, __ATOMIC_RELAXED);
+    pthread_join(scan->thread, NULL);
+    pthread_mutex_destroy(&scan->lock);
+    library_free_list(scan->entries, scan->count);
+    sortkeys_free(&scan->keys);
+    scan->entries = NULL;
+    scan->count = 0;
+}
+
+void library_get_counters(LibraryCounters* counters)
+{
+    counters->directories_scanned = __atomic_load_n(&library_counters.directories_scanned, __ATOMIC_RELAXED);
+    counters->files_scanned = __atomic_load_n(&library_counters.files_scanned, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,65 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+#include "sortkey.h"
+#include <limits.h>
+#include <pthread.h>
+
+// Helpers for working with the music directory.
+
+const char* get_filename(const char* filepath);
+int is_audio_file(const char* filename);
+// qsort comparator for an array of char*.
+int compare_strings(const void* a, const void* b);
+
+// Lists a directory as sorted, malloc'd entry names (".." and .DS_Store are
+// skipped, "." is kept as the play-all entry, directories end in '/').
+// Returns the count, or -1 if the directory cannot be opened. Free with
+// library_free_list.
+int library_list_directory(const char* path, char*** files);
+void library_free_list(char** files, int count);
+
+// A directory listing that runs on its own thread so the UI can draw while it
+// fills in. Entries are only ever added; their strings stay valid until
+// library_scan_free.
+typedef struct
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    char path[PATH_MAX];
+    char** entries;
+    int count;
+    int capacity;
+    int published;          // count the last poll returned
+    // Entries are keyed once, as they arrive, and merged into the order so
+    // far, so a poll doesn't sort the whole listing again.
+    SortKeys keys;
+    int keyed;              // entries with a key (or the "." entry)
+    size_t merged;          // keys in order
+    char* dot;              // the play-all entry, always first
+    int state;              // 0 scanning, 1 done, -1 could not open
+    int cancel;
+} LibraryScan;
+
+int library_scan_start(LibraryScan* scan, const char* path);
+// If entries arrived since the last call, replaces *files with a new sorted
+// array of them (the caller frees the old array, not the strings) and returns 1.
+// Only the new entries are sorted; they are merged into the ones before.
+int library_scan_poll(LibraryScan* scan, char*** files, int* count);
+int library_scan_state(LibraryScan* scan);
+// Once the scan is done: hands over the sorted entries and ends the scan, in
+// place of library_scan_free.
+int library_scan_take(LibraryScan* scan, char*** files);
+// Stops a scan that is still running and frees the entries.
+void library_scan_free(LibraryScan* scan);
+
+typedef struct
+{
+    unsigned long long directories_scanned;
+    unsigned long long files_scanned;
+} LibraryCounters;
+
+// Totals for this process; safe to read from any thread.
+void library_get_counters(LibraryCounters* counters);
+
+#endif
@@ -0,0 +1,37 @@
+#!/bin/bash
+
+# Builds build/libplayercore.a for Linux. Objects are only rebuilt when their
+# source (or any header) changed, so miniaudio is compiled once, not per program.
+
+set -e
+cd "$(dirname "$0")"
+mkdir -p build
+
+CFLAGS="-O2 -Wall $CFLAGS"
+SOURCES="miniaudio.c player.c library.c waveform.c daemon.c client.c statuspage.c metrics.c sortkey.c dircache.c prefetch.c asyncvfs.c faultvfs.c history.c playlist.c tags.c display.c arena.c rtcheck.c"
+OBJECTS=""
+
+# Objects built with other flags (say -DPLAYER_RT_CHECK) are all stale.
+[ "$(cat build/cflags 2>/dev/null)" = "$CFLAGS" ] || rm -f build/*.o
+echo "$CFLAGS" > build/cflags
+
+for src in $SOURCES
+do
+    obj="build/${src%.c}.o"
+    OBJECTS="$OBJECTS $obj"
+
+    stale=0
+    [ -f "$obj" ] || stale=1
+    for dep in "$src" *.h
+    do
+        [ "$dep" -nt "$obj" ] && stale=1
+    done
+
+    if [ $stale -eq 1 ]; then
+        echo "[ gcc $src ]"
+        gcc $CFLAGS -c "$src" -o "$obj"
+    fi
+done
+
+rm -f build/libplayercore.a
+ar rcs build/libplayercore.a $OBJECTS
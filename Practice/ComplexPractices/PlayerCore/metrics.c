@@ -0,0 +1,257 @@
+#include "metrics.h"
+#include "library.h"
+#include <ctype.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Like snprintf, keeps counting once out is full, so the caller can tell what
+// didn't fit and how much room it needs.
+static size_t metrics_append(char* out, size_t out_size, size_t used, const char* format, ...)
+{
+    va_list args;
+    int written;
+
+    va_start(args, format);
+    if (used < out_size)
+        written = vsnprintf(out + used, out_size - used, format, args);
+    else
+        written = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    return written > 0 ? used + written : used;
+}
+
+static size_t metrics_counter(char* out, size_t out_size, size_t used, const char* name, const char* help, unsigned long long value)
+{
+    return metrics_append(out, out_size, used, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name, value);
+}
+
+size_t metrics_format(MetricsExporter* exporter, char* out, size_t out_size)
+{
+    LibraryCounters library;
+    size_t used = 0;
+
+    if (exporter->player != NULL)
+    {
+        PlayerCounters player;
+
+        player_get_counters(exporter->player, &player);
+        used = metrics_counter(out, out_size, used, "psfsp_callbacks_total", "Audio callbacks serviced.", player.callbacks);
+        used = metrics_counter(out, out_size, used, "psfsp_idle_callbacks_total", "Audio callbacks that only wrote silence.", player.idle_callbacks);
+        used = metrics_counter(out, out_size, used, "psfsp_underruns_total", "Callbacks more than 1.5 periods late.", player.underruns);
+        used = metrics_append(out, out_size, used,
+                              "# HELP psfsp_decode_seconds_total Time spent decoding.\n"
+                              "# TYPE psfsp_decode_seconds_total counter\n"
+                              "psfsp_decode_seconds_total %.9f\n", player.decode_ns / 1e9);
+        used = metrics_counter(out, out_size, used, "psfsp_frames_decoded_total", "PCM frames decoded.", player.frames_decoded);
+        used = metrics_counter(out, out_size, used, "psfsp_tracks_played_total", "Tracks played to the end.", player.tracks_played);
+        used = metrics_counter(out, out_size, used, "psfsp_track_open_failures_total", "Tracks that could not be opened.", player.open_failures);
+        used = metrics_counter(out, out_size, used, "psfsp_io_read_bytes_total", "Bytes read by decoders.", player.io_bytes);
+        used = metrics_counter(out, out_size, used, "psfsp_io_stalls_total", "Decoder reads that waited for the disk.", player.io_stalls);
+        used = metrics_append(out, out_size, used,
+                              "# HELP psfsp_io_stall_seconds_total Time decoders spent waiting for the disk.\n"
+                              "# TYPE psfsp_io_stall_seconds_total counter\n"
+                              "psfsp_io_stall_seconds_total %.9f\n", player.io_stall_ns / 1e9);
+        used = metrics_counter(out, out_size, used, "psfsp_prefetch_files_total", "Queued files read ahead.", player.prefetch_files);
+        used = metrics_counter(out, out_size, used, "psfsp_prefetch_bytes_total", "Bytes asked to be read ahead.", player.prefetch_bytes);
+        used = metrics_counter(out, out_size, used, "psfsp_prefetch_used_bytes_total", "Read-ahead bytes of files that went on to play.", player.prefetch_used_bytes);
+        used = metrics_counter(out, out_size, used, "psfsp_prefetch_wasted_bytes_total", "Read-ahead bytes of files dropped from the queue unplayed.", player.prefetch_wasted_bytes);
+        used = metrics_counter(out, out_size, used, "psfsp_decoder_allocations_total", "Decoder allocations served from track arenas.", player.decoder_allocs);
+        used = metrics_counter(out, out_size, used, "psfsp_decoder_audio_allocations_total", "Decoder allocations made on the audio thread.", player.decoder_audio_allocs);
+        used = metrics_counter(out, out_size, used, "psfsp_decoder_system_allocations_total", "Decoder allocations passed to malloc because an arena was full.", player.decoder_system_allocs);
+        used = metrics_counter(out, out_size, used, "psfsp_decoder_audio_system_allocations_total", "Decoder allocations passed to malloc on the audio thread.", player.decoder_audio_system_allocs);
+        used = metrics_counter(out, out_size, used, "psfsp_buffering_raised_total", "Times underruns made the player buffer more.", player.adaptations_raised);
+        used = metrics_counter(out, out_size, used, "psfsp_buffering_lowered_total", "Times a quiet spell let the player buffer less.", player.adaptations_lowered);
+        used = metrics_counter(out, out_size, used, "psfsp_device_suspends_total", "Times the device was stopped while idle.", player.suspends);
+        used = metrics_append(out, out_size, used,
+                              "# HELP psfsp_device_suspended_seconds_total Time the device spent stopped while idle.\n"
+                              "# TYPE psfsp_device_suspended_seconds_total counter\n"
+                              "psfsp_device_suspended_seconds_total %.9f\n", player.suspended_ns / 1e9);
+        used = metrics_counter(out, out_size, used, "psfsp_resumes_total", "Resumes from pause or idle.", player.resumes);
+        used = metrics_append(out, out_size, used,
+                              "# HELP psfsp_resume_seconds_total Time from each resume to its first audible callback.\n"
+                              "# TYPE psfsp_resume_seconds_total counter\n"
+                              "psfsp_resume_seconds_total %.9f\n", player.resume_ns / 1e9);
+    }
+
+    library_get_counters(&library);
+    used = metrics_counter(out, out_size, used, "psfsp_library_directories_scanned_total", "Directories listed.", library.directories_scanned);
+    used = metrics_counter(out, out_size, used, "psfsp_library_files_scanned_total", "Directory entries listed.", library.files_scanned);
+    used = metrics_counter(out, out_size, used, "psfsp_metrics_scrapes_total", "Scrapes served by this exporter.", exporter->scrapes);
+
+    return used;
+}
+
+static void metrics_serve(MetricsExporter* exporter, int fd)
+{
+    struct pollfd request = { fd, POLLIN, 0 };
+    size_t size = METRICS_BODY_SIZE;
+    char* body = malloc(size);
+    char header[128];
+    char discard[1024];
+    size_t length = 0;
+
+    // Any request gets the metrics; read it only so the peer sees a clean close.
+    if (poll(&request, 1, 1000) > 0)
+        recv(fd, discard, sizeof(discard), MSG_DONTWAIT);
+
+    exporter->scrapes++;
+    // Grow until everything fits; counters may have grown a digit between
+    // passes, hence the loop.
+    while (body != NULL && (length = metrics_format(exporter, body, size)) >= size)
+    {
+        char* grown = realloc(body, length + 1);
+        if (grown == NULL)
+        {
+            free(body);
+            body = NULL;
+            break;
+        }
+        body = grown;
+        size = length + 1;
+    }
+    if (body == NULL)
+    {
+        close(fd);
+        return;
+    }
+    snprintf(header, sizeof(header),
+             "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", length);
+
+    send(fd, header, strlen(header), MSG_NOSIGNAL);
+    send(fd, body, length, MSG_NOSIGNAL);
+    free(body);
+    close(fd);
+}
+
+static void* metrics_thread(void* arg)
+{
+    MetricsExporter* exporter = (MetricsExporter*)arg;
+    struct pollfd fds[2];
+
+    fds[0].fd = exporter->listen_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = exporter->wake_pipe[0];
+    fds[1].events = POLLIN;
+
+    for (;;)
+    {
+        if (poll(fds, 2, -1) < 0)
+            continue;
+        if (fds[1].revents != 0)
+            break;
+        if (fds[0].revents & POLLIN)
+        {
+            int fd = accept(exporter->listen_fd, NULL, NULL);
+            if (fd >= 0)
+                metrics_serve(exporter, fd);
+        }
+    }
+
+    return NULL;
+}
+
+static int metrics_listen(MetricsExporter* exporter, const char* address)
+{
+    const char* c = address;
+    int fd;
+
+    while (isdigit((unsigned char)*c))
+        c++;
+
+    if (*address != '\0' && *c == '\0')
+    {
+        struct sockaddr_in addr;
+        int reuse = 1;
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((unsigned short)atoi(address));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    else
+    {
+        struct sockaddr_un addr;
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", address);
+        unlink(addr.sun_path);
+        if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+        snprintf(exporter->socket_path, sizeof(exporter->socket_path), "%s", address);
+    }
+
+    if (listen(fd, 8) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int metrics_exporter_start(MetricsExporter* exporter, const char* address, MiniaudioPlayer* player)
+{
+    memset(exporter, 0, sizeof(*exporter));
+    exporter->player = player;
+
+    exporter->listen_fd = metrics_listen(exporter, address);
+    if (exporter->listen_fd < 0)
+        return -1;
+
+    if (pipe(exporter->wake_pipe) != 0)
+    {
+        close(exporter->listen_fd);
+        return -1;
+    }
+
+    if (pthread_create(&exporter->thread, NULL, metrics_thread, exporter) != 0)
+    {
+        close(exporter->wake_pipe[0]);
+        close(exporter->wake_pipe[1]);
+        close(exporter->listen_fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+void metrics_exporter_stop(MetricsExporter* exporter)
+{
+    char wake = 0;
+
+    if (write(exporter->wake_pipe[1], &wake, 1) == 1)
+        pthread_join(exporter->thread, NULL);
+
+    close(exporter->wake_pipe[0]);
+    close(exporter->wake_pipe[1]);
+    close(exporter->listen_fd);
+    if (exporter->socket_path[0] != '\0')
+        unlink(exporter->socket_path);
+}
@@ -0,0 +1,31 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "player.h"
+#include <pthread.h>
+
+// Serves player and library counters in the Prometheus text format over HTTP,
+// on a loopback port or a Unix socket. Scrapes only read atomics, so they never
+// contend with the audio thread or the player lock.
+
+typedef struct
+{
+    pthread_t thread;
+    int listen_fd;
+    int wake_pipe[2];
+    MiniaudioPlayer* player;    // may be NULL: library counters only
+    char socket_path[108];      // set when listening on a Unix socket
+    unsigned long long scrapes;
+} MetricsExporter;
+
+// address is a port number (bound to 127.0.0.1) or a socket path.
+int metrics_exporter_start(MetricsExporter* exporter, const char* address, MiniaudioPlayer* player);
+void metrics_exporter_stop(MetricsExporter* exporter);
+
+#define METRICS_BODY_SIZE 4096      // first guess; a scrape grows it as needed
+
+// Formats the current values. Returns the length they need, like snprintf: if
+// that is out_size or more, out holds only what fit.
+size_t metrics_format(MetricsExporter* exporter, char* out, size_t out_size);
+
+#endif
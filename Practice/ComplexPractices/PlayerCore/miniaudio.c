@@ -0,0 +1,4 @@
+// The one miniaudio implementation unit. Everything else includes miniaudio.h
+// for declarations only, so the 95k lines are compiled once per library build.
+#define MINIAUDIO_IMPLEMENTATION
+#include "miniaudio.h"
@@ -0,0 +1,2093 @@
+#include "player.h"
+#include "statuspage.h"
+#include "prefetch.h"
+#include "asyncvfs.h"
+#include "arena.h"
+#include "rtcheck.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/resource.h>
+#ifdef __APPLE__
+#include <dispatch/dispatch.h>
+#else
+#include <semaphore.h>
+#endif
+
+#define RENDER_BLOCK_FRAMES 4096
+#define RENDER_BLOCKS 8
+
+#define PLAYER_ADAPT_RAISE 1
+#define PLAYER_ADAPT_LOWER 2
+
+// How the audio thread wakes the service thread. Posting a semaphore takes no
+// lock, where ma_event_signal locks a mutex to set its flag. Extra posts only
+// mean an extra pass over the pending flags.
+#ifdef __APPLE__
+typedef dispatch_semaphore_t PlayerWake;
+
+static int player_wake_init(PlayerWake* wake)
+{
+    *wake = dispatch_semaphore_create(0);
+    return *wake != NULL ? 0 : -1;
+}
+
+static void player_wake_post(PlayerWake* wake) { dispatch_semaphore_signal(*wake); }
+static void player_wake_wait(PlayerWake* wake) { dispatch_semaphore_wait(*wake, DISPATCH_TIME_FOREVER); }
+static void player_wake_uninit(PlayerWake* wake) { dispatch_release(*wake); }
+#else
+typedef sem_t PlayerWake;
+
+static int player_wake_init(PlayerWake* wake)
+{
+    return sem_init(wake, 0, 0);
+}
+
+static void player_wake_post(PlayerWake* wake) { sem_post(wake); }
+
+static void player_wake_wait(PlayerWake* wake)
+{
+    while (sem_wait(wake) != 0)
+        ;
+}
+
+static void player_wake_uninit(PlayerWake* wake) { sem_destroy(wake); }
+#endif
+
+typedef struct
+{
+    const char* name;
+    ma_uint32 period_ms;
+    ma_uint32 periods;
+    ma_performance_profile performance;
+} LatencyProfileInfo;
+
+static const LatencyProfileInfo latency_profiles[PLAYER_LATENCY_COUNT] =
+{
+    { "low",       5,   2, ma_performance_profile_low_latency },
+    { "balanced",  25,  3, ma_performance_profile_low_latency },
+    { "powersave", 200, 2, ma_performance_profile_conservative }
+};
+
+typedef struct
+{
+    ma_decoder decoder;
+    ma_bool32 is_active;
+    ma_uint64 cursor;
+    ma_uint64 serial;
+    TrackFormat format;
+    char filepath[512];
+    DecoderArena arena;             // everything the decoder allocates
+} AudioTrack;
+
+// A play or completion seen by the audio thread, waiting for the service
+// thread to pass it on to the history.
+typedef struct
+{
+    HistoryEventType type;
+    unsigned position_ms;
+    char path[512];
+} HistoryNote;
+
+#define PLAYER_HISTORY_NOTES 8
+
+// Entries of the shuffle's virtual Fisher-Yates array that no longer hold
+// their own index. Open addressing; key -1 marks a free slot.
+typedef struct
+{
+    int key;
+    int value;
+} ShuffleSlot;
+
+typedef struct
+{
+    ShuffleSlot* slots;
+    int capacity;
+    int count;
+} ShuffleMap;
+
+struct MiniaudioPlayer
+{
+    // Two slots; current and next point into them and are swapped at track
+    // boundaries, so decoders are never copied by value.
+    AudioTrack tracks[2];
+    AudioTrack* current;
+    AudioTrack* next;
+    ma_device device;
+    ma_mutex lock;
+    PlayerWake service_event;
+    pthread_t service_thread;
+    ma_bool32 service_running;
+    ma_bool32 service_quit;
+    ma_bool32 offline;
+    ma_format format;
+    ma_uint32 channels;
+    ma_uint32 sample_rate;
+    PlayerFormatMode format_mode;
+    PlayerLatencyProfile latency_profile;
+    PlayerCounters counters;
+    ma_uint64 last_callback_ns;
+    char** playlist;
+    int playlist_count;
+    int playlist_capacity;
+    // Arrays outgrown by player_queue_file. The audio thread may still be
+    // indexing one, so they are only freed once the device is stopped.
+    char*** retired_playlists;
+    int retired_count;
+    int current_index;
+    // Play order. position counts through the queue as it plays; without
+    // shuffle it is current_index. With shuffle, order[] holds the entry of
+    // every position drawn so far: a Fisher-Yates permutation evaluated one
+    // step at a time, with the entries its swaps moved kept in shuffle_moved.
+    // It is drawn a few positions ahead under the lock, and the audio thread
+    // reads it like playlist[], so it grows the same way.
+    int position;
+    ma_bool32 shuffle;
+    PlayerRepeatMode repeat;
+    int* order;
+    int order_count;
+    int order_capacity;
+    int** retired_orders;
+    int retired_order_count;
+    int pass_start;             // position where this pass through the queue began
+    int previous_pass_start;    // and where the one before it began
+    ShuffleMap shuffle_moved;
+    ma_uint64 shuffle_random;
+    ma_bool32 auto_advance;
+    ma_bool32 is_paused;
+    // Pause and idle. gain fades towards 0 while paused and back to 1 after;
+    // only the audio thread touches it. After the grace period idle the audio
+    // thread sets suspend_pending and the service thread stops the device.
+    float gain;
+    ma_uint64 idle_since_ns;
+    ma_bool32 suspend_pending;
+    ma_bool32 suspended;
+    ma_uint64 suspended_at_ns;
+    ma_uint64 resume_at_ns;         // when a resume was asked for; the audio thread clears it
+    ma_bool32 reconfigure_pending;
+    // A reopen failed and so did the fallback: there is no device, nothing
+    // plays, and the ma_device calls are skipped from then on.
+    ma_bool32 device_lost;
+    // Set by the audio thread when it moves on to the preloaded track. next
+    // then still holds the finished one; the service thread closes it and
+    // opens the track after, so no decoder is set up or torn down on the
+    // audio thread. Cleared by whoever fills next.
+    ma_bool32 preload_pending;
+    ArenaCounters arena_counters;
+    ma_uint64 track_serial;
+    // Adaptive buffering. The audio thread counts underruns and asks for a
+    // level up or down through adapt_request; the service thread changes the
+    // levels and reports back through adapt_raised and adapt_at_ns. Lowering
+    // the period waits in lower_period until the device is stopped anyway.
+    ma_bool32 adaptive;
+    int adapt_request;
+    int period_level;
+    int readahead_level;
+    ma_bool32 lower_period;
+    ma_bool32 adapt_raised;
+    ma_uint64 adapt_at_ns;
+    ma_uint64 adapt_stalls;         // decoder reads that had waited, at the last change
+    ma_uint64 underrun_window_ns;   // audio thread only, like the two below
+    int underrun_window_count;
+    ma_uint64 last_underrun_ns;
+    PlayerAdaptation adapt_log[PLAYER_ADAPT_LOG];
+    ma_uint64 adapt_serial;
+    StatusPublisher status;
+    // Decoders read through this so disk latency stays off the decoding thread.
+    AsyncVfs vfs;
+    ma_bool32 vfs_ready;
+    // Wraps vfs to record every decoder's reads per track. With
+    // PSFSP_IO_FAULTS set, io_faults sits below vfs and plays a flaky disk.
+    FaultVfs io_stats;
+    FaultVfs io_faults;
+    ma_bool32 io_faults_active;
+    Prefetcher prefetch;
+    ma_bool32 prefetch_running;
+    ma_bool32 prefetch_pending;
+    int prefetch_depth;
+    size_t prefetch_budget;         // as set; adaptive buffering scales it
+    // The window last handed to the prefetcher, so unchanged ones are skipped.
+    ma_uint64 prefetch_serial;
+    char* prefetch_window[PREFETCH_MAX_DEPTH];
+    int prefetch_count;
+    // Single-producer ring from the audio thread; drained with the lock held.
+    History* history;
+    HistoryNote history_notes[PLAYER_HISTORY_NOTES];
+    unsigned history_head;
+    unsigned history_tail;
+};
+
+const char* player_format_name(ma_format format)
+{
+    switch (format)
+    {
+        case ma_format_u8:  return "u8";
+        case ma_format_s16: return "s16";
+        case ma_format_s24: return "s24";
+        case ma_format_s32: return "s32";
+        case ma_format_f32: return "f32";
+        default:            return "?";
+    }
+}
+
+const char* player_latency_name(PlayerLatencyProfile latency)
+{
+    return latency_profiles[latency].name;
+}
+
+static const char* const repeat_names[PLAYER_REPEAT_COUNT] = { "off", "one", "all" };
+
+const char* player_repeat_name(PlayerRepeatMode repeat)
+{
+    return repeat >= 0 && repeat < PLAYER_REPEAT_COUNT ? repeat_names[repeat] : "?";
+}
+
+int player_parse_repeat(const char* name, PlayerRepeatMode* repeat)
+{
+    for (int i = 0; i < PLAYER_REPEAT_COUNT; i++)
+    {
+        if (strcmp(name, repeat_names[i]) == 0)
+        {
+            *repeat = (PlayerRepeatMode)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int player_parse_latency(const char* name, PlayerLatencyProfile* latency)
+{
+    for (int i = 0; i < PLAYER_LATENCY_COUNT; i++)
+    {
+        if (strcmp(name, latency_profiles[i].name) == 0)
+        {
+            *latency = (PlayerLatencyProfile)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Counters have a single writer at a time, so a plain increment published with an
+// atomic store is enough for lock-free readers.
+static void player_count(ma_uint64* counter, ma_uint64 amount)
+{
+    __atomic_store_n(counter, *counter + amount, __ATOMIC_RELAXED);
+}
+
+static ma_bool32 track_matches_device(MiniaudioPlayer* player, AudioTrack* track)
+{
+    return track->decoder.outputFormat == player->format &&
+           track->decoder.outputChannels == player->channels &&
+           track->decoder.outputSampleRate == player->sample_rate;
+}
+
+// Opens a decoder that outputs the device's format, or the file's own format in
+// bit-perfect mode, and records which conversions the decoder has to do.
+static int track_open(MiniaudioPlayer* player, AudioTrack* track, const char* filepath)
+{
+    ma_decoder_config config;
+
+    if (player->format_mode == PLAYER_FORMAT_BITPERFECT)
+        config = ma_decoder_config_init(ma_format_unknown, 0, 0);
+    else
+        config = ma_decoder_config_init(player->format, player->channels, player->sample_rate);
+    config.allocationCallbacks = arena_callbacks(&track->arena);
+
+    snprintf(track->filepath, sizeof(track->filepath), "%s", filepath);
+    track->cursor = 0;
+    track->serial = ++player->track_serial;
+    if (ma_decoder_init_vfs((ma_vfs*)&player->io_stats, filepath, &config, &track->decoder) != MA_SUCCESS)
+    {
+        arena_reset(&track->arena);
+        track->is_active = MA_FALSE;
+        player_count(&player->counters.open_failures, 1);
+        return -1;
+    }
+
+    memset(&track->format, 0, sizeof(track->format));
+    ma_data_source_get_data_format(track->decoder.pBackend, &track->format.source_format,
+                                   &track->format.source_channels, &track->format.source_rate, NULL, 0);
+    track->format.converted = track->decoder.converter.formatIn != track->decoder.converter.formatOut ||
+                              track->decoder.converter.channelsIn != track->decoder.converter.channelsOut;
+    track->format.resampled = track->decoder.converter.sampleRateIn != track->decoder.converter.sampleRateOut;
+    track->is_active = MA_TRUE;
+
+    return 0;
+}
+
+static void track_close(AudioTrack* track)
+{
+    if (track->is_active)
+    {
+        ma_decoder_uninit(&track->decoder);
+        arena_reset(&track->arena);
+        track->is_active = MA_FALSE;
+    }
+}
+
+static int shuffle_get(ShuffleMap* map, int key)
+{
+    if (map->capacity > 0)
+    {
+        int mask = map->capacity - 1;
+        for (int i = (int)((unsigned)key * 2654435761u) & mask; map->slots[i].key != -1; i = (i + 1) & mask)
+        {
+            if (map->slots[i].key == key)
+                return map->slots[i].value;
+        }
+    }
+    return key;
+}
+
+static void shuffle_set(ShuffleMap* map, int key, int value)
+{
+    if ((map->count + 1) * 2 > map->capacity)
+    {
+        ShuffleMap grown = { NULL, map->capacity ? map->capacity * 2 : 64, 0 };
+
+        grown.slots = malloc(sizeof(ShuffleSlot) * grown.capacity);
+        if (grown.slots == NULL)
+            return;
+        memset(grown.slots, 0xff, sizeof(ShuffleSlot) * grown.capacity);
+        for (int i = 0; i < map->capacity; i++)
+        {
+            if (map->slots[i].key != -1)
+                shuffle_set(&grown, map->slots[i].key, map->slots[i].value);
+        }
+        free(map->slots);
+        *map = grown;
+    }
+
+    int mask = map->capacity - 1;
+    int i = (int)((unsigned)key * 2654435761u) & mask;
+    while (map->slots[i].key != -1 && map->slots[i].key != key)
+        i = (i + 1) & mask;
+    if (map->slots[i].key == -1)
+        map->count++;
+    map->slots[i].key = key;
+    map->slots[i].value = value;
+}
+
+static void shuffle_clear(ShuffleMap* map)
+{
+    free(map->slots);
+    map->slots = NULL;
+    map->capacity = 0;
+    map->count = 0;
+}
+
+static ma_uint64 player_random(MiniaudioPlayer* player)
+{
+    ma_uint64 x = player->shuffle_random;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    player->shuffle_random = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+// The queue entry a position plays; with shuffle it must have been drawn.
+static int player_order_index(MiniaudioPlayer* player, int position)
+{
+    if (!player->shuffle)
+        return position;
+    return __atomic_load_n(&player->order, __ATOMIC_ACQUIRE)[position];
+}
+
+// The position after this one, or -1 at the end of the queue (or of what has
+// been drawn of the shuffle).
+static int player_position_after(MiniaudioPlayer* player, int position)
+{
+    if (player->shuffle)
+        return position + 1 < __atomic_load_n(&player->order_count, __ATOMIC_ACQUIRE) ? position + 1 : -1;
+
+    int count = __atomic_load_n(&player->playlist_count, __ATOMIC_ACQUIRE);
+    if (position + 1 < count)
+        return position + 1;
+    return player->repeat == PLAYER_REPEAT_ALL && count > 0 ? 0 : -1;
+}
+
+// What plays once the current track ends.
+static int player_next_position(MiniaudioPlayer* player)
+{
+    if (player->repeat == PLAYER_REPEAT_ONE)
+        return player->position;
+    return player_position_after(player, player->position);
+}
+
+// Returns -1, with nothing changed, when the order can't grow.
+static int player_order_push(MiniaudioPlayer* player, int index)
+{
+    if (player->order_count == player->order_capacity)
+    {
+        int capacity = player->order_capacity ? player->order_capacity * 2 : 64;
+        int* grown = malloc(sizeof(int) * capacity);
+
+        if (grown == NULL)
+            return -1;
+        if (player->order != NULL)
+        {
+            int** retired = realloc(player->retired_orders, sizeof(int*) * (player->retired_order_count + 1));
+            if (retired == NULL)
+            {
+                free(grown);
+                return -1;
+            }
+            player->retired_orders = retired;
+            player->retired_orders[player->retired_order_count++] = player->order;
+            memcpy(grown, player->order, sizeof(int) * player->order_count);
+        }
+        __atomic_store_n(&player->order, grown, __ATOMIC_RELEASE);
+        player->order_capacity = capacity;
+    }
+
+    player->order[player->order_count] = index;
+    __atomic_store_n(&player->order_count, player->order_count + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Under repeat all every pass adds to the order. Drops the passes before the
+// previous one, which skipping back and the repeat rollback never reach, and
+// moves every position down to match, along with the arrays outgrown so far.
+// Only while the audio thread can't be reading the order, as in
+// player_preload_next.
+static void player_order_compact(MiniaudioPlayer* player)
+{
+    int drop = player->previous_pass_start;
+
+    if (drop <= 0)
+        return;
+
+    memmove(player->order, player->order + drop, sizeof(int) * (player->order_count - drop));
+    __atomic_store_n(&player->order_count, player->order_count - drop, __ATOMIC_RELEASE);
+    player->position -= drop;
+    player->pass_start -= drop;
+    player->previous_pass_start = 0;
+
+    for (int i = 0; i < player->retired_order_count; i++)
+    {
+        free(player->retired_orders[i]);
+    }
+    free(player->retired_orders);
+    player->retired_orders = NULL;
+    player->retired_order_count = 0;
+}
+
+// Draws the next position: a random pick among the entries this pass has not
+// played yet. Returns 0 when the pass is over and nothing repeats, or when the
+// order can't grow. Called with the lock held.
+static int player_shuffle_draw(MiniaudioPlayer* player)
+{
+    int count = player->playlist_count;
+    int i = player->order_count - player->pass_start;
+    int avoid = -1;
+
+    if (i >= count)
+    {
+        if (player->repeat != PLAYER_REPEAT_ALL || count == 0)
+            return 0;
+        player->previous_pass_start = player->pass_start;
+        player->pass_start = player->order_count;
+        shuffle_clear(&player->shuffle_moved);
+        i = 0;
+    }
+
+    // A new pass doesn't open with the track that closed the last one. The
+    // draw skips its slot by taking the last slot in its place, which keeps
+    // the other picks equally likely.
+    int span = count - i;
+    if (i == 0 && count > 1 && player->order_count > 0)
+    {
+        avoid = player->order[player->order_count - 1];
+        span--;
+    }
+
+    int j = i + (int)(player_random(player) % (ma_uint64)span);
+    if (avoid >= 0 && shuffle_get(&player->shuffle_moved, j) == avoid)
+        j = count - 1;
+    int picked = shuffle_get(&player->shuffle_moved, j);
+    if (player_order_push(player, picked) != 0)
+        return 0;
+    shuffle_set(&player->shuffle_moved, j, shuffle_get(&player->shuffle_moved, i));
+    return 1;
+}
+
+// Keeps the shuffle drawn past the next track and the prefetch window, so the
+// audio thread can preload without drawing. Called with the lock held.
+static void player_order_fill(MiniaudioPlayer* player)
+{
+    int ahead = (player->prefetch_depth > 1 ? player->prefetch_depth : 1) + 1;
+
+    while (player->shuffle && player->order_count <= player->position + ahead && player_shuffle_draw(player))
+        ;
+}
+
+// The device must be stopped.
+static void player_order_free(MiniaudioPlayer* player)
+{
+    free(player->order);
+    for (int i = 0; i < player->retired_order_count; i++)
+    {
+        free(player->retired_orders[i]);
+    }
+    free(player->retired_orders);
+    player->retired_orders = NULL;
+    player->retired_order_count = 0;
+    player->order = NULL;
+    player->order_count = 0;
+    player->order_capacity = 0;
+    player->pass_start = 0;
+    player->previous_pass_start = 0;
+    shuffle_clear(&player->shuffle_moved);
+}
+
+// Starts the play order over at queue entry index; a shuffle begins a new pass
+// with it. The device must be stopped.
+static void player_order_restart(MiniaudioPlayer* player, int index)
+{
+    player_order_free(player);
+    player->current_index = index;
+    if (!player->shuffle)
+    {
+        player->position = index;
+        return;
+    }
+
+    // Without room for even one position, play in queue order instead.
+    if (player_order_push(player, index) != 0)
+    {
+        player->shuffle = MA_FALSE;
+        player->position = index;
+        return;
+    }
+    player->position = 0;
+    if (index != 0)
+        shuffle_set(&player->shuffle_moved, index, 0);
+    player_order_fill(player);
+}
+
+// Promotes the preloaded track. The finished one stays open in next until
+// player_preload_next replaces it.
+static void player_advance(MiniaudioPlayer* player)
+{
+    AudioTrack* finished = player->current;
+    int position = player_next_position(player);
+
+    player->current = player->next;
+    player->next = finished;
+    player->position = position;
+    player->current_index = player_order_index(player, position);
+}
+
+// Called with the device stopped, or after the audio thread advanced and set
+// preload_pending; either way it leaves the play order alone until this is
+// done.
+static void player_preload_next(MiniaudioPlayer* player)
+{
+    if (player->shuffle)
+        player_order_compact(player);
+
+    int position = player_next_position(player);
+
+    track_close(player->next);
+    if (position >= 0)
+    {
+        track_open(player, player->next, player->playlist[player_order_index(player, position)]);
+    }
+    __atomic_store_n(&player->preload_pending, MA_FALSE, __ATOMIC_RELEASE);
+}
+
+static unsigned track_position_ms(AudioTrack* track)
+{
+    ma_uint32 rate = track->decoder.outputSampleRate;
+    return rate > 0 ? (unsigned)(track->cursor * 1000 / rate) : 0;
+}
+
+// Audio thread: queues the event for the service thread, or drops it if the
+// ring is full. Only copies memory.
+static void player_history_push(MiniaudioPlayer* player, HistoryEventType type, AudioTrack* track)
+{
+    unsigned head = player->history_head;
+
+    if (__atomic_load_n(&player->history, __ATOMIC_RELAXED) == NULL ||
+        head - __atomic_load_n(&player->history_tail, __ATOMIC_ACQUIRE) == PLAYER_HISTORY_NOTES)
+        return;
+
+    HistoryNote* note = &player->history_notes[head % PLAYER_HISTORY_NOTES];
+    note->type = type;
+    note->position_ms = track_position_ms(track);
+    memcpy(note->path, track->filepath, sizeof(note->path));
+    __atomic_store_n(&player->history_head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Passes on what the audio thread noted, oldest first. Called with the lock held.
+static void player_history_drain(MiniaudioPlayer* player)
+{
+    unsigned head = __atomic_load_n(&player->history_head, __ATOMIC_ACQUIRE);
+    unsigned tail = player->history_tail;
+
+    for (; tail != head; tail++)
+    {
+        HistoryNote* note = &player->history_notes[tail % PLAYER_HISTORY_NOTES];
+        if (player->history != NULL)
+            history_record(player->history, note->type, note->path, note->position_ms);
+    }
+    __atomic_store_n(&player->history_tail, tail, __ATOMIC_RELEASE);
+}
+
+// Records an event from a control path, after whatever the audio thread noted
+// first. Called with the lock held.
+static void player_history_note(MiniaudioPlayer* player, HistoryEventType type, AudioTrack* track)
+{
+    if (player->history == NULL || !track->is_active)
+        return;
+
+    player_history_drain(player);
+    history_record(player->history, type, track->filepath, track_position_ms(track));
+}
+
+// Scales frames by gain, moving it step per frame until it reaches target.
+// Returns the gain reached.
+static float player_ramp(void* frames, ma_format format, ma_uint32 channels, ma_uint64 count,
+                         float gain, float step, float target)
+{
+    for (ma_uint64 i = 0; i < count; i++)
+    {
+        gain += step;
+        if ((step > 0 && gain > target) || (step < 0 && gain < target))
+            gain = target;
+
+        for (ma_uint32 c = 0; c < channels; c++)
+        {
+            ma_uint64 at = i * channels + c;
+            switch (format)
+            {
+            case ma_format_f32:
+                ((float*)frames)[at] *= gain;
+                break;
+            case ma_format_s16:
+                ((ma_int16*)frames)[at] = (ma_int16)(((ma_int16*)frames)[at] * gain);
+                break;
+            case ma_format_s32:
+                ((ma_int32*)frames)[at] = (ma_int32)(((ma_int32*)frames)[at] * (double)gain);
+                break;
+            case ma_format_s24:
+            {
+                ma_uint8* p = (ma_uint8*)frames + at * 3;
+                ma_int32 sample = (ma_int32)((ma_uint32)p[0] << 8 | (ma_uint32)p[1] << 16 | (ma_uint32)p[2] << 24) >> 8;
+                sample = (ma_int32)(sample * gain);
+                p[0] = (ma_uint8)sample;
+                p[1] = (ma_uint8)(sample >> 8);
+                p[2] = (ma_uint8)(sample >> 16);
+                break;
+            }
+            case ma_format_u8:
+                ((ma_uint8*)frames)[at] = (ma_uint8)(128 + (((ma_uint8*)frames)[at] - 128) * gain);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    return gain;
+}
+
+static ma_uint64 player_decode(MiniaudioPlayer* player, void* pOutput, ma_uint32 frameCount)
+{
+    ma_uint64 framesRead = 0;
+    ma_uint64 decodeStart = status_page_now();
+
+    ma_decoder_read_pcm_frames(&player->current->decoder, pOutput, frameCount, &framesRead);
+    player_count(&player->counters.decode_ns, status_page_now() - decodeStart);
+    player_count(&player->counters.frames_decoded, framesRead);
+    player->current->cursor += framesRead;
+    return framesRead;
+}
+
+// The whole playback path: decoding, playlist advance and preloading. Called by
+// the device, or directly by player_render when there is no device. Returns
+// MA_TRUE when there was nothing to play.
+static ma_bool32 player_process(MiniaudioPlayer* player, void* pOutput, ma_uint32 frameCount)
+{
+    size_t bytesPerFrame = ma_get_bytes_per_frame(player->format, player->channels);
+    float step = 1000.0f / ((float)PLAYER_FADE_MS * player->sample_rate);
+
+    player_count(&player->counters.callbacks, 1);
+
+    if (!player->current->is_active || player->is_paused || player->reconfigure_pending)
+    {
+        // Just paused: play on to silence instead of cutting the wave off,
+        // decoding no more than the fade needs so resume picks up right after.
+        if (player->gain > 0 && player->is_paused && player->current->is_active && !player->reconfigure_pending)
+        {
+            ma_uint32 fadeFrames = (ma_uint32)(player->gain / step) + 1;
+            ma_uint64 framesRead = player_decode(player, pOutput, fadeFrames < frameCount ? fadeFrames : frameCount);
+
+            memset((unsigned char*)pOutput + framesRead * bytesPerFrame, 0, (frameCount - framesRead) * bytesPerFrame);
+            player->gain = player_ramp(pOutput, player->format, player->channels, framesRead, player->gain, -step, 0.0f);
+            if (framesRead < fadeFrames && framesRead < frameCount)
+                player->gain = 0.0f;
+            return MA_FALSE;
+        }
+        memset(pOutput, 0, frameCount * bytesPerFrame);
+        // Whatever plays next fades in.
+        if (player->is_paused)
+            player->gain = 0.0f;
+        return MA_TRUE;
+    }
+
+    ma_uint64 framesRead = player_decode(player, pOutput, frameCount);
+    if (player->gain < 1.0f)
+        player->gain = player_ramp(pOutput, player->format, player->channels, framesRead, player->gain, step, 1.0f);
+
+    if (framesRead < frameCount)
+    {
+        player_count(&player->counters.tracks_played, 1);
+        player_history_push(player, HISTORY_COMPLETE, player->current);
+
+        memset((unsigned char*)pOutput + (framesRead * bytesPerFrame), 0,
+               (frameCount - framesRead) * bytesPerFrame);
+
+        // A track at another rate needs the device reopened, and one that
+        // hasn't been opened yet can't be started; neither can happen on this
+        // thread. The service thread picks both up.
+        if (player->auto_advance &&
+            (__atomic_load_n(&player->preload_pending, __ATOMIC_ACQUIRE) ||
+             (player->next->is_active && !track_matches_device(player, player->next))))
+        {
+            player->reconfigure_pending = MA_TRUE;
+            player_wake_post(&player->service_event);
+            return MA_FALSE;
+        }
+
+        if (player->auto_advance && player->next->is_active)
+        {
+            player_advance(player);
+            player_history_push(player, HISTORY_PLAY, player->current);
+            // Rendering has no service thread and no deadline: preload here.
+            if (player->offline)
+                player_preload_next(player);
+            else
+                __atomic_store_n(&player->preload_pending, MA_TRUE, __ATOMIC_RELEASE);
+            if (player->prefetch_running)
+                __atomic_store_n(&player->prefetch_pending, MA_TRUE, __ATOMIC_RELEASE);
+        } else {
+            player->current->is_active = MA_FALSE;
+        }
+
+        // The service thread closes the finished track, opens the next one,
+        // and draws the shuffle further ahead.
+        if (!player->offline)
+            player_wake_post(&player->service_event);
+    }
+    return MA_FALSE;
+}
+
+// Runs on the audio thread after every callback: no locks, and no syscalls
+// beyond posting the service wake.
+static void player_publish(MiniaudioPlayer* player, ma_uint64 start, ma_uint32 frameCount)
+{
+    StatusPublisher* publisher = &player->status;
+    PlayerStatusPage* page = publisher->page;
+    AudioTrack* track = player->current;
+
+    status_page_write_begin(publisher);
+    status_page_record_callback(publisher, start, status_page_now());
+    page->underruns = player->counters.underruns;
+    if (track->serial != publisher->last_track_id)
+    {
+        memcpy(page->filepath, track->filepath, sizeof(page->filepath));
+        page->track_id = track->serial;
+        publisher->last_track_id = track->serial;
+    }
+    page->playlist_index = player->auto_advance ? player->current_index : -1;
+    page->sample_rate = player->sample_rate;
+    page->period_frames = frameCount;
+    page->position_frames = track->cursor;
+    page->active = track->is_active;
+    page->paused = player->is_paused;
+    status_page_write_end(publisher);
+}
+
+// Runs on the audio thread: asks for more buffering after repeated underruns
+// and for less after a quiet spell. The service thread does the work.
+static void player_adapt_watch(MiniaudioPlayer* player, ma_uint64 now, ma_bool32 late)
+{
+    const ma_uint64 ms = 1000000;
+    int request = 0;
+
+    if (!__atomic_load_n(&player->adaptive, __ATOMIC_RELAXED) ||
+        __atomic_load_n(&player->adapt_request, __ATOMIC_ACQUIRE) != 0)
+        return;
+
+    if (late)
+    {
+        player->last_underrun_ns = now;
+        if (now - player->underrun_window_ns > PLAYER_ADAPT_WINDOW_MS * ms)
+        {
+            player->underrun_window_ns = now;
+            player->underrun_window_count = 0;
+        }
+        if (++player->underrun_window_count >= PLAYER_ADAPT_UNDERRUNS)
+        {
+            player->underrun_window_count = 0;
+            request = PLAYER_ADAPT_RAISE;
+        }
+    }
+    else if (__atomic_load_n(&player->adapt_raised, __ATOMIC_RELAXED))
+    {
+        ma_uint64 since = __atomic_load_n(&player->adapt_at_ns, __ATOMIC_RELAXED);
+
+        if (player->last_underrun_ns > since)
+            since = player->last_underrun_ns;
+        if (now - since > PLAYER_ADAPT_QUIET_MS * ms)
+            request = PLAYER_ADAPT_LOWER;
+    }
+
+    if (request != 0)
+    {
+        __atomic_store_n(&player->adapt_request, request, __ATOMIC_RELEASE);
+        player_wake_post(&player->service_event);
+    }
+}
+
+static void data_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount)
+{
+    MiniaudioPlayer* player = (MiniaudioPlayer*)pDevice->pUserData;
+    ma_uint64 start = status_page_now();
+
+    arena_enter_audio_thread();
+    rt_check_enter();
+    ma_uint64 period = (ma_uint64)frameCount * 1000000000ull / player->sample_rate;
+
+    ma_bool32 late = player->last_callback_ns != 0 && start - player->last_callback_ns > period + period / 2;
+    if (late)
+        player_count(&player->counters.underruns, 1);
+    player->last_callback_ns = start;
+    player_adapt_watch(player, start, late);
+
+    if (player_process(player, pOutput, frameCount))
+    {
+        player_count(&player->counters.idle_callbacks, 1);
+        if (player->idle_since_ns == 0)
+        {
+            player->idle_since_ns = start;
+        }
+        else if (start - player->idle_since_ns > PLAYER_IDLE_GRACE_MS * 1000000ull &&
+                 !__atomic_load_n(&player->suspend_pending, __ATOMIC_RELAXED))
+        {
+            __atomic_store_n(&player->suspend_pending, MA_TRUE, __ATOMIC_RELEASE);
+            player_wake_post(&player->service_event);
+        }
+    }
+    else
+    {
+        player->idle_since_ns = 0;
+        ma_uint64 resumed = __atomic_load_n(&player->resume_at_ns, __ATOMIC_ACQUIRE);
+        if (resumed != 0)
+        {
+            player_count(&player->counters.resumes, 1);
+            player_count(&player->counters.resume_ns, start > resumed ? start - resumed : 0);
+            __atomic_store_n(&player->resume_at_ns, 0, __ATOMIC_RELAXED);
+        }
+    }
+    if (__atomic_load_n(&player->status.page, __ATOMIC_ACQUIRE) != NULL)
+        player_publish(player, start, frameCount);
+    rt_check_leave();
+    (void)pInput;
+}
+
+static ma_bool32 player_has_device(MiniaudioPlayer* player)
+{
+    return !player->offline && !player->device_lost;
+}
+
+static void player_device_stop(MiniaudioPlayer* player)
+{
+    if (player_has_device(player))
+        ma_device_stop(&player->device);
+}
+
+static ma_bool32 player_is_idle(MiniaudioPlayer* player)
+{
+    return !player->current->is_active || player->is_paused;
+}
+
+static void player_device_start(MiniaudioPlayer* player)
+{
+    if (player_has_device(player))
+    {
+        // A suspended device stays stopped until there is something to play.
+        if (player->suspended)
+        {
+            if (player_is_idle(player))
+                return;
+            __atomic_store_n(&player->suspended, MA_FALSE, __ATOMIC_RELAXED);
+            player_count(&player->counters.suspended_ns, status_page_now() - player->suspended_at_ns);
+            __atomic_store_n(&player->resume_at_ns, status_page_now(), __ATOMIC_RELEASE);
+        }
+        // The gap while stopped is not an underrun.
+        player->last_callback_ns = 0;
+        player->idle_since_ns = 0;
+        ma_device_start(&player->device);
+    }
+}
+
+static void player_lower_period(MiniaudioPlayer* player);
+
+// Stops the device once it has been idle for the grace period, so nothing
+// wakes the CPU until player_device_start. Called with the lock held.
+static void player_suspend(MiniaudioPlayer* player)
+{
+    if (!player_has_device(player) || player->suspended || !player_is_idle(player))
+        return;
+    ma_device_stop(&player->device);
+    __atomic_store_n(&player->suspended_at_ns, status_page_now(), __ATOMIC_RELAXED);
+    __atomic_store_n(&player->suspended, MA_TRUE, __ATOMIC_RELAXED);
+    player_count(&player->counters.suspends, 1);
+    player_lower_period(player);
+}
+
+static int player_open_device(MiniaudioPlayer* player, ma_format format, ma_uint32 channels, ma_uint32 sampleRate)
+{
+    ma_device_config config = ma_device_config_init(ma_device_type_playback);
+    config.playback.format = format;
+    config.playback.channels = channels;
+    config.sampleRate = sampleRate;
+    config.dataCallback = data_callback;
+    config.pUserData = player;
+    config.noClip = player->format_mode == PLAYER_FORMAT_BITPERFECT;
+    config.periodSizeInMilliseconds = latency_profiles[player->latency_profile].period_ms << player->period_level;
+    config.periods = latency_profiles[player->latency_profile].periods;
+    config.performanceProfile = latency_profiles[player->latency_profile].performance;
+
+    if (ma_device_init(NULL, &config, &player->device) != MA_SUCCESS)
+    {
+        return -1;
+    }
+
+    player->format = player->device.playback.format;
+    player->channels = player->device.playback.channels;
+    player->sample_rate = player->device.sampleRate;
+
+    return 0;
+}
+
+// Called when the device was uninitialised and could not be opened again.
+// Adapting would only try to reopen it, so that stops too.
+static void player_lose_device(MiniaudioPlayer* player)
+{
+    player->device_lost = MA_TRUE;
+    player->lower_period = MA_FALSE;
+    __atomic_store_n(&player->adaptive, MA_FALSE, __ATOMIC_RELAXED);
+}
+
+// In bit-perfect mode, reopens the (stopped) device at the track's format.
+static int player_match_device(MiniaudioPlayer* player, AudioTrack* track)
+{
+    if (!player_has_device(player) || player->format_mode != PLAYER_FORMAT_BITPERFECT || track_matches_device(player, track))
+        return 0;
+
+    ma_device_uninit(&player->device);
+    if (player_open_device(player, track->decoder.outputFormat, track->decoder.outputChannels, track->decoder.outputSampleRate) != 0)
+    {
+        // Fall back to letting miniaudio convert rather than going silent.
+        if (player_open_device(player, ma_format_unknown, 0, 0) != 0)
+        {
+            player_lose_device(player);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Reopens the stopped device at the format it has, with the current period,
+// or failing that with previousLevel's. Returns -1 unless the current period
+// took; if neither opens the player is left without a device.
+static int player_open_period(MiniaudioPlayer* player, int previousLevel)
+{
+    ma_format format = player->device.playback.format;
+    ma_uint32 channels = player->device.playback.channels;
+    ma_uint32 sampleRate = player->device.sampleRate;
+
+    ma_device_uninit(&player->device);
+    if (player_open_device(player, format, channels, sampleRate) == 0)
+        return 0;
+    if (previousLevel != player->period_level)
+    {
+        player->period_level = previousLevel;
+        if (player_open_device(player, format, channels, sampleRate) == 0)
+            return -1;
+    }
+    player_lose_device(player);
+    return -1;
+}
+
+// Stops, reopens and restarts the device: a short gap in the sound. Decoders
+// stay open, so playback resumes where it was. Called with the lock held.
+static int player_reopen_device(MiniaudioPlayer* player, int previousLevel)
+{
+    int result;
+
+    if (!player_has_device(player))
+        return -1;
+    player_device_stop(player);
+    result = player_open_period(player, previousLevel);
+    player_device_start(player);
+    return result;
+}
+
+static size_t player_prefetch_budget(MiniaudioPlayer* player)
+{
+    return player->prefetch_budget << player->readahead_level;
+}
+
+// Read-ahead happens in two places: the prefetcher warms the page cache for
+// whole tracks, and each decoder's file keeps blocks in flight ahead of it.
+// Each level doubles both. Called with the lock held.
+static void player_apply_readahead(MiniaudioPlayer* player)
+{
+    if (player->prefetch_running)
+        prefetch_set_budget(&player->prefetch, player_prefetch_budget(player));
+    if (player->vfs_ready)
+        async_vfs_set_depth(&player->vfs, ASYNC_VFS_DEPTH << player->readahead_level);
+}
+
+static void player_adapt_publish(MiniaudioPlayer* player)
+{
+    __atomic_store_n(&player->adapt_raised, player->period_level > 0 || player->readahead_level > 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&player->adapt_at_ns, status_page_now(), __ATOMIC_RELAXED);
+}
+
+// Logs the levels after a change. Called with the lock held.
+static void player_adapt_note(MiniaudioPlayer* player, ma_bool32 raised)
+{
+    PlayerAdaptation* entry = &player->adapt_log[player->adapt_serial % PLAYER_ADAPT_LOG];
+    entry->serial = ++player->adapt_serial;
+    entry->time_ns = status_page_now();
+    entry->raised = raised;
+    entry->underruns = __atomic_load_n(&player->counters.underruns, __ATOMIC_RELAXED);
+    entry->period_level = player->period_level;
+    entry->readahead_level = player->readahead_level;
+    entry->period_ms = player_has_device(player) && player->device.playback.internalSampleRate > 0 ?
+        1000.0 * player->device.playback.internalPeriodSizeInFrames / player->device.playback.internalSampleRate : 0.0;
+    entry->prefetch_budget = player->prefetch_running ? player_prefetch_budget(player) : 0;
+    entry->decoder_ahead = player->vfs_ready ? (size_t)async_vfs_get_depth(&player->vfs) * ASYNC_VFS_BLOCK : 0;
+    if (entry->raised)
+        player_count(&player->counters.adaptations_raised, 1);
+    else
+        player_count(&player->counters.adaptations_lowered, 1);
+}
+
+// Moves one level up or down, as the audio thread asked. Called with the lock
+// held, from the service thread.
+static void player_adapt(MiniaudioPlayer* player, int request)
+{
+    int period = player->period_level;
+    int readahead = player->readahead_level;
+    ma_bool32 waited = MA_FALSE;
+
+    if (player->vfs_ready)
+    {
+        AsyncVfsCounters io;
+
+        async_vfs_get_counters(&player->vfs, &io);
+        waited = io.stalls > player->adapt_stalls;
+        player->adapt_stalls = io.stalls;
+    }
+
+    if (request == PLAYER_ADAPT_RAISE)
+    {
+        player->lower_period = MA_FALSE;
+        // Late because decoders waited on the disk: read further ahead.
+        // Otherwise the callback itself ran late: give it longer periods.
+        if (waited && readahead < PLAYER_ADAPT_MAX_LEVEL)
+            readahead++;
+        else if (period < PLAYER_ADAPT_MAX_LEVEL)
+            period++;
+        else if ((player->prefetch_running || player->vfs_ready) && readahead < PLAYER_ADAPT_MAX_LEVEL)
+            readahead++;
+    }
+    else
+    {
+        // The read-ahead first: it changes without a sound. The period needs
+        // the device reopened, so it waits until the device is stopped anyway.
+        if (readahead > 0)
+            readahead--;
+        else if (period > 0)
+            player->lower_period = MA_TRUE;
+    }
+    if (period == player->period_level && readahead == player->readahead_level)
+    {
+        player_adapt_publish(player);
+        return;
+    }
+
+    if (period != player->period_level)
+    {
+        int was = player->period_level;
+
+        // Already underrunning, so the gap of a reopen now beats waiting.
+        player->period_level = period;
+        player_reopen_device(player, was);
+    }
+    if (readahead != player->readahead_level)
+    {
+        player->readahead_level = readahead;
+        player_apply_readahead(player);
+    }
+    player_adapt_publish(player);
+    player_adapt_note(player, request == PLAYER_ADAPT_RAISE);
+}
+
+// Takes the period down the level player_adapt left pending. Called with the
+// device stopped, while idle or between tracks, so nothing is cut off.
+static void player_lower_period(MiniaudioPlayer* player)
+{
+    int was = player->period_level;
+
+    if (!player->lower_period)
+        return;
+    player->lower_period = MA_FALSE;
+    if (!player_has_device(player) || was == 0)
+        return;
+
+    player->period_level--;
+    player_open_period(player, was);
+    player_adapt_publish(player);
+    player_adapt_note(player, MA_FALSE);
+}
+
+// Hands the prefetcher the track now playing and the ones queued after it.
+// Called with the lock held.
+static void player_prefetch_update(MiniaudioPlayer* player)
+{
+    char* upcoming[PREFETCH_MAX_DEPTH];
+    ma_uint64 serial = player->current->is_active ? player->current->serial : 0;
+    int count = 0;
+
+    if (!player->prefetch_running)
+        return;
+
+    if (player->auto_advance && player->current->is_active)
+    {
+        player_order_fill(player);
+        for (int position = player->position; count < player->prefetch_depth; )
+        {
+            position = player_position_after(player, position);
+            if (position < 0 || position == player->position)
+                break;
+            upcoming[count++] = player->playlist[player_order_index(player, position)];
+        }
+    }
+
+    // Queueing a long playlist lands here once per entry, and nearly all of
+    // them leave the window as it was.
+    if (serial == player->prefetch_serial && count == player->prefetch_count &&
+        memcmp(upcoming, player->prefetch_window, sizeof(char*) * count) == 0)
+        return;
+    player->prefetch_serial = serial;
+    player->prefetch_count = count;
+    memcpy(player->prefetch_window, upcoming, sizeof(char*) * count);
+
+    prefetch_update(&player->prefetch, serial != 0 ? player->current->filepath : NULL, upcoming, count);
+}
+
+// Picks up work the audio thread had to hand off.
+static void* player_service_thread(void* arg)
+{
+    MiniaudioPlayer* player = (MiniaudioPlayer*)arg;
+
+    for (;;)
+    {
+        player_wake_wait(&player->service_event);
+        ma_mutex_lock(&player->lock);
+        if (player->service_quit)
+        {
+            ma_mutex_unlock(&player->lock);
+            break;
+        }
+
+        if (player->shuffle)
+            player_order_fill(player);
+        if (__atomic_load_n(&player->preload_pending, __ATOMIC_ACQUIRE))
+            player_preload_next(player);
+        if (player->reconfigure_pending)
+        {
+            player_device_stop(player);
+            player_lower_period(player);
+            if (player->next->is_active)
+            {
+                player_advance(player);
+                player_history_note(player, HISTORY_PLAY, player->current);
+                player_match_device(player, player->current);
+                player_preload_next(player);
+            }
+            else
+            {
+                player->current->is_active = MA_FALSE;
+            }
+            player->reconfigure_pending = MA_FALSE;
+            player_device_start(player);
+            player_prefetch_update(player);
+        }
+        if (__atomic_exchange_n(&player->prefetch_pending, MA_FALSE, __ATOMIC_ACQUIRE))
+            player_prefetch_update(player);
+        if (__atomic_exchange_n(&player->suspend_pending, MA_FALSE, __ATOMIC_ACQUIRE))
+            player_suspend(player);
+        int request = __atomic_load_n(&player->adapt_request, __ATOMIC_ACQUIRE);
+        if (request != 0)
+        {
+            player_adapt(player, request);
+            __atomic_store_n(&player->adapt_request, 0, __ATOMIC_RELEASE);
+        }
+        if (player->shuffle)
+        {
+            // The audio thread found nothing drawn to preload; it is there now.
+            if (player->auto_advance && player->current->is_active && !player->next->is_active &&
+                !player->reconfigure_pending && player_next_position(player) >= 0)
+            {
+                player_device_stop(player);
+                player_preload_next(player);
+                player_device_start(player);
+            }
+        }
+        player_history_drain(player);
+        ma_mutex_unlock(&player->lock);
+    }
+
+    return NULL;
+}
+
+static MiniaudioPlayer* player_alloc(void)
+{
+    MiniaudioPlayer* player = calloc(1, sizeof(MiniaudioPlayer));
+    if (player == NULL)
+        return NULL;
+
+    player->current = &player->tracks[0];
+    player->next = &player->tracks[1];
+    player->shuffle_random = (status_page_now() ^ (ma_uint64)(size_t)player) | 1;
+    player->gain = 1.0f;
+    if (arena_init(&player->tracks[0].arena, ARENA_SIZE, &player->arena_counters) != 0 ||
+        arena_init(&player->tracks[1].arena, ARENA_SIZE, &player->arena_counters) != 0)
+    {
+        arena_uninit(&player->tracks[0].arena);
+        free(player);
+        return NULL;
+    }
+    ma_mutex_init(&player->lock);
+    player_wake_init(&player->service_event);
+    player->vfs_ready = async_vfs_init(&player->vfs, ASYNC_VFS_AUTO) == 0;
+    fault_vfs_init(&player->io_stats, player->vfs_ready ? (ma_vfs*)&player->vfs : NULL, NULL);
+
+    const char* faults = getenv("PSFSP_IO_FAULTS");
+    if (faults != NULL && player->vfs_ready)
+    {
+        FaultConfig config;
+        int line = fault_config_load(&config, faults);
+
+        if (line == 0)
+        {
+            fault_vfs_init(&player->io_faults, NULL, &config);
+            async_vfs_set_source(&player->vfs, (ma_vfs*)&player->io_faults);
+            player->io_faults_active = MA_TRUE;
+        }
+        else
+        {
+            fprintf(stderr, line < 0 ? "Cannot read %s\n" : "%s:%d: bad fault rule\n", faults, line);
+        }
+    }
+    return player;
+}
+
+static void player_free(MiniaudioPlayer* player)
+{
+    fault_vfs_uninit(&player->io_stats);
+    if (player->vfs_ready)
+        async_vfs_uninit(&player->vfs);
+    if (player->io_faults_active)
+        fault_vfs_uninit(&player->io_faults);
+    player_wake_uninit(&player->service_event);
+    ma_mutex_uninit(&player->lock);
+    arena_uninit(&player->tracks[0].arena);
+    arena_uninit(&player->tracks[1].arena);
+    free(player);
+}
+
+MiniaudioPlayer* player_create(PlayerFormatMode mode, PlayerLatencyProfile latency)
+{
+    MiniaudioPlayer* player = player_alloc();
+    int result;
+
+    if (player == NULL)
+        return NULL;
+
+    player->format_mode = mode;
+    player->latency_profile = latency;
+    player->adaptive = MA_TRUE;
+
+    if (mode == PLAYER_FORMAT_FIXED)
+        result = player_open_device(player, ma_format_f32, 2, 48000);
+    else
+        result = player_open_device(player, ma_format_unknown, 0, 0);
+
+    if (result != 0)
+    {
+        player_free(player);
+        return NULL;
+    }
+
+    if (ma_device_start(&player->device) != MA_SUCCESS)
+    {
+        ma_device_uninit(&player->device);
+        player_free(player);
+        return NULL;
+    }
+
+    if (pthread_create(&player->service_thread, NULL, player_service_thread, player) == 0)
+        player->service_running = MA_TRUE;
+    player_set_prefetch(player, PLAYER_PREFETCH_DEPTH, PLAYER_PREFETCH_BUDGET);
+
+    return player;
+}
+
+MiniaudioPlayer* player_create_offline(ma_format format, ma_uint32 channels, ma_uint32 sampleRate)
+{
+    MiniaudioPlayer* player = player_alloc();
+    if (player == NULL)
+        return NULL;
+
+    player->offline = MA_TRUE;
+    player->format_mode = PLAYER_FORMAT_FIXED;
+    player->format = format;
+    player->channels = channels;
+    player->sample_rate = sampleRate;
+    return player;
+}
+
+// Reopens the device with another period size. Decoders stay open and the
+// device keeps its current format, so playback resumes where it was.
+int player_set_latency(MiniaudioPlayer* player, PlayerLatencyProfile latency)
+{
+    int result = 0;
+
+    ma_mutex_lock(&player->lock);
+    if (!player_has_device(player))
+    {
+        result = -1;
+    }
+    else if (latency != player->latency_profile || player->period_level > 0)
+    {
+        player->latency_profile = latency;
+        player->period_level = 0;
+        player->lower_period = MA_FALSE;
+        result = player_reopen_device(player, 0);
+        player_adapt_publish(player);
+    }
+    ma_mutex_unlock(&player->lock);
+
+    return result;
+}
+
+void player_set_adaptive(MiniaudioPlayer* player, ma_bool32 adaptive)
+{
+    ma_mutex_lock(&player->lock);
+    __atomic_store_n(&player->adaptive, adaptive && !player->device_lost ? MA_TRUE : MA_FALSE, __ATOMIC_RELAXED);
+    if (!adaptive && player_has_device(player))
+    {
+        player->lower_period = MA_FALSE;
+        if (player->readahead_level > 0)
+        {
+            player->readahead_level = 0;
+            player_apply_readahead(player);
+        }
+        if (player->period_level > 0)
+        {
+            player->period_level = 0;
+            player_reopen_device(player, 0);
+        }
+        player_adapt_publish(player);
+    }
+    ma_mutex_unlock(&player->lock);
+}
+
+void player_describe_adaptation(const PlayerAdaptation* adaptation, char* out, size_t size)
+{
+    snprintf(out, size, "buffering %s: period %.1f ms (level %d), read-ahead %.0f MB + %.0f KB per decoder (level %d), %llu underruns so far",
+             adaptation->raised ? "raised after underruns" : "lowered after a quiet spell",
+             adaptation->period_ms, adaptation->period_level,
+             adaptation->prefetch_budget / 1048576.0, adaptation->decoder_ahead / 1024.0, adaptation->readahead_level,
+             (unsigned long long)adaptation->underruns);
+}
+
+int player_get_adaptations(MiniaudioPlayer* player, ma_uint64 after, PlayerAdaptation* out, int max)
+{
+    int count = 0;
+
+    ma_mutex_lock(&player->lock);
+    ma_uint64 serial = player->adapt_serial > PLAYER_ADAPT_LOG ? player->adapt_serial - PLAYER_ADAPT_LOG : 0;
+    if (serial < after)
+        serial = after;
+    for (serial++; serial <= player->adapt_serial && count < max; serial++)
+        out[count++] = player->adapt_log[(serial - 1) % PLAYER_ADAPT_LOG];
+    ma_mutex_unlock(&player->lock);
+
+    return count;
+}
+
+void player_toggle_pause(MiniaudioPlayer* player)
+{
+    ma_mutex_lock(&player->lock);
+    player->is_paused = !player->is_paused;
+    if (!player->is_paused)
+    {
+        if (player->suspended)
+            player_device_start(player);
+        else if (player->current->is_active)
+            __atomic_store_n(&player->resume_at_ns, status_page_now(), __ATOMIC_RELEASE);
+    }
+    ma_mutex_unlock(&player->lock);
+}
+
+static void player_close_tracks(MiniaudioPlayer* player)
+{
+    player->reconfigure_pending = MA_FALSE;
+    track_close(player->current);
+    track_close(player->next);
+    __atomic_store_n(&player->preload_pending, MA_FALSE, __ATOMIC_RELEASE);
+}
+
+static int player_skip_next_locked(MiniaudioPlayer* player)
+{
+    if (!player->auto_advance)
+        return -1;
+    player_order_fill(player);
+    int position = player_position_after(player, player->position);
+    if (position < 0)
+        return -1;
+
+    player_device_stop(player);
+    player->reconfigure_pending = MA_FALSE;
+    player_history_note(player, HISTORY_SKIP, player->current);
+
+    // Under repeat one the preloaded track is this one again. A pending
+    // preload means next is the track that just finished.
+    if (player->next->is_active && !player->preload_pending && player->repeat != PLAYER_REPEAT_ONE)
+    {
+        player_advance(player);
+    }
+    else
+    {
+        track_close(player->current);
+        player->position = position;
+        player->current_index = player_order_index(player, position);
+        if (track_open(player, player->current, player->playlist[player->current_index]) != 0)
+        {
+            player_device_start(player);
+            return -1;
+        }
+    }
+    player_history_note(player, HISTORY_PLAY, player->current);
+
+    player_match_device(player, player->current);
+    player_order_fill(player);
+    player_preload_next(player);
+
+    player_device_start(player);
+    return 0;
+}
+
+int player_skip_next(MiniaudioPlayer* player)
+{
+    ma_mutex_lock(&player->lock);
+    int result = player_skip_next_locked(player);
+    player_prefetch_update(player);
+    ma_mutex_unlock(&player->lock);
+    return result;
+}
+
+static int player_skip_previous_locked(MiniaudioPlayer* player)
+{
+    int position = player->position - 1;
+
+    if (!player->shuffle && position < 0 && player->repeat == PLAYER_REPEAT_ALL)
+        position = player->playlist_count - 1;
+    if (!player->auto_advance || position < 0)
+        return -1;
+
+    player_device_stop(player);
+    player_history_note(player, HISTORY_SKIP, player->current);
+    player_close_tracks(player);
+
+    player->position = position;
+    player->current_index = player_order_index(player, position);
+
+    if (track_open(player, player->current, player->playlist[player->current_index]) != 0)
+    {
+        player_device_start(player);
+        return -1;
+    }
+    player_history_note(player, HISTORY_PLAY, player->current);
+    player_match_device(player, player->current);
+    player_preload_next(player);
+
+    player_device_start(player);
+    return 0;
+}
+
+int player_skip_previous(MiniaudioPlayer* player)
+{
+    ma_mutex_lock(&player->lock);
+    int result = player_skip_previous_locked(player);
+    player_prefetch_update(player);
+    ma_mutex_unlock(&player->lock);
+    return result;
+}
+
+static int player_play_file_locked(MiniaudioPlayer* player, const char* filepath)
+{
+    player_device_stop(player);
+    player_history_note(player, HISTORY_SKIP, player->current);
+    player_close_tracks(player);
+
+    if (track_open(player, player->current, filepath) != 0)
+    {
+        player_device_start(player);
+        return -1;
+    }
+    player_history_note(player, HISTORY_PLAY, player->current);
+    player_match_device(player, player->current);
+
+    player->auto_advance = MA_FALSE;
+    player->is_paused = MA_FALSE;
+
+    player_device_start(player);
+
+    return 0;
+}
+
+int player_play_file(MiniaudioPlayer* player, const char* filepath)
+{
+    ma_mutex_lock(&player->lock);
+    int result = player_play_file_locked(player, filepath);
+    player_prefetch_update(player);
+    ma_mutex_unlock(&player->lock);
+    return result;
+}
+
+static void player_free_playlist(MiniaudioPlayer* player)
+{
+    if (player->playlist != NULL)
+    {
+        for (int i = 0; i < player->playlist_count; i++)
+        {
+            free(player->playlist[i]);
+        }
+        free(player->playlist);
+        player->playlist = NULL;
+    }
+    for (int i = 0; i < player->retired_count; i++)
+    {
+        free(player->retired_playlists[i]);
+    }
+    free(player->retired_playlists);
+    player->retired_playlists = NULL;
+    player->retired_count = 0;
+    player->playlist_count = 0;
+    player->playlist_capacity = 0;
+    player_order_free(player);
+}
+
+static int player_play_playlist_locked(MiniaudioPlayer* player, char** files, int count)
+{
+    if (count == 0) return -1;
+
+    player_device_stop(player);
+    player_history_note(player, HISTORY_SKIP, player->current);
+    player_close_tracks(player);
+    player_free_playlist(player);
+
+    player->playlist = malloc(sizeof(char*) * count);
+    for (int i = 0; i < count; i++)
+    {
+        player->playlist[i] = strdup(files[i]);
+    }
+
+    player->playlist_count = count;
+    player->playlist_capacity = count;
+    player->auto_advance = MA_TRUE;
+    player->is_paused = MA_FALSE;
+    player_order_restart(player, player->shuffle ? (int)(player_random(player) % (ma_uint64)count) : 0);
+
+    if (track_open(player, player->current, player->playlist[player->current_index]) != 0)
+    {
+        player_device_start(player);
+        return -1;
+    }
+    player_history_note(player, HISTORY_PLAY, player->current);
+    player_match_device(player, player->current);
+    player_preload_next(player);
+
+    player_device_start(player);
+
+    return 0;
+}
+
+int player_play_playlist(MiniaudioPlayer* player, char** files, int count)
+{
+    ma_mutex_lock(&player->lock);
+    int result = player_play_playlist_locked(player, files, count);
+    player_prefetch_update(player);
+    ma_mutex_unlock(&player->lock);
+    return result;
+}
+
+// Appending keeps playing: the new entry is published before the count is
+// bumped, and a grown array replaces the old one without freeing it.
+static int player_queue_file_locked(MiniaudioPlayer* player, const char* filepath)
+{
+    if (!player->current->is_active)
+    {
+        char* files[1] = { (char*)filepath };
+        return player_play_playlist_locked(player, files, 1);
+    }
+
+    // A single file is playing: it becomes the head of the new queue.
+    if (!player->auto_advance)
+    {
+        player_device_stop(player);
+        player_free_playlist(player);
+        player->playlist = malloc(sizeof(char*));
+        player->playlist[0] = strdup(player->current->filepath);
+        player->playlist_count = 1;
+        player->playlist_capacity = 1;
+        player->auto_advance = MA_TRUE;
+        player_order_restart(player, 0);
+        player_device_start(player);
+    }
+    player_order_fill(player);
+    int had_next = player_next_position(player) >= 0;
+
+    if (player->playlist_count == player->playlist_capacity)
+    {
+        int capacity = player->playlist_capacity ? player->playlist_capacity * 2 : 16;
+        char** grown = malloc(sizeof(char*) * capacity);
+
+        memcpy(grown, player->playlist, sizeof(char*) * player->playlist_count);
+        player->retired_playlists = realloc(player->retired_playlists, sizeof(char**) * (player->retired_count + 1));
+        player->retired_playlists[player->retired_count++] = player->playlist;
+        __atomic_store_n(&player->playlist, grown, __ATOMIC_RELEASE);
+        player->playlist_capacity = capacity;
+    }
+
+    player->playlist[player->playlist_count] = strdup(filepath);
+    __atomic_store_n(&player->playlist_count, player->playlist_count + 1, __ATOMIC_RELEASE);
+
+    // The preload slot was empty because the queue had run out; fill it now.
+    player_order_fill(player);
+    if (!player->next->is_active && !had_next && player_next_position(player) >= 0)
+    {
+        player_device_stop(player);
+        player_preload_next(player);
+        player_device_start(player);
+    }
+
+    return 0;
+}
+
+int player_queue_file(MiniaudioPlayer* player, const char* filepath)
+{
+    ma_mutex_lock(&player->lock);
+    int result = player_queue_file_locked(player, filepath);
+    player_prefetch_update(player);
+    ma_mutex_unlock(&player->lock);
+    return result;
+}
+
+int player_seek(MiniaudioPlayer* player, ma_uint64 frame)
+{
+    int result = -1;
+
+    ma_mutex_lock(&player->lock);
+    if (player->current->is_active)
+    {
+        player_device_stop(player);
+        if (ma_decoder_seek_to_pcm_frame(&player->current->decoder, frame) == MA_SUCCESS)
+        {
+            player->current->cursor = frame;
+            result = 0;
+        }
+        player_device_start(player);
+    }
+    ma_mutex_unlock(&player->lock);
+
+    return result;
+}
+
+int player_stop(MiniaudioPlayer* player)
+{
+    ma_mutex_lock(&player->lock);
+    player_device_stop(player);
+    player_history_note(player, HISTORY_SKIP, player->current);
+    player_close_tracks(player);
+    player_device_start(player);
+    player_prefetch_update(player);
+    ma_mutex_unlock(&player->lock);
+
+    return 0;
+}
+
+int player_set_shuffle(MiniaudioPlayer* player, ma_bool32 shuffle)
+{
+    int result = 0;
+
+    ma_mutex_lock(&player->lock);
+    if (shuffle && !player->service_running)
+    {
+        ma_mutex_unlock(&player->lock);
+        return -1;
+    }
+
+    if (!shuffle != !player->shuffle)
+    {
+        player_device_stop(player);
+        player->shuffle = shuffle ? MA_TRUE : MA_FALSE;
+        player_order_restart(player, player->current_index);
+        if (shuffle && !player->shuffle)
+            result = -1;
+        if (player->auto_advance && player->current->is_active && !player->reconfigure_pending)
+            player_preload_next(player);
+        player_device_start(player);
+        player_prefetch_update(player);
+    }
+    ma_mutex_unlock(&player->lock);
+
+    return result;
+}
+
+int player_set_repeat(MiniaudioPlayer* player, PlayerRepeatMode repeat)
+{
+    if (repeat < 0 || repeat >= PLAYER_REPEAT_COUNT)
+        return -1;
+
+    ma_mutex_lock(&player->lock);
+    if (repeat != player->repeat)
+    {
+        player_device_stop(player);
+        // Positions already drawn into the next pass no longer play. The pass
+        // they follow counts as finished.
+        if (player->shuffle && repeat != PLAYER_REPEAT_ALL && player->pass_start > player->position)
+        {
+            player->order_count = player->pass_start;
+            player->pass_start = player->previous_pass_start;
+        }
+        player->repeat = repeat;
+        player_order_fill(player);
+        if (player->auto_advance && player->current->is_active && !player->reconfigure_pending)
+            player_preload_next(player);
+        player_device_start(player);
+        player_prefetch_update(player);
+    }
+    ma_mutex_unlock(&player->lock);
+
+    return 0;
+}
+
+// Needs the service thread, which relays playlist advances from the audio thread.
+int player_set_prefetch(MiniaudioPlayer* player, int depth, size_t budget_bytes)
+{
+    int result = 0;
+
+    if (depth < 0 || depth > PREFETCH_MAX_DEPTH)
+        return -1;
+
+    ma_mutex_lock(&player->lock);
+    if (!player->service_running)
+    {
+        result = -1;
+    }
+    else if (!player->prefetch_running)
+    {
+        player->prefetch_budget = budget_bytes;
+        if (prefetch_start(&player->prefetch, player_prefetch_budget(player)) == 0)
+            player->prefetch_running = MA_TRUE;
+        else
+            result = -1;
+    }
+    else
+    {
+        player->prefetch_budget = budget_bytes;
+        prefetch_set_budget(&player->prefetch, player_prefetch_budget(player));
+    }
+    player->prefetch_depth = depth;
+    player_prefetch_update(player);
+    ma_mutex_unlock(&player->lock);
+
+    return result;
+}
+
+void player_set_history(MiniaudioPlayer* player, History* history)
+{
+    ma_mutex_lock(&player->lock);
+    player_history_drain(player);
+    __atomic_store_n(&player->history, history, __ATOMIC_RELAXED);
+    ma_mutex_unlock(&player->lock);
+}
+
+int player_publish_status(MiniaudioPlayer* player, const char* name)
+{
+    StatusPublisher publisher;
+    int result = -1;
+
+    ma_mutex_lock(&player->lock);
+    if (player->status.page == NULL && !player->offline && status_page_create(&publisher, name) == 0)
+    {
+        player_device_stop(player);
+        player->status = publisher;
+        player_device_start(player);
+        result = 0;
+    }
+    ma_mutex_unlock(&player->lock);
+
+    return result;
+}
+
+void player_destroy(MiniaudioPlayer* player)
+{
+    if (player == NULL)
+        return;
+
+    if (player->service_running)
+    {
+        ma_mutex_lock(&player->lock);
+        player->service_quit = MA_TRUE;
+        ma_mutex_unlock(&player->lock);
+        player_wake_post(&player->service_event);
+        pthread_join(player->service_thread, NULL);
+    }
+    if (player->prefetch_running)
+        prefetch_stop(&player->prefetch);
+
+    if (player_has_device(player))
+        ma_device_uninit(&player->device);
+    status_page_destroy(&player->status);
+    player_history_drain(player);
+
+    player_close_tracks(player);
+    player_free_playlist(player);
+    player_free(player);
+}
+
+void player_get_status(MiniaudioPlayer* player, PlayerStatus* status)
+{
+    ma_mutex_lock(&player->lock);
+    AudioTrack* track = player->current;
+
+    status->is_active = track->is_active;
+    status->is_paused = player->is_paused;
+    status->auto_advance = player->auto_advance;
+    status->shuffle = player->shuffle;
+    status->repeat = player->repeat;
+    status->current_index = player->current_index;
+    status->playlist_count = player->playlist_count;
+    status->cursor = track->cursor;
+    status->format = track->format;
+    snprintf(status->filepath, sizeof(status->filepath), "%s", track->filepath);
+    ma_mutex_unlock(&player->lock);
+}
+
+void player_get_device_info(MiniaudioPlayer* player, PlayerDeviceInfo* info)
+{
+    ma_mutex_lock(&player->lock);
+    memset(info, 0, sizeof(*info));
+    info->offline = player->offline;
+    info->format = player->format;
+    info->channels = player->channels;
+    info->sample_rate = player->sample_rate;
+    info->latency = player->latency_profile;
+    info->callback_count = __atomic_load_n(&player->counters.callbacks, __ATOMIC_RELAXED);
+    info->suspended = player->suspended;
+    info->lost = player->device_lost;
+    if (player_has_device(player))
+    {
+        info->converted = player->device.playback.format != player->device.playback.internalFormat ||
+                          player->device.playback.channels != player->device.playback.internalChannels;
+        info->resampled = player->device.sampleRate != player->device.playback.internalSampleRate;
+        info->period_frames = player->device.playback.internalPeriodSizeInFrames;
+        info->internal_rate = player->device.playback.internalSampleRate;
+    }
+    ma_mutex_unlock(&player->lock);
+}
+
+void player_load_sample(MiniaudioPlayer* player, LoadSample* sample)
+{
+    struct timespec now;
+    struct rusage usage;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    getrusage(RUSAGE_SELF, &usage);
+    sample->wall = now.tv_sec + now.tv_nsec / 1e9;
+    sample->cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+                  usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    sample->callbacks = __atomic_load_n(&player->counters.callbacks, __ATOMIC_RELAXED);
+    sample->idle_callbacks = __atomic_load_n(&player->counters.idle_callbacks, __ATOMIC_RELAXED);
+}
+
+void player_get_counters(MiniaudioPlayer* player, PlayerCounters* counters)
+{
+    counters->callbacks = __atomic_load_n(&player->counters.callbacks, __ATOMIC_RELAXED);
+    counters->idle_callbacks = __atomic_load_n(&player->counters.idle_callbacks, __ATOMIC_RELAXED);
+    counters->underruns = __atomic_load_n(&player->counters.underruns, __ATOMIC_RELAXED);
+    counters->decode_ns = __atomic_load_n(&player->counters.decode_ns, __ATOMIC_RELAXED);
+    counters->frames_decoded = __atomic_load_n(&player->counters.frames_decoded, __ATOMIC_RELAXED);
+    counters->tracks_played = __atomic_load_n(&player->counters.tracks_played, __ATOMIC_RELAXED);
+    counters->open_failures = __atomic_load_n(&player->counters.open_failures, __ATOMIC_RELAXED);
+
+    ArenaCounters arena;
+    arena_get_counters(&player->arena_counters, &arena);
+    counters->decoder_allocs = arena.allocs;
+    counters->decoder_audio_allocs = arena.audio_allocs;
+    counters->decoder_system_allocs = arena.system_allocs;
+    counters->decoder_audio_system_allocs = arena.audio_system_allocs;
+    counters->adaptations_raised = __atomic_load_n(&player->counters.adaptations_raised, __ATOMIC_RELAXED);
+    counters->adaptations_lowered = __atomic_load_n(&player->counters.adaptations_lowered, __ATOMIC_RELAXED);
+    counters->suspends = __atomic_load_n(&player->counters.suspends, __ATOMIC_RELAXED);
+    counters->resumes = __atomic_load_n(&player->counters.resumes, __ATOMIC_RELAXED);
+    counters->resume_ns = __atomic_load_n(&player->counters.resume_ns, __ATOMIC_RELAXED);
+    // Includes the suspension still going on, if any.
+    counters->suspended_ns = __atomic_load_n(&player->counters.suspended_ns, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&player->suspended, __ATOMIC_RELAXED))
+        counters->suspended_ns += status_page_now() - __atomic_load_n(&player->suspended_at_ns, __ATOMIC_RELAXED);
+
+    AsyncVfsCounters io;
+    async_vfs_get_counters(&player->vfs, &io);
+    counters->io_bytes = io.bytes;
+    counters->io_stalls = io.stalls;
+    counters->io_stall_ns = io.stall_ns;
+
+    PrefetchCounters prefetch;
+    prefetch_get_counters(&player->prefetch, &prefetch);
+    counters->prefetch_files = prefetch.files;
+    counters->prefetch_bytes = prefetch.bytes;
+    counters->prefetch_used_bytes = prefetch.used_bytes;
+    counters->prefetch_wasted_bytes = prefetch.wasted_bytes;
+}
+
+int player_get_track_io(MiniaudioPlayer* player, FaultTrackStats* tracks, int max)
+{
+    return fault_vfs_tracks(&player->io_stats, tracks, max);
+}
+
+void player_load_stats(MiniaudioPlayer* player, const LoadSample* from, const LoadSample* to, LoadStats* stats)
+{
+    PlayerDeviceInfo info;
+    double elapsed = to->wall - from->wall;
+
+    player_get_device_info(player, &info);
+    stats->period_frames = info.period_frames;
+    stats->period_ms = info.internal_rate > 0 ? 1000.0 * info.period_frames / info.internal_rate : 0.0;
+    stats->wakeups_per_sec = elapsed > 0 ? (to->callbacks - from->callbacks) / elapsed : 0.0;
+    stats->idle_wakeups_per_sec = elapsed > 0 ? (to->idle_callbacks - from->idle_callbacks) / elapsed : 0.0;
+    stats->cpu_percent = elapsed > 0 ? 100.0 * (to->cpu - from->cpu) / elapsed : 0.0;
+}
+
+typedef struct
+{
+    ma_encoder encoder;
+    ma_semaphore free_blocks;
+    ma_semaphore full_blocks;
+    unsigned char* blocks[RENDER_BLOCKS];
+    ma_uint32 block_frames[RENDER_BLOCKS];
+    ma_uint64 frames_written;
+} RenderWriter;
+
+static void* render_writer_thread(void* arg)
+{
+    RenderWriter* writer = (RenderWriter*)arg;
+    int slot = 0;
+
+    for (;;)
+    {
+        ma_semaphore_wait(&writer->full_blocks);
+        if (writer->block_frames[slot] == 0)
+            break;
+
+        ma_uint64 written = 0;
+        ma_encoder_write_pcm_frames(&writer->encoder, writer->blocks[slot], writer->block_frames[slot], &written);
+        writer->frames_written += written;
+
+        ma_semaphore_release(&writer->free_blocks);
+        slot = (slot + 1) % RENDER_BLOCKS;
+    }
+
+    return NULL;
+}
+
+// Pulls the queued playlist through player_process as fast as the CPU allows
+// and hands the blocks to a writer thread that encodes them to a WAV file.
+int player_render(MiniaudioPlayer* player, const char* outPath, RenderStats* stats)
+{
+    RenderWriter writer;
+    ma_encoder_config config = ma_encoder_config_init(ma_encoding_format_wav, player->format, player->channels, player->sample_rate);
+    size_t bytesPerFrame = ma_get_bytes_per_frame(player->format, player->channels);
+    pthread_t thread;
+    struct timespec start, end;
+    int slot = 0;
+    int i;
+
+    if (!player->offline)
+        return -1;
+
+    memset(&writer, 0, sizeof(writer));
+    if (ma_encoder_init_file(outPath, &config, &writer.encoder) != MA_SUCCESS)
+        return -1;
+
+    ma_semaphore_init(RENDER_BLOCKS, &writer.free_blocks);
+    ma_semaphore_init(0, &writer.full_blocks);
+    for (i = 0; i < RENDER_BLOCKS; i++)
+        writer.blocks[i] = malloc(RENDER_BLOCK_FRAMES * bytesPerFrame);
+
+    ma_mutex_lock(&player->lock);
+    pthread_create(&thread, NULL, render_writer_thread, &writer);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (player->current->is_active)
+    {
+        ma_semaphore_wait(&writer.free_blocks);
+        player_process(player, writer.blocks[slot], RENDER_BLOCK_FRAMES);
+        writer.block_frames[slot] = RENDER_BLOCK_FRAMES;
+        ma_semaphore_release(&writer.full_blocks);
+        slot = (slot + 1) % RENDER_BLOCKS;
+    }
+
+    // An empty block tells the writer to finish.
+    ma_semaphore_wait(&writer.free_blocks);
+    writer.block_frames[slot] = 0;
+    ma_semaphore_release(&writer.full_blocks);
+    pthread_join(thread, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ma_mutex_unlock(&player->lock);
+    ma_encoder_uninit(&writer.encoder);
+
+    for (i = 0; i < RENDER_BLOCKS; i++)
+        free(writer.blocks[i]);
+    ma_semaphore_uninit(&writer.free_blocks);
+    ma_semaphore_uninit(&writer.full_blocks);
+
+    if (stats != NULL)
+    {
+        stats->frames = writer.frames_written;
+        stats->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        stats->realtime_factor = stats->seconds > 0
+            ? ((double)stats->frames / player->sample_rate) / stats->seconds : 0.0;
+    }
+
+    return 0;
+}
@@ -0,0 +1,239 @@
+#ifndef PLAYER_H
+#define PLAYER_H
+
+#include "miniaudio.h"
+#include "faultvfs.h"
+#include "history.h"
+#include <stddef.h>
+
+// Playback engine shared by Audio, PSFSP and PlaySelectFile.
+//
+// Every function here may be called from any thread; the engine serialises
+// them on an internal lock. The audio thread itself never takes that lock.
+
+typedef struct MiniaudioPlayer MiniaudioPlayer;
+
+typedef enum
+{
+    PLAYER_FORMAT_FIXED,        // f32, stereo, 48 kHz regardless of the hardware
+    PLAYER_FORMAT_NATIVE,       // whatever the device reports as its native format
+    PLAYER_FORMAT_BITPERFECT    // reopen the device to match each track
+} PlayerFormatMode;
+
+typedef enum
+{
+    PLAYER_LATENCY_LOW,         // small periods, most wakeups
+    PLAYER_LATENCY_BALANCED,
+    PLAYER_LATENCY_POWERSAVE,   // large periods, fewest wakeups
+    PLAYER_LATENCY_COUNT
+} PlayerLatencyProfile;
+
+typedef enum
+{
+    PLAYER_REPEAT_OFF,
+    PLAYER_REPEAT_ONE,          // the current track, until skipped
+    PLAYER_REPEAT_ALL,          // the queue; a shuffle is redrawn for every pass
+    PLAYER_REPEAT_COUNT
+} PlayerRepeatMode;
+
+typedef struct
+{
+    ma_format source_format;
+    ma_uint32 source_channels;
+    ma_uint32 source_rate;
+    ma_bool32 converted;
+    ma_bool32 resampled;
+} TrackFormat;
+
+typedef struct
+{
+    ma_bool32 is_active;
+    ma_bool32 is_paused;
+    ma_bool32 auto_advance;
+    ma_bool32 shuffle;
+    PlayerRepeatMode repeat;
+    int current_index;
+    int playlist_count;
+    ma_uint64 cursor;
+    TrackFormat format;
+    char filepath[512];
+} PlayerStatus;
+
+typedef struct
+{
+    ma_bool32 offline;
+    ma_format format;
+    ma_uint32 channels;
+    ma_uint32 sample_rate;
+    ma_bool32 converted;
+    ma_bool32 resampled;
+    PlayerLatencyProfile latency;
+    ma_uint32 period_frames;
+    ma_uint32 internal_rate;
+    ma_uint64 callback_count;
+    ma_bool32 suspended;            // stopped while there is nothing to play
+    ma_bool32 lost;                 // could not be reopened; nothing plays
+} PlayerDeviceInfo;
+
+typedef struct
+{
+    double wall;
+    double cpu;
+    ma_uint64 callbacks;
+    ma_uint64 idle_callbacks;
+} LoadSample;
+
+typedef struct
+{
+    ma_uint32 period_frames;
+    double period_ms;
+    double wakeups_per_sec;
+    double idle_wakeups_per_sec;    // of those, callbacks that only wrote silence
+    double cpu_percent;
+} LoadStats;
+
+typedef struct
+{
+    ma_uint64 frames;
+    double seconds;
+    double realtime_factor;
+} RenderStats;
+
+// Running totals since the player was created. Each has a single writer, the
+// audio thread, the service thread or the prefetcher; player_get_counters reads them without
+// taking any lock.
+typedef struct
+{
+    ma_uint64 callbacks;
+    ma_uint64 idle_callbacks;   // paused or nothing to play: silence only
+    ma_uint64 underruns;        // callbacks more than 1.5 periods late
+    ma_uint64 decode_ns;        // time spent in the decoder
+    ma_uint64 frames_decoded;
+    ma_uint64 tracks_played;    // tracks that reached their end
+    ma_uint64 open_failures;    // tracks whose decoder could not be opened
+    ma_uint64 io_bytes;         // read by decoders
+    ma_uint64 io_stalls;        // decoder reads that had to wait for the disk
+    ma_uint64 io_stall_ns;
+    ma_uint64 prefetch_files;
+    ma_uint64 prefetch_bytes;   // asked to be read ahead
+    ma_uint64 prefetch_used_bytes;
+    ma_uint64 prefetch_wasted_bytes;
+    // Decoder allocations, which per-track arenas serve (see arena.h), and
+    // how many of them the audio thread made.
+    ma_uint64 decoder_allocs;
+    ma_uint64 decoder_audio_allocs;
+    ma_uint64 decoder_system_allocs;        // an arena was full
+    ma_uint64 decoder_audio_system_allocs;  // should stay 0
+    ma_uint64 adaptations_raised;   // see player_set_adaptive
+    ma_uint64 adaptations_lowered;
+    ma_uint64 suspends;         // device stopped while idle
+    ma_uint64 suspended_ns;
+    ma_uint64 resumes;
+    ma_uint64 resume_ns;        // from the request to the first audible callback
+} PlayerCounters;
+
+// Adaptive buffering: after PLAYER_ADAPT_UNDERRUNS underruns within
+// PLAYER_ADAPT_WINDOW_MS the player raises one level, after
+// PLAYER_ADAPT_QUIET_MS without any it lowers one. Each level doubles the
+// device period or the read-ahead: the prefetch budget and how many blocks
+// each decoder's file keeps in flight (see asyncvfs.h).
+#define PLAYER_ADAPT_UNDERRUNS 3
+#define PLAYER_ADAPT_WINDOW_MS 10000
+#define PLAYER_ADAPT_QUIET_MS 60000
+#define PLAYER_ADAPT_MAX_LEVEL 2
+#define PLAYER_ADAPT_LOG 16         // adjustments kept for player_get_adaptations
+
+typedef struct
+{
+    ma_uint64 serial;               // counts up from 1
+    ma_uint64 time_ns;              // CLOCK_MONOTONIC
+    ma_bool32 raised;               // after underruns, else after a quiet spell
+    ma_uint64 underruns;            // total so far
+    int period_level;
+    int readahead_level;
+    double period_ms;               // the device's, after the change
+    size_t prefetch_budget;         // 0 without a prefetcher
+    size_t decoder_ahead;           // bytes each decoder reads ahead, 0 without the async VFS
+} PlayerAdaptation;
+
+// Pause fades out, and resume fades in, over PLAYER_FADE_MS. Paused, or with
+// nothing left to play, for PLAYER_IDLE_GRACE_MS, the device is stopped so
+// the CPU can sleep; resuming or playing something starts it again.
+#define PLAYER_FADE_MS 5
+#define PLAYER_IDLE_GRACE_MS 1000
+
+#define PLAYER_PREFETCH_DEPTH 2
+#define PLAYER_PREFETCH_BUDGET (16u << 20)
+
+// Opens and starts the default playback device. Returns NULL on failure.
+MiniaudioPlayer* player_create(PlayerFormatMode mode, PlayerLatencyProfile latency);
+// A player with no device, driven by player_render.
+MiniaudioPlayer* player_create_offline(ma_format format, ma_uint32 channels, ma_uint32 sampleRate);
+void player_destroy(MiniaudioPlayer* player);
+
+int player_play_file(MiniaudioPlayer* player, const char* filepath);
+// The playlist is copied; the caller keeps ownership of files.
+int player_play_playlist(MiniaudioPlayer* player, char** files, int count);
+// Appends to the queue, or starts a new queue if nothing is playing.
+int player_queue_file(MiniaudioPlayer* player, const char* filepath);
+int player_skip_next(MiniaudioPlayer* player);
+int player_skip_previous(MiniaudioPlayer* player);
+void player_toggle_pause(MiniaudioPlayer* player);
+int player_stop(MiniaudioPlayer* player);
+// Seeks the current track. frame is in the decoder's output rate.
+int player_seek(MiniaudioPlayer* player, ma_uint64 frame);
+int player_set_latency(MiniaudioPlayer* player, PlayerLatencyProfile latency);
+// Plays the queue in a random order that visits every entry once per pass.
+// Turning it on keeps the current track playing and takes the same time for
+// any queue length; player_skip_previous walks back through what was played.
+// Needs the service thread, so offline players always play in queue order.
+int player_set_shuffle(MiniaudioPlayer* player, ma_bool32 shuffle);
+int player_set_repeat(MiniaudioPlayer* player, PlayerRepeatMode repeat);
+// Warms the page cache for the next depth queue entries, sharing budget_bytes
+// between them (see prefetch.h). depth 0 turns it off. Players with a device
+// start with PLAYER_PREFETCH_DEPTH and PLAYER_PREFETCH_BUDGET.
+int player_set_prefetch(MiniaudioPlayer* player, int depth, size_t budget_bytes);
+// Lets the player size its own buffers. When decoders had to wait for the
+// disk it raises the read-ahead, open files included, else the device
+// period; that reopens the device, a short gap, and decoders carry on where
+// they were. Lowering undoes the read-ahead first and takes the period down
+// only once the device is stopped for pause, idle or a format change.
+// Players with a device start with it on; turning it off, or
+// player_set_latency, goes back to the set sizes (reopening at once). If a
+// reopen fails twice the player has no device and stops adapting.
+void player_set_adaptive(MiniaudioPlayer* player, ma_bool32 adaptive);
+// Copies the adjustments with a serial above after, oldest first, from the
+// last PLAYER_ADAPT_LOG. Returns the number copied.
+int player_get_adaptations(MiniaudioPlayer* player, ma_uint64 after, PlayerAdaptation* out, int max);
+// One line for logs, without a newline.
+void player_describe_adaptation(const PlayerAdaptation* adaptation, char* out, size_t size);
+// Records every play, skip and completion in history, or stops with NULL. The
+// caller keeps ownership and detaches it (or destroys the player) before
+// history_close.
+void player_set_history(MiniaudioPlayer* player, History* history);
+
+// Snapshots. Values written by the audio thread may be up to one period old.
+void player_get_status(MiniaudioPlayer* player, PlayerStatus* status);
+void player_get_device_info(MiniaudioPlayer* player, PlayerDeviceInfo* info);
+
+void player_load_sample(MiniaudioPlayer* player, LoadSample* sample);
+void player_get_counters(MiniaudioPlayer* player, PlayerCounters* counters);
+// Reads, bytes and read latency of the most recently opened tracks as their
+// decoders saw them, newest first. Returns the number copied.
+int player_get_track_io(MiniaudioPlayer* player, FaultTrackStats* tracks, int max);
+void player_load_stats(MiniaudioPlayer* player, const LoadSample* from, const LoadSample* to, LoadStats* stats);
+
+// Publishes a seqlocked status page in POSIX shared memory under name (see
+// statuspage.h). It is updated by the audio thread and removed by player_destroy.
+int player_publish_status(MiniaudioPlayer* player, const char* name);
+
+// Offline players only: plays the queue to a WAV file as fast as possible.
+int player_render(MiniaudioPlayer* player, const char* outPath, RenderStats* stats);
+
+const char* player_latency_name(PlayerLatencyProfile latency);
+int player_parse_latency(const char* name, PlayerLatencyProfile* latency);
+const char* player_format_name(ma_format format);
+const char* player_repeat_name(PlayerRepeatMode repeat);
+int player_parse_repeat(const char* name, PlayerRepeatMode* repeat);
+
+#endif
@@ -0,0 +1,324 @@
+#include "playlist.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char* playlist_extension(const char* filename)
+{
+    const char* dot = strrchr(filename, '.');
+    return dot != NULL ? dot + 1 : "";
+}
+
+int is_playlist_file(const char* filename)
+{
+    const char* ext = playlist_extension(filename);
+
+    return strcasecmp(ext, "m3u") == 0 || strcasecmp(ext, "m3u8") == 0 ||
+           strcasecmp(ext, "pls") == 0 || strcasecmp(ext, "xspf") == 0;
+}
+
+static int playlist_starts_with(const char* data, size_t size, const char* prefix)
+{
+    size_t length = strlen(prefix);
+    return size >= length && strncasecmp(data, prefix, length) == 0;
+}
+
+int playlist_open(PlaylistReader* reader, const char* path)
+{
+    struct stat info;
+    const char* ext = playlist_extension(path);
+    const char* slash = strrchr(path, '/');
+    int fd;
+
+    memset(reader, 0, sizeof(*reader));
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        close(fd);
+        return -1;
+    }
+
+    if (info.st_size > 0)
+    {
+        void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            return -1;
+        }
+        madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+        reader->data = data;
+        reader->size = (size_t)info.st_size;
+    }
+    close(fd);
+
+    if (slash == NULL)
+        snprintf(reader->base, sizeof(reader->base), ".");
+    else if (slash == path)
+        snprintf(reader->base, sizeof(reader->base), "/");
+    else
+        snprintf(reader->base, sizeof(reader->base), "%.*s", (int)(slash - path), path);
+
+    // A UTF-8 byte order mark is not part of the first entry.
+    if (playlist_starts_with(reader->data, reader->size, "\xEF\xBB\xBF"))
+        reader->at = 3;
+
+    // The extension decides, unless the content plainly says otherwise.
+    if (playlist_starts_with(reader->data + reader->at, reader->size - reader->at, "[playlist]"))
+        reader->format = PLAYLIST_PLS;
+    else if (playlist_starts_with(reader->data + reader->at, reader->size - reader->at, "<?xml") ||
+             strcasecmp(ext, "xspf") == 0)
+        reader->format = PLAYLIST_XSPF;
+    else if (strcasecmp(ext, "pls") == 0)
+        reader->format = PLAYLIST_PLS;
+    else
+        reader->format = PLAYLIST_M3U;
+
+    return 0;
+}
+
+void playlist_close(PlaylistReader* reader)
+{
+    if (reader->data != NULL)
+        munmap((void*)reader->data, reader->size);
+    reader->data = NULL;
+    reader->size = 0;
+}
+
+// The next line, without its terminator and surrounding whitespace.
+static int playlist_line(PlaylistReader* reader, const char** line, size_t* length)
+{
+    if (reader->at >= reader->size)
+        return 0;
+
+    const char* start = reader->data + reader->at;
+    const char* newline = memchr(start, '\n', reader->size - reader->at);
+    size_t size = newline != NULL ? (size_t)(newline - start) : reader->size - reader->at;
+
+    reader->at += size + (newline != NULL);
+    while (size > 0 && isspace((unsigned char)*start))
+        start++, size--;
+    while (size > 0 && isspace((unsigned char)start[size - 1]))
+        size--;
+
+    *line = start;
+    *length = size;
+    return 1;
+}
+
+static int playlist_hex(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Copies an entry as written into out as a path: decodes XML entities and
+// percent escapes where the format calls for them, drops file://, and puts
+// relative paths under the playlist's directory. Returns 0 for entries that
+// can't be played from here, such as http:// streams.
+static int playlist_resolve(PlaylistReader* reader, const char* entry, size_t length, char* out, size_t out_size)
+{
+    static const struct { const char* name; char value; } entities[] =
+    {
+        { "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' }, { "&quot;", '"' }, { "&apos;", '\'' }
+    };
+    int xml = reader->format == PLAYLIST_XSPF;
+    int url = xml;
+    char path[1024];
+    size_t used = 0;
+
+    if (playlist_starts_with(entry, length, "file://"))
+    {
+        entry += 7, length -= 7;
+        if (playlist_starts_with(entry, length, "localhost/"))
+            entry += 9, length -= 9;
+        url = 1;
+    }
+    else
+    {
+        // Any other scheme: letters, then "://".
+        size_t i = 0;
+        while (i < length && isalpha((unsigned char)entry[i]))
+            i++;
+        if (i > 1 && length - i >= 3 && memcmp(entry + i, "://", 3) == 0)
+            return 0;
+    }
+
+    for (size_t i = 0; i < length; )
+    {
+        char c = entry[i++];
+
+        if (xml && c == '&')
+        {
+            for (size_t e = 0; e < sizeof(entities) / sizeof(entities[0]); e++)
+            {
+                size_t size = strlen(entities[e].name);
+                if (playlist_starts_with(entry + i - 1, length - i + 1, entities[e].name))
+                {
+                    c = entities[e].value;
+                    i += size - 1;
+                    break;
+                }
+            }
+        }
+        else if (url && c == '%' && i + 1 < length && playlist_hex(entry[i]) >= 0 && playlist_hex(entry[i + 1]) >= 0)
+        {
+            c = (char)(playlist_hex(entry[i]) * 16 + playlist_hex(entry[i + 1]));
+            i += 2;
+        }
+
+        if (used + 1 >= sizeof(path))
+            return 0;
+        path[used++] = c;
+    }
+    path[used] = '\0';
+    if (used == 0)
+        return 0;
+
+    int written;
+    if (path[0] == '/')
+        written = snprintf(out, out_size, "%s", path);
+    else
+        written = snprintf(out, out_size, "%s/%s", reader->base, path);
+    return written > 0 && (size_t)written < out_size;
+}
+
+// The text of the next <location> element.
+static int playlist_next_location(PlaylistReader* reader, const char** text, size_t* length)
+{
+    static const char open_tag[] = "<location>";
+    static const char close_tag[] = "</location>";
+
+    while (reader->at < reader->size)
+    {
+        const char* start = reader->data + reader->at;
+        const char* tag = memchr(start, '<', reader->size - reader->at);
+        if (tag == NULL)
+            break;
+
+        reader->at = (size_t)(tag - reader->data) + 1;
+        if (!playlist_starts_with(tag, reader->size - (size_t)(tag - reader->data), open_tag))
+            continue;
+
+        const char* value = tag + sizeof(open_tag) - 1;
+        const char* end = value;
+        while ((end = memchr(end, '<', reader->size - (size_t)(end - reader->data))) != NULL &&
+               !playlist_starts_with(end, reader->size - (size_t)(end - reader->data), close_tag))
+            end++;
+        if (end == NULL)
+            break;
+
+        reader->at = (size_t)(end - reader->data) + sizeof(close_tag) - 1;
+        while (value < end && isspace((unsigned char)*value))
+            value++;
+        while (end > value && isspace((unsigned char)end[-1]))
+            end--;
+        *text = value;
+        *length = (size_t)(end - value);
+        return 1;
+    }
+
+    reader->at = reader->size;
+    return 0;
+}
+
+int playlist_next(PlaylistReader* reader, char* out, size_t out_size)
+{
+    const char* entry;
+    size_t length;
+
+    if (reader->format == PLAYLIST_XSPF)
+    {
+        while (playlist_next_location(reader, &entry, &length))
+        {
+            if (playlist_resolve(reader, entry, length, out, out_size))
+                return 1;
+        }
+        return 0;
+    }
+
+    while (playlist_line(reader, &entry, &length))
+    {
+        if (reader->format == PLAYLIST_PLS)
+        {
+            // FileN=path; titles, lengths and the header are skipped.
+            size_t i = 4;
+            if (!playlist_starts_with(entry, length, "File"))
+                continue;
+            while (i < length && isdigit((unsigned char)entry[i]))
+                i++;
+            if (i == 4 || i >= length || entry[i] != '=')
+                continue;
+            entry += i + 1;
+            length -= i + 1;
+        }
+        else if (length == 0 || entry[0] == '#')
+        {
+            continue;
+        }
+
+        if (playlist_resolve(reader, entry, length, out, out_size))
+            return 1;
+    }
+    return 0;
+}
+
+static void* playlist_load_thread(void* arg)
+{
+    PlaylistLoader* loader = (PlaylistLoader*)arg;
+    char path[1024];
+
+    while (!__atomic_load_n(&loader->cancel, __ATOMIC_RELAXED) &&
+           playlist_next(&loader->reader, path, sizeof(path)))
+    {
+        if (loader->entries == 0)
+        {
+            char* first = path;
+            player_play_playlist(loader->player, &first, 1);
+        }
+        else
+        {
+            player_queue_file(loader->player, path);
+        }
+        __atomic_store_n(&loader->entries, loader->entries + 1, __ATOMIC_RELAXED);
+    }
+
+    playlist_close(&loader->reader);
+    return NULL;
+}
+
+int playlist_load_start(PlaylistLoader* loader, MiniaudioPlayer* player, const char* path)
+{
+    memset(loader, 0, sizeof(*loader));
+    loader->player = player;
+    if (playlist_open(&loader->reader, path) != 0)
+        return -1;
+
+    if (pthread_create(&loader->thread, NULL, playlist_load_thread, loader) != 0)
+    {
+        playlist_close(&loader->reader);
+        return -1;
+    }
+    loader->running = 1;
+    return 0;
+}
+
+void playlist_load_stop(PlaylistLoader* loader)
+{
+    if (!loader->running)
+        return;
+
+    __atomic_store_n(&loader->cancel, 1, __ATOMIC_RELAXED);
+    pthread_join(loader->thread, NULL);
+    loader->running = 0;
+}
@@ -0,0 +1,55 @@
+#ifndef PLAYLIST_H
+#define PLAYLIST_H
+
+#include "player.h"
+#include <pthread.h>
+#include <stddef.h>
+
+// Streaming reader for M3U/M3U8, PLS and XSPF playlists. The file is memory
+// mapped and parsed one entry at a time, so the first entries are ready before
+// the rest has been looked at. Relative paths are resolved against the
+// playlist's directory, file:// URLs are decoded, and other URLs are skipped.
+
+typedef enum
+{
+    PLAYLIST_M3U,
+    PLAYLIST_PLS,
+    PLAYLIST_XSPF
+} PlaylistFormat;
+
+typedef struct
+{
+    const char* data;
+    size_t size;
+    size_t at;
+    PlaylistFormat format;
+    char base[512];                 // directory relative entries are under
+} PlaylistReader;
+
+// By extension: .m3u, .m3u8, .pls or .xspf.
+int is_playlist_file(const char* filename);
+
+int playlist_open(PlaylistReader* reader, const char* path);
+// Copies the next entry's path into out. Returns 1, or 0 at the end.
+int playlist_next(PlaylistReader* reader, char* out, size_t out_size);
+void playlist_close(PlaylistReader* reader);
+
+// Loads a playlist into a player on its own thread: the first entry replaces
+// the queue and starts playing as soon as it is parsed, the rest are queued
+// as they are read.
+typedef struct
+{
+    pthread_t thread;
+    MiniaudioPlayer* player;
+    PlaylistReader reader;
+    int running;
+    int cancel;
+    int entries;                    // queued so far
+} PlaylistLoader;
+
+// Returns -1 if the playlist cannot be opened.
+int playlist_load_start(PlaylistLoader* loader, MiniaudioPlayer* player, const char* path);
+// Stops a load that is still running. Safe on a zeroed loader that never started.
+void playlist_load_stop(PlaylistLoader* loader);
+
+#endif
@@ -0,0 +1,199 @@
+#include "prefetch.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// The thread is the only writer, so readers just need the stores to be atomic.
+static void prefetch_count(unsigned long long* counter, unsigned long long amount)
+{
+    __atomic_store_n(counter, *counter + amount, __ATOMIC_RELAXED);
+}
+
+// Asks the kernel to read ahead up to lead bytes from the start of path.
+// Returns the number of bytes requested, 0 if the file could not be opened.
+static size_t prefetch_advise(const char* path, size_t lead)
+{
+    struct stat info;
+    size_t length;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        close(fd);
+        return 0;
+    }
+
+    length = (size_t)info.st_size < lead ? (size_t)info.st_size : lead;
+    if (length > 0)
+    {
+#ifdef __APPLE__
+        struct radvisory advice = { 0, (int)length };
+        if (fcntl(fd, F_RDADVISE, &advice) != 0)
+            length = 0;
+#else
+        if (posix_fadvise(fd, 0, length, POSIX_FADV_WILLNEED) != 0)
+            length = 0;
+#endif
+    }
+    close(fd);
+
+    return length;
+}
+
+static int prefetch_in_window(char upcoming[][512], int count, const char* path)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(upcoming[i], path) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// Settles warmed files that left the window: used if they are now playing,
+// wasted otherwise.
+static void prefetch_retire(Prefetcher* prefetcher, const char* playing, char upcoming[][512], int count)
+{
+    int kept = 0;
+
+    for (int i = 0; i < prefetcher->warm_count; i++)
+    {
+        PrefetchEntry* entry = &prefetcher->warm[i];
+
+        if (strcmp(entry->path, playing) == 0)
+            prefetch_count(&prefetcher->counters.used_bytes, entry->bytes);
+        else if (!prefetch_in_window(upcoming, count, entry->path))
+            prefetch_count(&prefetcher->counters.wasted_bytes, entry->bytes);
+        else
+            prefetcher->warm[kept++] = *entry;
+    }
+    prefetcher->warm_count = kept;
+}
+
+static int prefetch_is_warm(Prefetcher* prefetcher, const char* path)
+{
+    for (int i = 0; i < prefetcher->warm_count; i++)
+    {
+        if (strcmp(prefetcher->warm[i].path, path) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static void* prefetch_thread(void* arg)
+{
+    Prefetcher* prefetcher = (Prefetcher*)arg;
+    char playing[512];
+    char upcoming[PREFETCH_MAX_DEPTH][512];
+
+    for (;;)
+    {
+        size_t budget, lead, warmed = 0;
+        int count;
+
+        pthread_mutex_lock(&prefetcher->lock);
+        while (!prefetcher->dirty && !prefetcher->quit)
+            pthread_cond_wait(&prefetcher->wake, &prefetcher->lock);
+        if (prefetcher->quit)
+        {
+            pthread_mutex_unlock(&prefetcher->lock);
+            break;
+        }
+        memcpy(playing, prefetcher->playing, sizeof(playing));
+        memcpy(upcoming, prefetcher->upcoming, sizeof(upcoming));
+        count = prefetcher->upcoming_count;
+        budget = prefetcher->budget_bytes;
+        prefetcher->dirty = 0;
+        pthread_mutex_unlock(&prefetcher->lock);
+
+        prefetch_retire(prefetcher, playing, upcoming, count);
+        for (int i = 0; i < prefetcher->warm_count; i++)
+            warmed += prefetcher->warm[i].bytes;
+
+        // Nearest first, so a tight budget goes to the track that plays soonest.
+        lead = count > 0 ? budget / count : 0;
+        for (int i = 0; i < count && lead > 0; i++)
+        {
+            if (prefetch_is_warm(prefetcher, upcoming[i]) || warmed + lead > budget)
+                continue;
+
+            size_t bytes = prefetch_advise(upcoming[i], lead);
+            if (bytes == 0)
+                continue;
+
+            PrefetchEntry* entry = &prefetcher->warm[prefetcher->warm_count++];
+            memcpy(entry->path, upcoming[i], sizeof(entry->path));
+            entry->bytes = bytes;
+            warmed += bytes;
+            prefetch_count(&prefetcher->counters.files, 1);
+            prefetch_count(&prefetcher->counters.bytes, bytes);
+        }
+    }
+
+    return NULL;
+}
+
+int prefetch_start(Prefetcher* prefetcher, size_t budget_bytes)
+{
+    memset(prefetcher, 0, sizeof(*prefetcher));
+    prefetcher->budget_bytes = budget_bytes;
+    pthread_mutex_init(&prefetcher->lock, NULL);
+    pthread_cond_init(&prefetcher->wake, NULL);
+
+    if (pthread_create(&prefetcher->thread, NULL, prefetch_thread, prefetcher) != 0)
+    {
+        pthread_cond_destroy(&prefetcher->wake);
+        pthread_mutex_destroy(&prefetcher->lock);
+        return -1;
+    }
+
+    return 0;
+}
+
+void prefetch_stop(Prefetcher* prefetcher)
+{
+    pthread_mutex_lock(&prefetcher->lock);
+    prefetcher->quit = 1;
+    pthread_cond_signal(&prefetcher->wake);
+    pthread_mutex_unlock(&prefetcher->lock);
+
+    pthread_join(prefetcher->thread, NULL);
+    pthread_cond_destroy(&prefetcher->wake);
+    pthread_mutex_destroy(&prefetcher->lock);
+}
+
+void prefetch_update(Prefetcher* prefetcher, const char* playing, char** upcoming, int count)
+{
+    if (count > PREFETCH_MAX_DEPTH)
+        count = PREFETCH_MAX_DEPTH;
+
+    pthread_mutex_lock(&prefetcher->lock);
+    snprintf(prefetcher->playing, sizeof(prefetcher->playing), "%s", playing != NULL ? playing : "");
+    for (int i = 0; i < count; i++)
+        snprintf(prefetcher->upcoming[i], sizeof(prefetcher->upcoming[i]), "%s", upcoming[i]);
+    prefetcher->upcoming_count = count;
+    prefetcher->dirty = 1;
+    pthread_cond_signal(&prefetcher->wake);
+    pthread_mutex_unlock(&prefetcher->lock);
+}
+
+void prefetch_set_budget(Prefetcher* prefetcher, size_t budget_bytes)
+{
+    pthread_mutex_lock(&prefetcher->lock);
+    prefetcher->budget_bytes = budget_bytes;
+    prefetcher->dirty = 1;
+    pthread_cond_signal(&prefetcher->wake);
+    pthread_mutex_unlock(&prefetcher->lock);
+}
+
+void prefetch_get_counters(Prefetcher* prefetcher, PrefetchCounters* counters)
+{
+    counters->files = __atomic_load_n(&prefetcher->counters.files, __ATOMIC_RELAXED);
+    counters->bytes = __atomic_load_n(&prefetcher->counters.bytes, __ATOMIC_RELAXED);
+    counters->used_bytes = __atomic_load_n(&prefetcher->counters.used_bytes, __ATOMIC_RELAXED);
+    counters->wasted_bytes = __atomic_load_n(&prefetcher->counters.wasted_bytes, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,61 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+// Warms the page cache for the next few queue entries so a track on NFS or a
+// spinning disk doesn't stall for its first seconds. A thread asks the kernel
+// to read ahead the leading bytes of each upcoming file (posix_fadvise
+// WILLNEED, or F_RDADVISE on macOS); nothing is read into this process.
+//
+// A warmed file counts as used once it starts playing, and as wasted if it
+// leaves the window unplayed (skipped, or the queue was replaced).
+
+#define PREFETCH_MAX_DEPTH 8
+
+typedef struct
+{
+    unsigned long long files;
+    unsigned long long bytes;           // asked to be read ahead
+    unsigned long long used_bytes;
+    unsigned long long wasted_bytes;
+} PrefetchCounters;
+
+typedef struct
+{
+    char path[512];
+    size_t bytes;
+} PrefetchEntry;
+
+typedef struct
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    // The window the owner asked for, guarded by lock.
+    char playing[512];
+    char upcoming[PREFETCH_MAX_DEPTH][512];
+    int upcoming_count;
+    size_t budget_bytes;
+    int dirty;
+    int quit;
+    // Files already warmed; only the thread touches these.
+    PrefetchEntry warm[PREFETCH_MAX_DEPTH];
+    int warm_count;
+    PrefetchCounters counters;
+} Prefetcher;
+
+int prefetch_start(Prefetcher* prefetcher, size_t budget_bytes);
+void prefetch_stop(Prefetcher* prefetcher);
+
+// Replaces the window: the file now playing and up to PREFETCH_MAX_DEPTH that
+// follow it. The budget is shared evenly between the upcoming files. Copies
+// everything and returns at once, but takes a mutex, so not for the audio thread.
+void prefetch_update(Prefetcher* prefetcher, const char* playing, char** upcoming, int count);
+void prefetch_set_budget(Prefetcher* prefetcher, size_t budget_bytes);
+
+// Safe to call from any thread.
+void prefetch_get_counters(Prefetcher* prefetcher, PrefetchCounters* counters);
+
+#endif
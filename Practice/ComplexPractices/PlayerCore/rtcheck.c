@@ -0,0 +1,841 @@
+#ifdef PLAYER_RT_CHECK
+
+#define _GNU_SOURCE
+// Fortified headers define printf and friends inline, which would clash.
+#undef _FORTIFY_SOURCE
+#include "rtcheck.h"
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+// Before 2.33 glibc's fstat was an inline wrapper around __fxstat.
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 33)
+#define RT_FXSTAT
+#endif
+
+// The functions below replace the C library's for the whole program. Each one
+// checks whether its thread is inside the callback and otherwise passes
+// straight through to the real function.
+
+typedef enum
+{
+    RT_ALLOC,
+    RT_STDIO,
+    RT_SYSCALL,
+    RT_LOCK,
+    RT_KINDS
+} RtKind;
+
+static const char* rt_kind_names[RT_KINDS] = { "allocation", "stdio", "syscall", "lock" };
+
+typedef enum
+{
+    RT_MODE_COUNT,
+    RT_MODE_ABORT,
+    RT_MODE_OFF
+} RtMode;
+
+// One call site: the same stack seen again only bumps count.
+typedef struct
+{
+    int ready;
+    unsigned long long count;
+    RtKind kind;
+    const char* name;
+    int depth;
+    void* stack[RT_CHECK_DEPTH];
+} RtRecord;
+
+static RtMode rt_mode;
+static RtRecord rt_records[RT_CHECK_RECORDS];
+static unsigned rt_record_count;
+static unsigned long long rt_counts[RT_KINDS];
+static unsigned long long rt_callbacks;
+static unsigned long long rt_dropped;   // new call sites once the records were full
+static __thread int rt_inside;
+static __thread int rt_busy;        // recording: let everything through
+static __thread const char* rt_expect;  // self test: the name it waits to see
+static __thread int rt_expect_seen;
+
+static void rt_violation(RtKind kind, const char* name);
+
+#define RT_CHECK(kind, name) \
+    do { if (rt_inside && !rt_busy) rt_violation(kind, name); } while (0)
+
+// The real functions, looked up once at startup so the callback never calls
+// dlsym. Anything that runs before then looks its own up.
+#define RT_REAL(type, name, args) \
+    static type (*rt_real_##name) args; \
+    static type (*rt_get_##name(void)) args \
+    { \
+        if (rt_real_##name == NULL) \
+            *(void**)&rt_real_##name = dlsym(RTLD_NEXT, #name); \
+        return rt_real_##name; \
+    }
+
+RT_REAL(int, vfprintf, (FILE*, const char*, va_list))
+RT_REAL(int, fputs, (const char*, FILE*))
+RT_REAL(int, puts, (const char*))
+RT_REAL(int, fputc, (int, FILE*))
+RT_REAL(int, putchar, (int))
+RT_REAL(size_t, fwrite, (const void*, size_t, size_t, FILE*))
+RT_REAL(int, fflush, (FILE*))
+RT_REAL(FILE*, fopen, (const char*, const char*))
+RT_REAL(size_t, fread, (void*, size_t, size_t, FILE*))
+RT_REAL(char*, fgets, (char*, int, FILE*))
+RT_REAL(int, fseek, (FILE*, long, int))
+RT_REAL(long, ftell, (FILE*))
+RT_REAL(int, fclose, (FILE*))
+RT_REAL(ssize_t, read, (int, void*, size_t))
+RT_REAL(ssize_t, write, (int, const void*, size_t))
+RT_REAL(int, open, (const char*, int, ...))
+RT_REAL(int, close, (int))
+RT_REAL(int, fsync, (int))
+RT_REAL(ssize_t, pread, (int, void*, size_t, off_t))
+RT_REAL(ssize_t, pwrite, (int, const void*, size_t, off_t))
+RT_REAL(off_t, lseek, (int, off_t, int))
+#ifdef RT_FXSTAT
+RT_REAL(int, __fxstat, (int, int, struct stat*))
+#else
+RT_REAL(int, fstat, (int, struct stat*))
+#endif
+RT_REAL(int, poll, (struct pollfd*, nfds_t, int))
+RT_REAL(int, nanosleep, (const struct timespec*, struct timespec*))
+RT_REAL(int, usleep, (useconds_t))
+RT_REAL(unsigned, sleep, (unsigned))
+RT_REAL(int, pthread_mutex_lock, (pthread_mutex_t*))
+RT_REAL(int, pthread_rwlock_rdlock, (pthread_rwlock_t*))
+RT_REAL(int, pthread_rwlock_wrlock, (pthread_rwlock_t*))
+RT_REAL(int, pthread_cond_wait, (pthread_cond_t*, pthread_mutex_t*))
+RT_REAL(int, pthread_cond_timedwait, (pthread_cond_t*, pthread_mutex_t*, const struct timespec*))
+RT_REAL(int, sem_wait, (sem_t*))
+#ifdef __linux__
+RT_REAL(int, sem_timedwait, (sem_t*, const struct timespec*))
+// glibc's eventfd calls reach read and write inside libc, past these wrappers.
+RT_REAL(int, eventfd_read, (int, eventfd_t*))
+RT_REAL(int, eventfd_write, (int, eventfd_t))
+#endif
+#ifdef __GLIBC__
+// Fortified builds call these instead of printf, fprintf, read, pread, fread
+// and fgets.
+RT_REAL(int, __vfprintf_chk, (FILE*, int, const char*, va_list))
+RT_REAL(ssize_t, __read_chk, (int, void*, size_t, size_t))
+RT_REAL(ssize_t, __pread_chk, (int, void*, size_t, off_t, size_t))
+RT_REAL(size_t, __fread_chk, (void*, size_t, size_t, size_t, FILE*))
+RT_REAL(char*, __fgets_chk, (char*, size_t, int, FILE*))
+#endif
+
+#ifdef __GLIBC__
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* p, size_t size);
+extern void __libc_free(void* p);
+
+#define rt_malloc __libc_malloc
+#define rt_calloc __libc_calloc
+#define rt_realloc __libc_realloc
+#define rt_free __libc_free
+
+#else
+
+// dlsym may allocate while the allocator itself is being looked up; that
+// comes from a static block that is never given back.
+static unsigned char rt_boot[4096];
+static size_t rt_boot_used;
+static int rt_resolving;
+
+RT_REAL(void*, malloc, (size_t))
+RT_REAL(void*, calloc, (size_t, size_t))
+RT_REAL(void*, realloc, (void*, size_t))
+RT_REAL(void, free, (void*))
+
+static void* rt_boot_alloc(size_t size)
+{
+    size = (size + 15) & ~(size_t)15;
+    if (size > sizeof(rt_boot) - rt_boot_used)
+        return NULL;
+    rt_boot_used += size;
+    return memset(rt_boot + rt_boot_used - size, 0, size);
+}
+
+static int rt_is_boot(void* p)
+{
+    return (unsigned char*)p >= rt_boot && (unsigned char*)p < rt_boot + sizeof(rt_boot);
+}
+
+static void* rt_malloc(size_t size)
+{
+    void* p;
+
+    if (rt_resolving)
+        return rt_boot_alloc(size);
+    rt_resolving = 1;
+    p = rt_get_malloc()(size);
+    rt_resolving = 0;
+    return p;
+}
+
+static void* rt_calloc(size_t count, size_t size)
+{
+    void* p;
+
+    if (rt_resolving)
+        return rt_boot_alloc(count * size);
+    rt_resolving = 1;
+    p = rt_get_calloc()(count, size);
+    rt_resolving = 0;
+    return p;
+}
+
+static void* rt_realloc(void* p, size_t size)
+{
+    void* moved;
+
+    if (rt_is_boot(p))
+    {
+        moved = rt_malloc(size);
+        if (moved != NULL)
+            memcpy(moved, p, size < sizeof(rt_boot) ? size : sizeof(rt_boot));
+        return moved;
+    }
+    rt_resolving = 1;
+    moved = rt_get_realloc()(p, size);
+    rt_resolving = 0;
+    return moved;
+}
+
+static void rt_free(void* p)
+{
+    if (!rt_is_boot(p))
+        rt_get_free()(p);
+}
+
+#endif
+
+static void rt_violation(RtKind kind, const char* name)
+{
+    void* stack[RT_CHECK_DEPTH];
+    unsigned count, slot, i;
+    int depth;
+
+    if (rt_mode == RT_MODE_OFF)
+        return;
+    if (rt_expect != NULL && strcmp(name, rt_expect) == 0)
+        rt_expect_seen = 1;
+    rt_busy = 1;
+    __atomic_add_fetch(&rt_counts[kind], 1, __ATOMIC_RELAXED);
+    depth = backtrace(stack, RT_CHECK_DEPTH);
+
+    count = __atomic_load_n(&rt_record_count, __ATOMIC_ACQUIRE);
+    for (i = 0; i < count && i < RT_CHECK_RECORDS; i++)
+    {
+        RtRecord* record = &rt_records[i];
+        if (__atomic_load_n(&record->ready, __ATOMIC_ACQUIRE) && record->depth == depth &&
+            memcmp(record->stack, stack, sizeof(void*) * (size_t)depth) == 0)
+        {
+            __atomic_add_fetch(&record->count, 1, __ATOMIC_RELAXED);
+            rt_busy = 0;
+            return;
+        }
+    }
+
+    slot = __atomic_fetch_add(&rt_record_count, 1, __ATOMIC_RELAXED);
+    if (slot >= RT_CHECK_RECORDS)
+    {
+        __atomic_add_fetch(&rt_dropped, 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        RtRecord* record = &rt_records[slot];
+
+        record->kind = kind;
+        record->name = name;
+        record->depth = depth;
+        record->count = 1;
+        memcpy(record->stack, stack, sizeof(void*) * (size_t)depth);
+        __atomic_store_n(&record->ready, 1, __ATOMIC_RELEASE);
+
+        if (rt_mode == RT_MODE_ABORT)
+        {
+            char line[128];
+            int length = snprintf(line, sizeof(line), "rtcheck: %s (%s) in the audio callback\n",
+                                  name, rt_kind_names[kind]);
+            rt_get_write()(2, line, (size_t)length);
+            backtrace_symbols_fd(record->stack, record->depth, 2);
+            abort();
+        }
+    }
+    rt_busy = 0;
+}
+
+void rt_check_enter(void)
+{
+    rt_inside = 1;
+    __atomic_add_fetch(&rt_callbacks, 1, __ATOMIC_RELAXED);
+}
+
+void rt_check_leave(void)
+{
+    rt_inside = 0;
+}
+
+void rt_check_report(void)
+{
+    unsigned count = __atomic_load_n(&rt_record_count, __ATOMIC_ACQUIRE);
+    unsigned long long total = 0;
+    unsigned i;
+
+    if (count > RT_CHECK_RECORDS)
+        count = RT_CHECK_RECORDS;
+    for (i = 0; i < RT_KINDS; i++)
+        total += __atomic_load_n(&rt_counts[i], __ATOMIC_RELAXED);
+
+    fprintf(stderr, "rtcheck: %llu violations in %llu callbacks", total,
+            __atomic_load_n(&rt_callbacks, __ATOMIC_RELAXED));
+    for (i = 0; i < RT_KINDS; i++)
+        if (rt_counts[i] > 0)
+            fprintf(stderr, ", %s %llu", rt_kind_names[i], rt_counts[i]);
+    fprintf(stderr, "\n");
+
+    for (i = 0; i < count; i++)
+    {
+        RtRecord* record = &rt_records[i];
+        unsigned long long times = __atomic_load_n(&record->count, __ATOMIC_RELAXED);
+
+        if (!__atomic_load_n(&record->ready, __ATOMIC_ACQUIRE))
+            continue;
+        fprintf(stderr, "\n%s (%s), %llu time%s:\n", record->name, rt_kind_names[record->kind],
+                times, times == 1 ? "" : "s");
+        fflush(stderr);
+        // The first two frames are rt_violation and the wrapper.
+        backtrace_symbols_fd(record->stack + 2, record->depth - 2, 2);
+    }
+    if (rt_dropped > 0)
+        fprintf(stderr, "\n%llu from call sites not kept\n", rt_dropped);
+}
+
+static int rt_check_self_test(void);
+
+__attribute__((constructor)) static void rt_check_start(void)
+{
+    const char* mode = getenv("PSFSP_RT_CHECK");
+    int selftest;
+    void* warm[2];
+
+    if (mode != NULL && strcmp(mode, "off") == 0)
+        rt_mode = RT_MODE_OFF;
+    else if (mode != NULL && strcmp(mode, "abort") == 0)
+        rt_mode = RT_MODE_ABORT;
+    selftest = mode != NULL && strcmp(mode, "selftest") == 0;
+
+    // backtrace loads the unwinder the first time it runs.
+    backtrace(warm, 2);
+    rt_get_vfprintf(); rt_get_fputs(); rt_get_puts(); rt_get_fputc(); rt_get_putchar();
+    rt_get_fwrite(); rt_get_fflush(); rt_get_fopen(); rt_get_fread(); rt_get_fgets();
+    rt_get_fseek(); rt_get_ftell(); rt_get_fclose(); rt_get_read(); rt_get_write();
+    rt_get_open(); rt_get_close(); rt_get_fsync(); rt_get_pread(); rt_get_pwrite();
+    rt_get_lseek(); rt_get_poll(); rt_get_nanosleep(); rt_get_usleep(); rt_get_sleep();
+    rt_get_pthread_mutex_lock(); rt_get_pthread_rwlock_rdlock(); rt_get_pthread_rwlock_wrlock();
+    rt_get_pthread_cond_wait(); rt_get_pthread_cond_timedwait(); rt_get_sem_wait();
+#ifdef RT_FXSTAT
+    rt_get___fxstat();
+#else
+    rt_get_fstat();
+#endif
+#ifdef __linux__
+    rt_get_sem_timedwait(); rt_get_eventfd_read(); rt_get_eventfd_write();
+#endif
+#ifdef __GLIBC__
+    rt_get___vfprintf_chk(); rt_get___read_chk(); rt_get___pread_chk(); rt_get___fread_chk();
+    rt_get___fgets_chk();
+#endif
+
+    if (selftest)
+        exit(rt_check_self_test());
+    if (rt_mode == RT_MODE_COUNT)
+        atexit(rt_check_report);
+}
+
+void* malloc(size_t size)
+{
+    RT_CHECK(RT_ALLOC, "malloc");
+    return rt_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    RT_CHECK(RT_ALLOC, "calloc");
+    return rt_calloc(count, size);
+}
+
+void* realloc(void* p, size_t size)
+{
+    RT_CHECK(RT_ALLOC, "realloc");
+    return rt_realloc(p, size);
+}
+
+void free(void* p)
+{
+    if (p != NULL)
+        RT_CHECK(RT_ALLOC, "free");
+    rt_free(p);
+}
+
+int vfprintf(FILE* stream, const char* format, va_list args)
+{
+    RT_CHECK(RT_STDIO, "vfprintf");
+    return rt_get_vfprintf()(stream, format, args);
+}
+
+int vprintf(const char* format, va_list args)
+{
+    RT_CHECK(RT_STDIO, "vprintf");
+    return rt_get_vfprintf()(stdout, format, args);
+}
+
+int fprintf(FILE* stream, const char* format, ...)
+{
+    va_list args;
+    int result;
+
+    RT_CHECK(RT_STDIO, "fprintf");
+    va_start(args, format);
+    result = rt_get_vfprintf()(stream, format, args);
+    va_end(args);
+    return result;
+}
+
+int printf(const char* format, ...)
+{
+    va_list args;
+    int result;
+
+    RT_CHECK(RT_STDIO, "printf");
+    va_start(args, format);
+    result = rt_get_vfprintf()(stdout, format, args);
+    va_end(args);
+    return result;
+}
+
+int fputs(const char* text, FILE* stream)
+{
+    RT_CHECK(RT_STDIO, "fputs");
+    return rt_get_fputs()(text, stream);
+}
+
+int puts(const char* text)
+{
+    RT_CHECK(RT_STDIO, "puts");
+    return rt_get_puts()(text);
+}
+
+int fputc(int c, FILE* stream)
+{
+    RT_CHECK(RT_STDIO, "fputc");
+    return rt_get_fputc()(c, stream);
+}
+
+int putchar(int c)
+{
+    RT_CHECK(RT_STDIO, "putchar");
+    return rt_get_putchar()(c);
+}
+
+size_t fwrite(const void* data, size_t size, size_t count, FILE* stream)
+{
+    RT_CHECK(RT_STDIO, "fwrite");
+    return rt_get_fwrite()(data, size, count, stream);
+}
+
+int fflush(FILE* stream)
+{
+    RT_CHECK(RT_STDIO, "fflush");
+    return rt_get_fflush()(stream);
+}
+
+FILE* fopen(const char* path, const char* mode)
+{
+    RT_CHECK(RT_STDIO, "fopen");
+    return rt_get_fopen()(path, mode);
+}
+
+size_t fread(void* data, size_t size, size_t count, FILE* stream)
+{
+    RT_CHECK(RT_STDIO, "fread");
+    return rt_get_fread()(data, size, count, stream);
+}
+
+char* fgets(char* line, int size, FILE* stream)
+{
+    RT_CHECK(RT_STDIO, "fgets");
+    return rt_get_fgets()(line, size, stream);
+}
+
+int fseek(FILE* stream, long offset, int origin)
+{
+    RT_CHECK(RT_STDIO, "fseek");
+    return rt_get_fseek()(stream, offset, origin);
+}
+
+long ftell(FILE* stream)
+{
+    RT_CHECK(RT_STDIO, "ftell");
+    return rt_get_ftell()(stream);
+}
+
+int fclose(FILE* stream)
+{
+    RT_CHECK(RT_STDIO, "fclose");
+    return rt_get_fclose()(stream);
+}
+
+#ifdef __GLIBC__
+
+int __vfprintf_chk(FILE* stream, int flag, const char* format, va_list args)
+{
+    RT_CHECK(RT_STDIO, "vfprintf");
+    return rt_get___vfprintf_chk()(stream, flag, format, args);
+}
+
+int __fprintf_chk(FILE* stream, int flag, const char* format, ...)
+{
+    va_list args;
+    int result;
+
+    RT_CHECK(RT_STDIO, "fprintf");
+    va_start(args, format);
+    result = rt_get___vfprintf_chk()(stream, flag, format, args);
+    va_end(args);
+    return result;
+}
+
+int __printf_chk(int flag, const char* format, ...)
+{
+    va_list args;
+    int result;
+
+    RT_CHECK(RT_STDIO, "printf");
+    va_start(args, format);
+    result = rt_get___vfprintf_chk()(stdout, flag, format, args);
+    va_end(args);
+    return result;
+}
+
+ssize_t __read_chk(int fd, void* buffer, size_t size, size_t buffer_size)
+{
+    RT_CHECK(RT_SYSCALL, "read");
+    return rt_get___read_chk()(fd, buffer, size, buffer_size);
+}
+
+ssize_t __pread_chk(int fd, void* buffer, size_t size, off_t offset, size_t buffer_size)
+{
+    RT_CHECK(RT_SYSCALL, "pread");
+    return rt_get___pread_chk()(fd, buffer, size, offset, buffer_size);
+}
+
+size_t __fread_chk(void* data, size_t buffer_size, size_t size, size_t count, FILE* stream)
+{
+    RT_CHECK(RT_STDIO, "fread");
+    return rt_get___fread_chk()(data, buffer_size, size, count, stream);
+}
+
+char* __fgets_chk(char* line, size_t buffer_size, int size, FILE* stream)
+{
+    RT_CHECK(RT_STDIO, "fgets");
+    return rt_get___fgets_chk()(line, buffer_size, size, stream);
+}
+
+#endif
+
+ssize_t read(int fd, void* buffer, size_t size)
+{
+    RT_CHECK(RT_SYSCALL, "read");
+    return rt_get_read()(fd, buffer, size);
+}
+
+ssize_t write(int fd, const void* buffer, size_t size)
+{
+    RT_CHECK(RT_SYSCALL, "write");
+    return rt_get_write()(fd, buffer, size);
+}
+
+int open(const char* path, int flags, ...)
+{
+    va_list args;
+    mode_t mode;
+
+    RT_CHECK(RT_SYSCALL, "open");
+    va_start(args, flags);
+    mode = (flags & O_CREAT) ? (mode_t)va_arg(args, int) : 0;
+    va_end(args);
+    return rt_get_open()(path, flags, mode);
+}
+
+int close(int fd)
+{
+    RT_CHECK(RT_SYSCALL, "close");
+    return rt_get_close()(fd);
+}
+
+int fsync(int fd)
+{
+    RT_CHECK(RT_SYSCALL, "fsync");
+    return rt_get_fsync()(fd);
+}
+
+ssize_t pread(int fd, void* buffer, size_t size, off_t offset)
+{
+    RT_CHECK(RT_SYSCALL, "pread");
+    return rt_get_pread()(fd, buffer, size, offset);
+}
+
+ssize_t pwrite(int fd, const void* buffer, size_t size, off_t offset)
+{
+    RT_CHECK(RT_SYSCALL, "pwrite");
+    return rt_get_pwrite()(fd, buffer, size, offset);
+}
+
+off_t lseek(int fd, off_t offset, int origin)
+{
+    RT_CHECK(RT_SYSCALL, "lseek");
+    return rt_get_lseek()(fd, offset, origin);
+}
+
+#ifdef RT_FXSTAT
+int __fxstat(int version, int fd, struct stat* info)
+{
+    RT_CHECK(RT_SYSCALL, "fstat");
+    return rt_get___fxstat()(version, fd, info);
+}
+#else
+int fstat(int fd, struct stat* info)
+{
+    RT_CHECK(RT_SYSCALL, "fstat");
+    return rt_get_fstat()(fd, info);
+}
+#endif
+
+#ifdef __linux__
+int eventfd_read(int fd, eventfd_t* value)
+{
+    RT_CHECK(RT_SYSCALL, "eventfd_read");
+    return rt_get_eventfd_read()(fd, value);
+}
+
+int eventfd_write(int fd, eventfd_t value)
+{
+    RT_CHECK(RT_SYSCALL, "eventfd_write");
+    return rt_get_eventfd_write()(fd, value);
+}
+#endif
+
+int poll(struct pollfd* fds, nfds_t count, int timeout)
+{
+    RT_CHECK(RT_SYSCALL, "poll");
+    return rt_get_poll()(fds, count, timeout);
+}
+
+int nanosleep(const struct timespec* duration, struct timespec* remaining)
+{
+    RT_CHECK(RT_SYSCALL, "nanosleep");
+    return rt_get_nanosleep()(duration, remaining);
+}
+
+int usleep(useconds_t microseconds)
+{
+    RT_CHECK(RT_SYSCALL, "usleep");
+    return rt_get_usleep()(microseconds);
+}
+
+unsigned sleep(unsigned seconds)
+{
+    RT_CHECK(RT_SYSCALL, "sleep");
+    return rt_get_sleep()(seconds);
+}
+
+int pthread_mutex_lock(pthread_mutex_t* mutex)
+{
+    RT_CHECK(RT_LOCK, "pthread_mutex_lock");
+    return rt_get_pthread_mutex_lock()(mutex);
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t* lock)
+{
+    RT_CHECK(RT_LOCK, "pthread_rwlock_rdlock");
+    return rt_get_pthread_rwlock_rdlock()(lock);
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t* lock)
+{
+    RT_CHECK(RT_LOCK, "pthread_rwlock_wrlock");
+    return rt_get_pthread_rwlock_wrlock()(lock);
+}
+
+int pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex)
+{
+    RT_CHECK(RT_LOCK, "pthread_cond_wait");
+    return rt_get_pthread_cond_wait()(cond, mutex);
+}
+
+int pthread_cond_timedwait(pthread_cond_t* cond, pthread_mutex_t* mutex, const struct timespec* until)
+{
+    RT_CHECK(RT_LOCK, "pthread_cond_timedwait");
+    return rt_get_pthread_cond_timedwait()(cond, mutex, until);
+}
+
+// Posting never blocks; waiting does.
+int sem_wait(sem_t* semaphore)
+{
+    RT_CHECK(RT_LOCK, "sem_wait");
+    return rt_get_sem_wait()(semaphore);
+}
+
+#ifdef __linux__
+int sem_timedwait(sem_t* semaphore, const struct timespec* until)
+{
+    RT_CHECK(RT_LOCK, "sem_timedwait");
+    return rt_get_sem_timedwait()(semaphore, until);
+}
+#endif
+
+// PSFSP_RT_CHECK=selftest: calls every wrapped function from a thread marked
+// as inside the callback and reports any that went unseen. Nothing here
+// blocks: the semaphore is posted before each wait, files are /dev/null.
+#define RT_EXPECT(name, call) \
+    do { \
+        rt_expect = name; \
+        rt_expect_seen = 0; \
+        /* The compiler takes malloc and friends not to read our globals. */ \
+        __atomic_signal_fence(__ATOMIC_SEQ_CST); \
+        call; \
+        __atomic_signal_fence(__ATOMIC_SEQ_CST); \
+        if (!rt_expect_seen && missed < (int)(sizeof(missing) / sizeof(missing[0]))) \
+            missing[missed++] = name; \
+        checked++; \
+    } while (0)
+
+static int rt_self_vfprintf(FILE* file, const char* format, ...)
+{
+    va_list args;
+    int result;
+
+    va_start(args, format);
+    result = vfprintf(file, format, args);
+    va_end(args);
+    return result;
+}
+
+static int rt_check_self_test(void)
+{
+    const char* missing[64];
+    int missed = 0, checked = 0;
+    char buffer[64];
+    struct stat info;
+    struct timespec until = { 0, 0 };
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
+    pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+    sem_t semaphore;
+    void* volatile p;           // or malloc and free would be folded away
+    FILE* file;
+    int fd, sink;
+    // Not constants, so the compiler can't turn one stdio call into another.
+    const char* volatile text = "x";
+    const char* volatile empty = "";
+
+    sem_init(&semaphore, 0, 0);
+    sink = rt_get_open()("/dev/null", O_WRONLY, 0);
+    rt_mode = RT_MODE_COUNT;
+    rt_check_enter();
+
+    RT_EXPECT("malloc", p = malloc(16));
+    RT_EXPECT("realloc", p = realloc(p, 32));
+    RT_EXPECT("free", free(p));
+    RT_EXPECT("calloc", p = calloc(1, 16));
+    rt_free(p);
+
+    RT_EXPECT("fopen", file = fopen("/dev/null", "r"));
+    RT_EXPECT("fread", fread(buffer, 1, sizeof(buffer), file));
+    RT_EXPECT("fgets", fgets(buffer, sizeof(buffer), file));
+    RT_EXPECT("fseek", fseek(file, 0, SEEK_SET));
+    RT_EXPECT("ftell", ftell(file));
+    RT_EXPECT("fclose", fclose(file));
+    file = rt_get_fopen()("/dev/null", "w");
+    RT_EXPECT("fprintf", fprintf(file, "%d", 1));
+    RT_EXPECT("vfprintf", rt_self_vfprintf(file, "%d", 1));
+    RT_EXPECT("fputs", fputs(text, file));
+    RT_EXPECT("fputc", fputc('x', file));
+    RT_EXPECT("fwrite", fwrite(text, 1, 1, file));
+    RT_EXPECT("fflush", fflush(file));
+    rt_get_fclose()(file);
+
+    RT_EXPECT("open", fd = open("/dev/null", O_RDONLY));
+    RT_EXPECT("read", read(fd, buffer, sizeof(buffer)));
+    RT_EXPECT("pread", pread(fd, buffer, sizeof(buffer), 0));
+    RT_EXPECT("lseek", lseek(fd, 0, SEEK_SET));
+    RT_EXPECT("fstat", fstat(fd, &info));
+    RT_EXPECT("close", close(fd));
+    RT_EXPECT("write", write(sink, "x", 1));
+    RT_EXPECT("pwrite", pwrite(sink, "x", 1, 0));
+    RT_EXPECT("fsync", fsync(sink));
+    RT_EXPECT("poll", poll(NULL, 0, 0));
+    RT_EXPECT("nanosleep", nanosleep(&until, NULL));
+    RT_EXPECT("usleep", usleep(0));
+    RT_EXPECT("sleep", sleep(0));
+
+    RT_EXPECT("pthread_mutex_lock", pthread_mutex_lock(&mutex));
+    until.tv_sec = 0;
+    RT_EXPECT("pthread_cond_timedwait", pthread_cond_timedwait(&cond, &mutex, &until));
+    pthread_mutex_unlock(&mutex);
+    RT_EXPECT("pthread_rwlock_rdlock", pthread_rwlock_rdlock(&rwlock));
+    pthread_rwlock_unlock(&rwlock);
+    RT_EXPECT("pthread_rwlock_wrlock", pthread_rwlock_wrlock(&rwlock));
+    pthread_rwlock_unlock(&rwlock);
+    sem_post(&semaphore);
+    RT_EXPECT("sem_wait", sem_wait(&semaphore));
+#ifdef __linux__
+    sem_post(&semaphore);
+    RT_EXPECT("sem_timedwait", sem_timedwait(&semaphore, &until));
+    fd = eventfd(0, 0);
+    RT_EXPECT("eventfd_write", eventfd_write(fd, 1));
+    RT_EXPECT("eventfd_read", { eventfd_t value; eventfd_read(fd, &value); });
+    rt_get_close()(fd);
+#endif
+#ifdef __GLIBC__
+    fd = rt_get_open()("/dev/null", O_RDONLY, 0);
+    file = rt_get_fopen()("/dev/null", "r");
+    RT_EXPECT("read", __read_chk(fd, buffer, sizeof(buffer), sizeof(buffer)));
+    RT_EXPECT("pread", __pread_chk(fd, buffer, sizeof(buffer), 0, sizeof(buffer)));
+    RT_EXPECT("fread", __fread_chk(buffer, sizeof(buffer), 1, sizeof(buffer), file));
+    RT_EXPECT("fgets", __fgets_chk(buffer, sizeof(buffer), sizeof(buffer), file));
+    RT_EXPECT("printf", __printf_chk(1, "%s", empty));
+    rt_get_fclose()(file);
+    rt_get_close()(fd);
+#endif
+
+    rt_check_leave();
+    rt_expect = NULL;
+    rt_get_close()(sink);
+    sem_destroy(&semaphore);
+
+    for (int i = 0; i < missed; i++)
+        fprintf(stderr, "rtcheck: %s was not caught\n", missing[i]);
+    fprintf(stderr, "rtcheck: self test caught %d of %d calls\n", checked - missed, checked);
+    return missed == 0 ? 0 : 1;
+}
+
+#endif
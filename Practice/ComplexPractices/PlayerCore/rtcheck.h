@@ -0,0 +1,50 @@
+#ifndef RTCHECK_H
+#define RTCHECK_H
+
+// Catches what the audio callback must never do. Built in only when compiled
+// with -DPLAYER_RT_CHECK; otherwise every call here is empty.
+//
+//   CFLAGS=-DPLAYER_RT_CHECK PSFSP/make.sh -rdynamic
+//
+// While a thread is between rt_check_enter and rt_check_leave, these are
+// recorded with a backtrace:
+//
+//   malloc, calloc, realloc and free
+//   stdio: printf and friends, fputs, fwrite, fflush, fopen, fread, fgets,
+//   fseek, ftell, fclose
+//   syscalls: read, write, pread, pwrite, lseek, fstat, open, close, fsync,
+//   poll, sleeps, eventfd_read and eventfd_write
+//   waits: mutexes, rwlocks, conditions, sem_wait and sem_timedwait
+//
+// glibc's fortified _chk variants are caught as the calls they stand for.
+// Semaphore posts never block, so waking another thread with one is allowed.
+// PSFSP_RT_CHECK picks what happens then:
+//
+//   count     (default) keep them and print a summary, one entry per call
+//             site, when the program exits
+//   abort     print the first one and abort, for a core dump or a debugger
+//   off       don't check
+//   selftest  call each of the above as if in the callback, report any
+//             that slipped through and exit, 1 if one did
+//
+// -rdynamic makes the backtraces show function names. glibc and macOS only.
+
+#define RT_CHECK_DEPTH 24           // frames kept per violation
+#define RT_CHECK_RECORDS 256        // violations kept; later ones are only counted
+
+#ifdef PLAYER_RT_CHECK
+
+void rt_check_enter(void);
+void rt_check_leave(void);
+// Prints the violations kept so far, grouped by call site, to stderr.
+void rt_check_report(void);
+
+#else
+
+#define rt_check_enter() ((void)0)
+#define rt_check_leave() ((void)0)
+#define rt_check_report() ((void)0)
+
+#endif
+
+#endif
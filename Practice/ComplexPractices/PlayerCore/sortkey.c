@@ -0,0 +1,380 @@
+#include "sortkey.h"
+#include <ctype.h>
+#include <limits.h>
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+
+#define SORTKEY_DIGITS 0x01
+#define SORTKEY_TEXT 0x02
+#define SORTKEY_SMALL 32
+
+void sortkeys_init(SortKeys* keys)
+{
+    const char* collate = setlocale(LC_COLLATE, NULL);
+
+    memset(keys, 0, sizeof(*keys));
+    // C and C.UTF-8 collate by code point, which is byte order in UTF-8.
+    keys->byte_order = collate == NULL || strcmp(collate, "C") == 0 || strcmp(collate, "POSIX") == 0 ||
+                       strncmp(collate, "C.", 2) == 0;
+}
+
+void sortkeys_free(SortKeys* keys)
+{
+    free(keys->arena);
+    free(keys->keys);
+    memset(keys, 0, sizeof(*keys));
+}
+
+static unsigned char* sortkeys_reserve(SortKeys* keys, size_t length)
+{
+    if (keys->arena_used + length > keys->arena_size)
+    {
+        size_t size = keys->arena_size ? keys->arena_size : 4096;
+        while (keys->arena_used + length > size)
+            size *= 2;
+        keys->arena = realloc(keys->arena, size);
+        keys->arena_size = size;
+    }
+
+    return keys->arena + keys->arena_used;
+}
+
+static void sortkeys_append(SortKeys* keys, const void* bytes, size_t length)
+{
+    memcpy(sortkeys_reserve(keys, length), bytes, length);
+    keys->arena_used += length;
+    keys->keys[keys->count - 1].length += length;
+}
+
+static void sortkeys_byte(SortKeys* keys, unsigned char byte)
+{
+    sortkeys_append(keys, &byte, 1);
+}
+
+void sortkeys_begin(SortKeys* keys, size_t index)
+{
+    if (keys->count == keys->capacity)
+    {
+        keys->capacity = keys->capacity ? keys->capacity * 2 : 256;
+        keys->keys = realloc(keys->keys, sizeof(SortKey) * keys->capacity);
+    }
+
+    keys->keys[keys->count].offset = keys->arena_used;
+    keys->keys[keys->count].length = 0;
+    keys->keys[keys->count].index = index;
+    keys->count++;
+}
+
+// Appends the collation key of a run of non-digits, case-folded. strxfrm never
+// produces a zero byte, so the terminator sorts a prefix first.
+static void sortkeys_collate(SortKeys* keys, const char* text, size_t length)
+{
+    if (keys->byte_order)
+    {
+        unsigned char* out = sortkeys_reserve(keys, length + 1);
+        for (size_t i = 0; i < length; i++)
+            out[i] = (unsigned char)tolower((unsigned char)text[i]);
+        out[length] = 0;
+        keys->arena_used += length + 1;
+        keys->keys[keys->count - 1].length += length + 1;
+        return;
+    }
+
+    char folded[1024];
+    size_t used = 0;
+    mbstate_t in, out;
+    size_t i = 0;
+
+    memset(&in, 0, sizeof(in));
+    memset(&out, 0, sizeof(out));
+    while (i < length && used + MB_LEN_MAX < sizeof(folded))
+    {
+        wchar_t wide;
+        size_t consumed = mbrtowc(&wide, text + i, length - i, &in);
+        if (consumed == (size_t)-1 || consumed == (size_t)-2 || consumed == 0)
+        {
+            // Not valid in this locale: keep the byte as it is.
+            folded[used++] = text[i++];
+            memset(&in, 0, sizeof(in));
+            continue;
+        }
+        size_t produced = wcrtomb(folded + used, towlower(wide), &out);
+        if (produced == (size_t)-1)
+        {
+            memcpy(folded + used, text + i, consumed);
+            produced = consumed;
+        }
+        used += produced;
+        i += consumed;
+    }
+    folded[used] = '\0';
+
+    size_t room = used * 4 + 16;
+    for (;;)
+    {
+        unsigned char* dest = sortkeys_reserve(keys, room);
+        size_t needed = strxfrm((char*)dest, folded, room);
+        if (needed < room)
+        {
+            keys->arena_used += needed + 1;
+            keys->keys[keys->count - 1].length += needed + 1;
+            return;
+        }
+        room = needed + 1;
+    }
+}
+
+void sortkeys_text(SortKeys* keys, const char* text)
+{
+    const char* p = text;
+
+    while (*p != '\0')
+    {
+        if (isdigit((unsigned char)*p))
+        {
+            // Numbers compare by digit count, then digit by digit.
+            while (*p == '0' && isdigit((unsigned char)p[1]))
+                p++;
+            const char* digits = p;
+            while (isdigit((unsigned char)*p))
+                p++;
+            size_t count = p - digits;
+
+            sortkeys_byte(keys, SORTKEY_DIGITS);
+            sortkeys_byte(keys, (unsigned char)(count < 255 ? count : 255));
+            sortkeys_append(keys, digits, count);
+        }
+        else
+        {
+            const char* start = p;
+            while (*p != '\0' && !isdigit((unsigned char)*p))
+                p++;
+
+            sortkeys_byte(keys, SORTKEY_TEXT);
+            sortkeys_collate(keys, start, p - start);
+        }
+    }
+    sortkeys_byte(keys, 0);
+}
+
+void sortkeys_number(SortKeys* keys, unsigned long long value)
+{
+    unsigned char bytes[8];
+
+    for (int i = 0; i < 8; i++)
+        bytes[i] = (unsigned char)(value >> (56 - 8 * i));
+    sortkeys_append(keys, bytes, sizeof(bytes));
+}
+
+void sortkeys_bytes(SortKeys* keys, const void* bytes, size_t length)
+{
+    sortkeys_append(keys, bytes, length);
+}
+
+static int sortkey_compare(const unsigned char* arena, const SortKey* a, const SortKey* b, size_t depth)
+{
+    size_t shorter = a->length < b->length ? a->length : b->length;
+    int result = depth < shorter ? memcmp(arena + a->offset + depth, arena + b->offset + depth, shorter - depth) : 0;
+
+    if (result != 0)
+        return result;
+    return (a->length > b->length) - (a->length < b->length);
+}
+
+// The cached bytes decide most comparisons. Past the end of a key the cache
+// holds zeros, which still orders the shorter key first, so only equal caches
+// need the arena.
+static int sortkey_compare_cached(const unsigned char* arena, const SortKey* a, const SortKey* b,
+                                  size_t depth, size_t cache_depth)
+{
+    int shift = 8 * (int)(depth - cache_depth);
+    unsigned long long left = shift < 64 ? a->cache << shift : 0;
+    unsigned long long right = shift < 64 ? b->cache << shift : 0;
+
+    if (left != right)
+        return left < right ? -1 : 1;
+    return sortkey_compare(arena, a, b, depth);
+}
+
+static void sortkeys_insertion(const unsigned char* arena, SortKey* keys, size_t count, size_t depth, size_t cache_depth)
+{
+    for (size_t i = 1; i < count; i++)
+    {
+        SortKey key = keys[i];
+        size_t j = i;
+        while (j > 0 && sortkey_compare_cached(arena, &keys[j - 1], &key, depth, cache_depth) > 0)
+        {
+            keys[j] = keys[j - 1];
+            j--;
+        }
+        keys[j] = key;
+    }
+}
+
+// Loads key bytes [depth, depth + 8) into the cache, so the radix passes read
+// the arena once per eight levels instead of once per level.
+static void sortkeys_fill_cache(const unsigned char* arena, SortKey* keys, size_t count, size_t depth)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        // After a scatter the keys point all over the arena; keep a few loads
+        // in flight instead of waiting on each miss.
+        if (i + 16 < count)
+            __builtin_prefetch(arena + keys[i + 16].offset + depth);
+
+        unsigned long long cache = 0;
+        for (size_t d = depth; d < depth + 8; d++)
+            cache = (cache << 8) | (d < keys[i].length ? arena[keys[i].offset + d] : 0);
+        keys[i].cache = cache;
+    }
+}
+
+static int sortkey_bucket(const SortKey* key, size_t depth, size_t cache_depth)
+{
+    if (depth >= key->length)
+        return 0;
+    return (int)((key->cache >> (56 - 8 * (depth - cache_depth))) & 0xff) + 1;
+}
+
+// MSD radix sort on the byte at depth. Bucket 0 holds keys that have ended,
+// which are equal from here on, so it needs no further work.
+static void sortkeys_radix(const unsigned char* arena, SortKey* keys, SortKey* scratch, size_t count,
+                           size_t depth, size_t cache_depth)
+{
+    size_t buckets[258];
+    size_t starts[257];
+
+    if (count < SORTKEY_SMALL)
+    {
+        sortkeys_insertion(arena, keys, count, depth, cache_depth);
+        return;
+    }
+
+    for (;;)
+    {
+        if (depth == cache_depth + 8)
+        {
+            sortkeys_fill_cache(arena, keys, count, depth);
+            cache_depth = depth;
+        }
+
+        memset(buckets, 0, sizeof(buckets));
+        for (size_t i = 0; i < count; i++)
+            buckets[sortkey_bucket(&keys[i], depth, cache_depth) + 1]++;
+
+        // A shared prefix byte: nothing to move, go one level deeper.
+        int b = sortkey_bucket(&keys[0], depth, cache_depth);
+        if (buckets[b + 1] != count)
+            break;
+        if (b == 0)
+            return;
+        depth++;
+    }
+
+    for (int b = 1; b < 258; b++)
+        buckets[b] += buckets[b - 1];
+    memcpy(starts, buckets, sizeof(starts));
+
+    for (size_t i = 0; i < count; i++)
+        scratch[buckets[sortkey_bucket(&keys[i], depth, cache_depth)]++] = keys[i];
+    memcpy(keys, scratch, sizeof(SortKey) * count);
+
+    for (int b = 1; b < 257; b++)
+    {
+        size_t size = (b < 256 ? starts[b + 1] : count) - starts[b];
+        if (size > 1)
+            sortkeys_radix(arena, keys + starts[b], scratch, size, depth + 1, cache_depth);
+    }
+}
+
+void sortkeys_sort(SortKeys* keys)
+{
+    SortKey* scratch;
+
+    if (keys->count < 2)
+        return;
+
+    scratch = malloc(sizeof(SortKey) * keys->count);
+    sortkeys_fill_cache(keys->arena, keys->keys, keys->count, 0);
+    sortkeys_radix(keys->arena, keys->keys, scratch, keys->count, 0, 0);
+    free(scratch);
+}
+
+int sortkeys_merge(SortKeys* keys, size_t sorted)
+{
+    size_t added = keys->count - sorted;
+    SortKey* tail = keys->keys + sorted;
+    SortKey* merged;
+    size_t a = 0, b = 0, out = 0;
+
+    if (added == 0)
+        return 0;
+    if (added > 1)
+    {
+        SortKey* scratch = malloc(sizeof(SortKey) * added);
+        if (scratch == NULL)
+            return -1;
+        sortkeys_fill_cache(keys->arena, tail, added, 0);
+        sortkeys_radix(keys->arena, tail, scratch, added, 0, 0);
+        free(scratch);
+    }
+    if (sorted == 0)
+        return 0;
+
+    merged = malloc(sizeof(SortKey) * keys->count);
+    if (merged == NULL)
+        return -1;
+    while (a < sorted && b < added)
+    {
+        if (sortkey_compare(keys->arena, &keys->keys[a], &tail[b], 0) <= 0)
+            merged[out++] = keys->keys[a++];
+        else
+            merged[out++] = tail[b++];
+    }
+    while (a < sorted)
+        merged[out++] = keys->keys[a++];
+    while (b < added)
+        merged[out++] = tail[b++];
+    memcpy(keys->keys, merged, sizeof(SortKey) * keys->count);
+    free(merged);
+
+    return 0;
+}
+
+void natural_sort_strings(char** strings, size_t count)
+{
+    SortKeys keys;
+    char** sorted;
+
+    if (count < 2)
+        return;
+
+    sortkeys_init(&keys);
+    // Keys run to about twice the name length; sizing up front avoids
+    // copying the arena as it grows.
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++)
+        total += strlen(strings[i]) * 2 + 8;
+    sortkeys_reserve(&keys, total);
+    keys.keys = malloc(sizeof(SortKey) * count);
+    keys.capacity = count;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        sortkeys_begin(&keys, i);
+        sortkeys_text(&keys, strings[i]);
+        sortkeys_bytes(&keys, strings[i], strlen(strings[i]));
+    }
+    sortkeys_sort(&keys);
+
+    sorted = malloc(sizeof(char*) * count);
+    for (size_t i = 0; i < count; i++)
+        sorted[i] = strings[keys.keys[i].index];
+    memcpy(strings, sorted, sizeof(char*) * count);
+
+    free(sorted);
+    sortkeys_free(&keys);
+}
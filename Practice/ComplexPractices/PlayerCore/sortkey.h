@@ -0,0 +1,53 @@
+#ifndef SORTKEY_H
+#define SORTKEY_H
+
+#include <stddef.h>
+
+// Sorting by precomputed binary keys. Each entry's key is built once, so the
+// sort itself only compares bytes (an MSD radix sort), and a key can be made
+// of several fields to re-sort by something other than the name.
+//
+// Text fields sort naturally ("Track 2" before "Track 10"), case-folded and in
+// the order of the current LC_COLLATE locale; call setlocale first.
+
+typedef struct
+{
+    size_t offset;          // into the arena
+    size_t length;
+    size_t index;           // caller's index, e.g. into the array being sorted
+    unsigned long long cache;   // eight key bytes near the sort depth
+} SortKey;
+
+typedef struct
+{
+    unsigned char* arena;
+    size_t arena_used;
+    size_t arena_size;
+    SortKey* keys;
+    size_t count;
+    size_t capacity;
+    int byte_order;         // the locale collates by code point, so skip strxfrm
+} SortKeys;
+
+void sortkeys_init(SortKeys* keys);
+void sortkeys_free(SortKeys* keys);
+
+// Starts the key for one entry; the field functions then append to it.
+void sortkeys_begin(SortKeys* keys, size_t index);
+void sortkeys_text(SortKeys* keys, const char* text);
+void sortkeys_number(SortKeys* keys, unsigned long long value);
+// Raw bytes, e.g. the original name as a final tie-break.
+void sortkeys_bytes(SortKeys* keys, const void* bytes, size_t length);
+
+// Sorts keys->keys by key; read the order back through SortKey.index.
+void sortkeys_sort(SortKeys* keys);
+// Sorts the keys added after the first sorted, which must already be in
+// order, and merges the two runs: for a list that grows while it is shown.
+// Returns -1 if it ran out of memory; the keys are then in no set order past
+// sorted, and a later call with the same sorted makes up for it.
+int sortkeys_merge(SortKeys* keys, size_t sorted);
+
+// Natural sort of an array of strings, ties broken by the raw bytes.
+void natural_sort_strings(char** strings, size_t count);
+
+#endif
@@ -0,0 +1,178 @@
+#include "statuspage.h"
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+void status_page_default_name(char* out, size_t out_size)
+{
+    snprintf(out, out_size, "/psfsp-status-%u", (unsigned)getuid());
+}
+
+ma_uint64 status_page_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (ma_uint64)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+int status_page_create(StatusPublisher* publisher, const char* name)
+{
+    int fd;
+
+    memset(publisher, 0, sizeof(*publisher));
+    // Only this user's monitors may read what is playing. fchmod covers a
+    // segment left behind by an older daemon with a wider mode.
+    fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (fd < 0)
+        return -1;
+
+    if (fchmod(fd, 0600) != 0 || ftruncate(fd, sizeof(PlayerStatusPage)) != 0)
+    {
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+
+    void* mapped = mmap(NULL, sizeof(PlayerStatusPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        shm_unlink(name);
+        return -1;
+    }
+
+    publisher->page = (PlayerStatusPage*)mapped;
+    publisher->page->version = STATUS_PAGE_VERSION;
+    publisher->page->playlist_index = -1;
+    snprintf(publisher->name, sizeof(publisher->name), "%s", name);
+    // Written last so a reader never accepts a half-initialised page.
+    __atomic_store_n(&publisher->page->magic, STATUS_PAGE_MAGIC, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+void status_page_destroy(StatusPublisher* publisher)
+{
+    if (publisher->page == NULL)
+        return;
+
+    munmap(publisher->page, sizeof(PlayerStatusPage));
+    shm_unlink(publisher->name);
+    publisher->page = NULL;
+}
+
+void status_page_write_begin(StatusPublisher* publisher)
+{
+    ma_uint32 seq = publisher->page->seq;
+
+    __atomic_store_n(&publisher->page->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void status_page_write_end(StatusPublisher* publisher)
+{
+    __atomic_store_n(&publisher->page->seq, publisher->page->seq + 1, __ATOMIC_RELEASE);
+}
+
+// Log-linear buckets: four per power of two, so any value is within 25%.
+static int histogram_bucket(ma_uint64 ns)
+{
+    if (ns < 4)
+        return (int)ns;
+
+    int exponent = 63 - __builtin_clzll(ns);
+    int bucket = exponent * 4 + (int)((ns >> (exponent - 2)) & 3);
+    return bucket < STATUS_PAGE_HISTOGRAM ? bucket : STATUS_PAGE_HISTOGRAM - 1;
+}
+
+static ma_uint64 histogram_value(int bucket)
+{
+    if (bucket < 4)
+        return bucket;
+
+    return (ma_uint64)(4 + bucket % 4) << (bucket / 4 - 2);
+}
+
+static ma_uint32 histogram_percentile(const StatusPublisher* publisher, double quantile)
+{
+    ma_uint64 target = (ma_uint64)(publisher->samples * quantile);
+    ma_uint64 seen = 0;
+
+    for (int b = 0; b < STATUS_PAGE_HISTOGRAM; b++)
+    {
+        seen += publisher->histogram[b];
+        if (seen > target)
+            return (ma_uint32)(histogram_value(b) / 1000);
+    }
+
+    return 0;
+}
+
+void status_page_record_callback(StatusPublisher* publisher, ma_uint64 start_ns, ma_uint64 end_ns)
+{
+    PlayerStatusPage* page = publisher->page;
+    ma_uint64 duration = end_ns - start_ns;
+
+    publisher->histogram[histogram_bucket(duration)]++;
+    publisher->samples++;
+
+    page->callbacks++;
+    page->callback_p50_us = histogram_percentile(publisher, 0.50);
+    page->callback_p99_us = histogram_percentile(publisher, 0.99);
+    if (duration / 1000 > page->callback_max_us)
+        page->callback_max_us = (ma_uint32)(duration / 1000);
+    page->updated_ns = end_ns;
+}
+
+const PlayerStatusPage* status_page_open(const char* name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+
+    void* mapped = mmap(NULL, sizeof(PlayerStatusPage), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return NULL;
+
+    const PlayerStatusPage* page = (const PlayerStatusPage*)mapped;
+    if (__atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) != STATUS_PAGE_MAGIC || page->version != STATUS_PAGE_VERSION)
+    {
+        munmap(mapped, sizeof(PlayerStatusPage));
+        return NULL;
+    }
+
+    return page;
+}
+
+void status_page_close(const PlayerStatusPage* page)
+{
+    if (page != NULL)
+        munmap((void*)page, sizeof(PlayerStatusPage));
+}
+
+int status_page_read(const PlayerStatusPage* page, PlayerStatusPage* snapshot)
+{
+    // An update takes microseconds, so a sequence that stays odd this long
+    // means the writer died inside one.
+    for (int attempt = 0; attempt < STATUS_PAGE_READ_RETRIES; attempt++)
+    {
+        ma_uint32 before = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        if ((before & 1) == 0)
+        {
+            memcpy(snapshot, page, sizeof(*snapshot));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+            if (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) == before)
+                return 0;
+        }
+        sched_yield();
+    }
+
+    return -1;
+}
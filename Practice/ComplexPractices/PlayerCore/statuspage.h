@@ -0,0 +1,70 @@
+#ifndef STATUSPAGE_H
+#define STATUSPAGE_H
+
+#include "miniaudio.h"
+
+// Player state published in a POSIX shared-memory segment. The audio thread is
+// the only writer and updates it once per callback under a sequence lock;
+// readers map it read-only and retry if they raced with an update, so sampling
+// it costs the player nothing and the reader no syscalls.
+//
+// The layout is shared between processes: fixed-width fields only, and bump
+// STATUS_PAGE_VERSION on any change.
+
+#define STATUS_PAGE_MAGIC 0x50535350   // "PSSP"
+#define STATUS_PAGE_VERSION 1
+#define STATUS_PAGE_HISTOGRAM 128
+#define STATUS_PAGE_READ_RETRIES 1000  // torn reads tolerated before giving up
+
+typedef struct
+{
+    ma_uint32 magic;
+    ma_uint32 version;
+    ma_uint32 seq;                  // odd while an update is in progress
+    ma_uint32 sample_rate;
+    ma_uint64 track_id;             // changes whenever a new track starts
+    ma_int32 playlist_index;
+    ma_uint32 active;
+    ma_uint32 paused;
+    ma_uint32 period_frames;
+    ma_uint64 position_frames;
+    ma_uint64 callbacks;
+    ma_uint64 underruns;            // callbacks more than 1.5 periods late
+    ma_uint32 callback_p50_us;      // time spent inside the callback
+    ma_uint32 callback_p99_us;
+    ma_uint32 callback_max_us;
+    ma_uint32 reserved;
+    ma_uint64 updated_ns;           // CLOCK_MONOTONIC of the last update
+    char filepath[512];
+} PlayerStatusPage;
+
+// Writer side. Owned by the player; none of this lives in the segment.
+typedef struct
+{
+    PlayerStatusPage* page;
+    char name[64];
+    ma_uint64 histogram[STATUS_PAGE_HISTOGRAM];
+    ma_uint64 samples;
+    ma_uint64 last_track_id;
+} StatusPublisher;
+
+void status_page_default_name(char* out, size_t out_size);
+ma_uint64 status_page_now(void);
+
+int status_page_create(StatusPublisher* publisher, const char* name);
+void status_page_destroy(StatusPublisher* publisher);
+// Brackets one update. Only the audio thread may call these.
+void status_page_write_begin(StatusPublisher* publisher);
+void status_page_write_end(StatusPublisher* publisher);
+// Adds one callback to the timing histogram and refreshes the percentiles.
+// Call between write_begin and write_end.
+void status_page_record_callback(StatusPublisher* publisher, ma_uint64 start_ns, ma_uint64 end_ns);
+
+// Reader side.
+const PlayerStatusPage* status_page_open(const char* name);
+void status_page_close(const PlayerStatusPage* page);
+// Takes a consistent copy. Returns -1 if every attempt raced with an update,
+// which happens when the writer stopped halfway through one.
+int status_page_read(const PlayerStatusPage* page, PlayerStatusPage* snapshot);
+
+#endif
@@ -0,0 +1,665 @@
+#include "tags.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TAG_OGG_PAGES 16                // pages searched for the comment header
+#define TAG_OGG_COPY (64 * 1024)        // most of a split comment header put back together
+
+typedef struct
+{
+    char* out;
+    size_t size;
+    size_t used;
+    int full;
+} TagText;
+
+static void tag_put(TagText* text, unsigned codepoint)
+{
+    unsigned char bytes[4];
+    size_t length;
+
+    if (codepoint < 0x80)
+        bytes[0] = (unsigned char)codepoint, length = 1;
+    else if (codepoint < 0x800)
+    {
+        bytes[0] = (unsigned char)(0xC0 | (codepoint >> 6));
+        bytes[1] = (unsigned char)(0x80 | (codepoint & 0x3F));
+        length = 2;
+    }
+    else if (codepoint < 0x10000)
+    {
+        bytes[0] = (unsigned char)(0xE0 | (codepoint >> 12));
+        bytes[1] = (unsigned char)(0x80 | ((codepoint >> 6) & 0x3F));
+        bytes[2] = (unsigned char)(0x80 | (codepoint & 0x3F));
+        length = 3;
+    }
+    else
+    {
+        bytes[0] = (unsigned char)(0xF0 | (codepoint >> 18));
+        bytes[1] = (unsigned char)(0x80 | ((codepoint >> 12) & 0x3F));
+        bytes[2] = (unsigned char)(0x80 | ((codepoint >> 6) & 0x3F));
+        bytes[3] = (unsigned char)(0x80 | (codepoint & 0x3F));
+        length = 4;
+    }
+
+    // Whole characters only, so a long title is cut cleanly.
+    if (text->used + length >= text->size)
+    {
+        text->full = 1;
+        return;
+    }
+    memcpy(text->out + text->used, bytes, length);
+    text->used += length;
+}
+
+static int tag_empty(const char* field)
+{
+    return field[0] == '\0';
+}
+
+// Text in an ID3 encoding: 0 Latin-1, 1 UTF-16 with BOM, 2 UTF-16BE, 3 UTF-8.
+// Stops at the first terminator; multi-value frames keep their first value.
+static void tag_decode(char* out, size_t size, int encoding, const unsigned char* in, size_t length)
+{
+    TagText text = { out, size, 0, 0 };
+
+    if (encoding == 1 || encoding == 2)
+    {
+        int big_endian = encoding == 2;
+
+        if (length >= 2 && in[0] == 0xFF && in[1] == 0xFE)
+            big_endian = 0, in += 2, length -= 2;
+        else if (length >= 2 && in[0] == 0xFE && in[1] == 0xFF)
+            big_endian = 1, in += 2, length -= 2;
+
+        for (size_t i = 0; i + 1 < length && !text.full; i += 2)
+        {
+            unsigned unit = big_endian ? (unsigned)(in[i] << 8 | in[i + 1]) : (unsigned)(in[i + 1] << 8 | in[i]);
+            if (unit == 0)
+                break;
+            if (unit >= 0xD800 && unit < 0xDC00 && i + 3 < length)
+            {
+                unsigned low = big_endian ? (unsigned)(in[i + 2] << 8 | in[i + 3]) : (unsigned)(in[i + 3] << 8 | in[i + 2]);
+                if (low >= 0xDC00 && low < 0xE000)
+                {
+                    unit = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+                    i += 2;
+                }
+            }
+            tag_put(&text, unit);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < length && in[i] != 0 && !text.full; i++)
+        {
+            if (encoding == 3 || in[i] < 0x80)
+            {
+                // UTF-8 goes across a run at a time.
+                size_t run = i;
+                while (run < length && in[run] != 0 && (encoding == 3 || in[run] < 0x80))
+                    run++;
+                size_t copy = run - i;
+                if (text.used + copy >= size)
+                {
+                    copy = size - 1 - text.used;
+                    while (copy > 0 && (in[i + copy] & 0xC0) == 0x80)
+                        copy--;
+                    memcpy(out + text.used, in + i, copy);
+                    text.used += copy;
+                    text.full = 1;
+                    break;
+                }
+                memcpy(out + text.used, in + i, copy);
+                text.used += copy;
+                i = run - 1;
+            }
+            else
+            {
+                tag_put(&text, in[i]);
+            }
+        }
+    }
+
+    // Trailing spaces pad ID3v1 fields and creep into others.
+    while (text.used > 0 && out[text.used - 1] == ' ')
+        text.used--;
+    out[text.used] = '\0';
+}
+
+static int tag_track_number(const unsigned char* in, size_t length)
+{
+    int track = 0;
+    size_t i = 0;
+
+    while (i < length && in[i] == ' ')
+        i++;
+    for (; i < length && in[i] >= '0' && in[i] <= '9' && track < 100000; i++)
+        track = track * 10 + (in[i] - '0');
+    return track;
+}
+
+static unsigned tag_be32(const unsigned char* p)
+{
+    return (unsigned)p[0] << 24 | (unsigned)p[1] << 16 | (unsigned)p[2] << 8 | p[3];
+}
+
+static unsigned tag_le32(const unsigned char* p)
+{
+    return (unsigned)p[3] << 24 | (unsigned)p[2] << 16 | (unsigned)p[1] << 8 | p[0];
+}
+
+static unsigned tag_syncsafe(const unsigned char* p)
+{
+    return (unsigned)(p[0] & 0x7F) << 21 | (unsigned)(p[1] & 0x7F) << 14 | (unsigned)(p[2] & 0x7F) << 7 | (p[3] & 0x7F);
+}
+
+static void tag_id3_frame(TrackTags* tags, const char* id, const unsigned char* body, size_t size)
+{
+    char* field = NULL;
+
+    if (size < 2)
+        return;
+    if (memcmp(id, "TIT2", 4) == 0 || memcmp(id, "TT2", 4) == 0)
+        field = tags->title;
+    else if (memcmp(id, "TPE1", 4) == 0 || memcmp(id, "TP1", 4) == 0)
+        field = tags->artist;
+    else if (memcmp(id, "TALB", 4) == 0 || memcmp(id, "TAL", 4) == 0)
+        field = tags->album;
+    else if ((memcmp(id, "TRCK", 4) == 0 || memcmp(id, "TRK", 4) == 0) && tags->track == 0)
+    {
+        // The number is ASCII in every encoding but UTF-16.
+        char number[16];
+        tag_decode(number, sizeof(number), body[0], body + 1, size - 1);
+        tags->track = tag_track_number((const unsigned char*)number, strlen(number));
+        return;
+    }
+
+    if (field != NULL && tag_empty(field))
+        tag_decode(field, TAG_TEXT, body[0], body + 1, size - 1);
+}
+
+// Returns the tag's size, including its header and footer, or 0 if data
+// doesn't start with one.
+static size_t tags_id3v2(const unsigned char* data, size_t size, TrackTags* tags)
+{
+    if (size < 10 || memcmp(data, "ID3", 3) != 0 || data[3] < 2 || data[3] > 4)
+        return 0;
+
+    int version = data[3];
+    int flags = data[5];
+    size_t length = tag_syncsafe(data + 6);
+    size_t total = 10 + length + ((flags & 0x10) ? 10 : 0);
+    const unsigned char* p = data + 10;
+    const unsigned char* end = data + 10 + (length < size - 10 ? length : size - 10);
+    size_t header = version == 2 ? 6 : 10;
+
+    // Whole-tag unsynchronisation would mean undoing it into a copy; such tags
+    // are rare enough to leave to ID3v1.
+    if (version < 4 && (flags & 0x80))
+        return total;
+    if (flags & 0x40)
+    {
+        if ((size_t)(end - p) < 4)
+            return total;
+        size_t extended = version == 3 ? tag_be32(p) + 4 : tag_syncsafe(p);
+        if (extended > (size_t)(end - p))
+            return total;
+        p += extended;
+    }
+
+    while ((size_t)(end - p) >= header && p[0] != 0)
+    {
+        char id[5] = { 0 };
+        size_t frame;
+        int frame_flags = 0;
+
+        memcpy(id, p, version == 2 ? 3 : 4);
+        if (version == 2)
+            frame = (size_t)p[3] << 16 | (size_t)p[4] << 8 | p[5];
+        else if (version == 3)
+            frame = tag_be32(p + 4), frame_flags = p[9];
+        else
+            frame = tag_syncsafe(p + 4), frame_flags = p[9];
+
+        if (frame > (size_t)(end - p) - header)
+            break;
+
+        const unsigned char* body = p + header;
+        size_t body_size = frame;
+        int skip = 0;
+
+        if (version == 3)
+            skip = (frame_flags & 0xC0) != 0;          // compressed or encrypted
+        else if (version == 4)
+        {
+            skip = (frame_flags & 0x0E) != 0;          // compressed, encrypted or unsynchronised
+            if (!skip && (frame_flags & 0x01) && body_size >= 4)
+                body += 4, body_size -= 4;             // data length indicator
+        }
+        if (!skip && id[0] == 'T')
+            tag_id3_frame(tags, id, body, body_size);
+
+        p += header + frame;
+    }
+
+    return total;
+}
+
+static void tags_id3v1(const unsigned char* data, size_t size, TrackTags* tags)
+{
+    if (size < 128)
+        return;
+
+    const unsigned char* tag = data + size - 128;
+    if (memcmp(tag, "TAG", 3) != 0)
+        return;
+
+    if (tag_empty(tags->title))
+        tag_decode(tags->title, TAG_TEXT, 0, tag + 3, 30);
+    if (tag_empty(tags->artist))
+        tag_decode(tags->artist, TAG_TEXT, 0, tag + 33, 30);
+    if (tag_empty(tags->album))
+        tag_decode(tags->album, TAG_TEXT, 0, tag + 63, 30);
+    // ID3v1.1 keeps the track in the last byte of the comment.
+    if (tags->track == 0 && tag[125] == 0 && tag[126] != 0)
+        tags->track = tag[126];
+}
+
+// A Vorbis comment block: vendor string, then KEY=value entries. Stops
+// quietly where the data runs out, which lets a truncated copy still count.
+static void tags_vorbis_comment(const unsigned char* data, size_t size, TrackTags* tags)
+{
+    if (size < 8)
+        return;
+
+    size_t at = 4 + (size_t)tag_le32(data);
+    if (at > size - 4)
+        return;
+    unsigned count = tag_le32(data + at);
+    at += 4;
+
+    for (unsigned i = 0; i < count && size - at >= 4; i++)
+    {
+        size_t length = tag_le32(data + at);
+        const unsigned char* entry = data + at + 4;
+        at += 4;
+        if (length > size - at)
+            break;
+        at += length;
+
+        const unsigned char* equals = memchr(entry, '=', length);
+        if (equals == NULL)
+            continue;
+        size_t key = (size_t)(equals - entry);
+        const unsigned char* value = equals + 1;
+        size_t value_length = length - key - 1;
+        char* field = NULL;
+
+        if (key == 5 && strncasecmp((const char*)entry, "TITLE", 5) == 0)
+            field = tags->title;
+        else if (key == 6 && strncasecmp((const char*)entry, "ARTIST", 6) == 0)
+            field = tags->artist;
+        else if (key == 5 && strncasecmp((const char*)entry, "ALBUM", 5) == 0)
+            field = tags->album;
+        else if (key == 11 && strncasecmp((const char*)entry, "TRACKNUMBER", 11) == 0 && tags->track == 0)
+            tags->track = tag_track_number(value, value_length);
+
+        if (field != NULL && tag_empty(field))
+            tag_decode(field, TAG_TEXT, 3, value, value_length);
+    }
+}
+
+static void tags_flac(const unsigned char* data, size_t size, TrackTags* tags)
+{
+    size_t at = 4;
+
+    while (size - at >= 4)
+    {
+        int last = data[at] & 0x80;
+        int type = data[at] & 0x7F;
+        size_t length = (size_t)data[at + 1] << 16 | (size_t)data[at + 2] << 8 | data[at + 3];
+
+        at += 4;
+        if (length > size - at)
+            break;
+        if (type == 4)
+        {
+            tags_vorbis_comment(data + at, length, tags);
+            break;
+        }
+        if (last)
+            break;
+        at += length;
+    }
+}
+
+static void tags_ogg_packet(const unsigned char* packet, size_t length, TrackTags* tags)
+{
+    if (length >= 7 && memcmp(packet, "\x03vorbis", 7) == 0)
+        tags_vorbis_comment(packet + 7, length - 7, tags);
+    else if (length >= 8 && memcmp(packet, "OpusTags", 8) == 0)
+        tags_vorbis_comment(packet + 8, length - 8, tags);
+}
+
+// The comment header is the stream's second packet. It is parsed where it
+// lies when it fits in one page, and copied together only when it doesn't.
+static void tags_ogg(const unsigned char* data, size_t size, TrackTags* tags)
+{
+    unsigned char* joined = NULL;
+    size_t joined_length = 0;
+    int packet = 0;
+    size_t at = 0;
+
+    for (int page = 0; page < TAG_OGG_PAGES && size - at >= 27 && memcmp(data + at, "OggS", 4) == 0; page++)
+    {
+        int segments = data[at + 26];
+        const unsigned char* lacing = data + at + 27;
+        const unsigned char* body = lacing + segments;
+
+        if ((size_t)(body - data) > size)
+            break;
+
+        size_t body_size = 0;
+        for (int s = 0; s < segments; s++)
+            body_size += lacing[s];
+        if (body_size > size - (size_t)(body - data))
+            break;
+
+        size_t start = 0;
+        size_t end = 0;
+        for (int s = 0; s < segments; s++)
+        {
+            end += lacing[s];
+            if (lacing[s] == 255)
+                continue;
+
+            if (packet == 1)
+            {
+                if (joined == NULL)
+                    tags_ogg_packet(body + start, end - start, tags);
+                else
+                {
+                    size_t copy = end - start;
+                    if (copy > TAG_OGG_COPY - joined_length)
+                        copy = TAG_OGG_COPY - joined_length;
+                    memcpy(joined + joined_length, body + start, copy);
+                    tags_ogg_packet(joined, joined_length + copy, tags);
+                }
+                free(joined);
+                return;
+            }
+            packet++;
+            start = end;
+        }
+
+        // The packet goes on into the next page.
+        if (packet == 1 && end > start)
+        {
+            if (joined == NULL && (joined = malloc(TAG_OGG_COPY)) == NULL)
+                return;
+            size_t copy = end - start;
+            if (copy > TAG_OGG_COPY - joined_length)
+                copy = TAG_OGG_COPY - joined_length;
+            memcpy(joined + joined_length, body + start, copy);
+            joined_length += copy;
+        }
+
+        at = (size_t)(body - data) + body_size;
+    }
+
+    // Ran out before the packet ended: whatever was gathered is still worth reading.
+    if (joined != NULL)
+        tags_ogg_packet(joined, joined_length, tags);
+    free(joined);
+}
+
+int tags_read(const char* path, TrackTags* tags)
+{
+    struct stat info;
+    int fd;
+
+    memset(tags, 0, sizeof(*tags));
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size < 4)
+    {
+        close(fd);
+        return -1;
+    }
+
+    size_t size = (size_t)info.st_size;
+    const unsigned char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return -1;
+
+    // Only the pages holding tags are ever touched.
+    size_t offset = tags_id3v2(data, size, tags);
+    if (offset < size && size - offset >= 4)
+    {
+        if (memcmp(data + offset, "fLaC", 4) == 0)
+            tags_flac(data + offset, size - offset, tags);
+        else if (memcmp(data + offset, "OggS", 4) == 0)
+            tags_ogg(data + offset, size - offset, tags);
+    }
+    tags_id3v1(data, size, tags);
+
+    munmap((void*)data, size);
+    return tag_empty(tags->title) && tag_empty(tags->artist) && tag_empty(tags->album) && tags->track == 0 ? -1 : 0;
+}
+
+struct TagEntry
+{
+    char* path;
+    unsigned long long hash;
+    int state;                      // 0 queued, 1 read with tags, -1 read without
+    TrackTags tags;
+};
+
+static unsigned long long tag_hash(const char* path)
+{
+    unsigned long long hash = 1469598103934665603ULL;
+    for (const unsigned char* p = (const unsigned char*)path; *p; p++)
+        hash = (hash ^ *p) * 1099511628211ULL;
+    return hash;
+}
+
+static TagEntry** tag_reader_slot(TagReader* reader, const char* path, unsigned long long hash)
+{
+    size_t mask = reader->capacity - 1;
+    size_t i = (size_t)hash & mask;
+
+    while (reader->table[i] != NULL &&
+           (reader->table[i]->hash != hash || strcmp(reader->table[i]->path, path) != 0))
+        i = (i + 1) & mask;
+    return &reader->table[i];
+}
+
+static int tag_reader_grow(TagReader* reader)
+{
+    size_t capacity = reader->capacity * 2;
+    TagEntry** table = calloc(capacity, sizeof(*table));
+    TagEntry** old = reader->table;
+    size_t old_capacity = reader->capacity;
+
+    if (table == NULL)
+        return -1;
+    reader->table = table;
+    reader->capacity = capacity;
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if (old[i] != NULL)
+            *tag_reader_slot(reader, old[i]->path, old[i]->hash) = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+static int tag_reader_enqueue(TagReader* reader, TagEntry* entry)
+{
+    if (reader->queue_count == reader->queue_capacity)
+    {
+        size_t capacity = reader->queue_capacity * 2;
+        TagEntry** queue = malloc(capacity * sizeof(*queue));
+        if (queue == NULL)
+            return -1;
+        for (size_t i = 0; i < reader->queue_count; i++)
+            queue[i] = reader->queue[(reader->queue_head + i) % reader->queue_capacity];
+        free(reader->queue);
+        reader->queue = queue;
+        reader->queue_capacity = capacity;
+        reader->queue_head = 0;
+    }
+    reader->queue[(reader->queue_head + reader->queue_count) % reader->queue_capacity] = entry;
+    reader->queue_count++;
+    return 0;
+}
+
+static void* tag_reader_thread(void* arg)
+{
+    TagReader* reader = (TagReader*)arg;
+
+    pthread_mutex_lock(&reader->lock);
+    while (!reader->quit)
+    {
+        if (reader->queue_count == 0)
+        {
+            pthread_cond_wait(&reader->wake, &reader->lock);
+            continue;
+        }
+
+        TagEntry* entry = reader->queue[reader->queue_head];
+        reader->queue_head = (reader->queue_head + 1) % reader->queue_capacity;
+        reader->queue_count--;
+        pthread_mutex_unlock(&reader->lock);
+
+        // Entries are never freed while the reader runs, so the path is safe
+        // to use unlocked; the result goes in under the lock.
+        TrackTags tags;
+        int found = tags_read(entry->path, &tags) == 0;
+
+        pthread_mutex_lock(&reader->lock);
+        entry->tags = tags;
+        entry->state = found ? 1 : -1;
+        __atomic_store_n(&reader->files_read, reader->files_read + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&reader->lock);
+    return NULL;
+}
+
+int tag_reader_start(TagReader* reader)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->capacity = 1024;
+    reader->table = calloc(reader->capacity, sizeof(*reader->table));
+    reader->queue_capacity = 256;
+    reader->queue = malloc(reader->queue_capacity * sizeof(*reader->queue));
+    if (reader->table == NULL || reader->queue == NULL)
+    {
+        free(reader->table);
+        free(reader->queue);
+        return -1;
+    }
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->wake, NULL);
+
+    for (int i = 0; i < TAG_READER_THREADS; i++)
+    {
+        if (pthread_create(&reader->threads[i], NULL, tag_reader_thread, reader) != 0)
+            break;
+        reader->thread_count++;
+    }
+    if (reader->thread_count == 0)
+    {
+        tag_reader_stop(reader);
+        return -1;
+    }
+    return 0;
+}
+
+void tag_reader_stop(TagReader* reader)
+{
+    if (reader->table == NULL)
+        return;
+
+    pthread_mutex_lock(&reader->lock);
+    reader->quit = 1;
+    pthread_cond_broadcast(&reader->wake);
+    pthread_mutex_unlock(&reader->lock);
+    for (int i = 0; i < reader->thread_count; i++)
+        pthread_join(reader->threads[i], NULL);
+
+    for (size_t i = 0; i < reader->capacity; i++)
+    {
+        if (reader->table[i] != NULL)
+        {
+            free(reader->table[i]->path);
+            free(reader->table[i]);
+        }
+    }
+    free(reader->table);
+    free(reader->queue);
+    pthread_cond_destroy(&reader->wake);
+    pthread_mutex_destroy(&reader->lock);
+    reader->table = NULL;
+}
+
+void tag_reader_request(TagReader* reader, const char* path)
+{
+    unsigned long long hash = tag_hash(path);
+
+    pthread_mutex_lock(&reader->lock);
+    if ((reader->count + 1) * 4 > reader->capacity * 3 && tag_reader_grow(reader) != 0)
+    {
+        pthread_mutex_unlock(&reader->lock);
+        return;
+    }
+
+    TagEntry** slot = tag_reader_slot(reader, path, hash);
+    if (*slot == NULL)
+    {
+        TagEntry* entry = calloc(1, sizeof(*entry));
+        if (entry != NULL && (entry->path = strdup(path)) != NULL && tag_reader_enqueue(reader, entry) == 0)
+        {
+            entry->hash = hash;
+            *slot = entry;
+            reader->count++;
+            pthread_cond_signal(&reader->wake);
+        }
+        else if (entry != NULL)
+        {
+            free(entry->path);
+            free(entry);
+        }
+    }
+    pthread_mutex_unlock(&reader->lock);
+}
+
+int tag_reader_get(TagReader* reader, const char* path, TrackTags* tags)
+{
+    unsigned long long hash = tag_hash(path);
+    int found = 0;
+
+    pthread_mutex_lock(&reader->lock);
+    TagEntry* entry = *tag_reader_slot(reader, path, hash);
+    if (entry != NULL && entry->state == 1)
+    {
+        *tags = entry->tags;
+        found = 1;
+    }
+    pthread_mutex_unlock(&reader->lock);
+    return found;
+}
+
+unsigned long long tag_reader_progress(TagReader* reader)
+{
+    return __atomic_load_n(&reader->files_read, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,56 @@
+#ifndef TAGS_H
+#define TAGS_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+// Title, artist, album and track number from ID3v2 (2.2 to 2.4) and ID3v1,
+// FLAC VORBIS_COMMENT blocks, and Ogg Vorbis or Opus comment headers. The
+// file is memory mapped and parsed in place; only the four fields are copied
+// out, converted to UTF-8.
+
+#define TAG_TEXT 96
+#define TAG_READER_THREADS 2
+
+typedef struct
+{
+    char title[TAG_TEXT];
+    char artist[TAG_TEXT];
+    char album[TAG_TEXT];
+    int track;                      // 0 if unknown
+} TrackTags;
+
+// Returns 0 if any field was found, -1 if the file has no tags or can't be read.
+int tags_read(const char* path, TrackTags* tags);
+
+// Reads tags on a few threads and keeps every result, keyed by path, so the
+// browser can ask for a whole directory and then look entries up every frame.
+typedef struct TagEntry TagEntry;
+
+typedef struct
+{
+    pthread_t threads[TAG_READER_THREADS];
+    int thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    TagEntry** table;               // open addressing on the path's hash
+    size_t capacity;
+    size_t count;
+    TagEntry** queue;               // ring of entries waiting for a thread
+    size_t queue_head;
+    size_t queue_count;
+    size_t queue_capacity;
+    unsigned long long files_read;
+    int quit;
+} TagReader;
+
+int tag_reader_start(TagReader* reader);
+void tag_reader_stop(TagReader* reader);
+// Queues path unless it has been seen before. Costs a hash lookup.
+void tag_reader_request(TagReader* reader, const char* path);
+// Returns 1 and fills tags once path has been read and had tags, else 0.
+int tag_reader_get(TagReader* reader, const char* path, TrackTags* tags);
+// Files read so far; a change means new results are in.
+unsigned long long tag_reader_progress(TagReader* reader);
+
+#endif
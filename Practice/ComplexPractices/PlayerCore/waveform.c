@@ -0,0 +1,307 @@
+#define _GNU_SOURCE
+#include "waveform.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <sys/stat.h>
+#ifdef __APPLE__
+#include <pthread/qos.h>
+#endif
+
+#define WAVEFORM_BLOCK_FRAMES 1024
+#define WAVEFORM_MAGIC 0x46575350u /* "PSWF" */
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t buckets;
+    uint64_t file_size;
+    int64_t file_mtime;
+    uint64_t total_frames;
+    char filepath[512];
+} WaveformCacheHeader;
+
+static uint64_t hash_string(const char* str)
+{
+    uint64_t hash = 1469598103934665603ULL;
+    while (*str)
+    {
+        hash ^= (unsigned char)*str++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void waveform_cache_path(const char* filepath, char* out, size_t out_size)
+{
+    const char* cache_home = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    char dir[448];
+
+    if (cache_home != NULL && cache_home[0] != '\0')
+        snprintf(dir, sizeof(dir), "%s/psfsp", cache_home);
+    else
+        snprintf(dir, sizeof(dir), "%s/.cache/psfsp", home ? home : "/tmp");
+
+    mkdir(dir, 0755);
+    snprintf(out, out_size, "%s/%016llx.wf", dir, (unsigned long long)hash_string(filepath));
+}
+
+static int waveform_cache_load(const char* cache_path, const char* filepath, const struct stat* st, WaveformOverview* overview)
+{
+    WaveformCacheHeader header;
+    FILE* file = fopen(cache_path, "rb");
+    int ok = 0;
+
+    if (file == NULL)
+        return -1;
+
+    if (fread(&header, sizeof(header), 1, file) == 1 &&
+        header.magic == WAVEFORM_MAGIC &&
+        header.buckets == WAVEFORM_BUCKETS &&
+        header.file_size == (uint64_t)st->st_size &&
+        header.file_mtime == (int64_t)st->st_mtime &&
+        strncmp(header.filepath, filepath, sizeof(header.filepath)) == 0)
+    {
+        ok = fread(overview->min, sizeof(overview->min), 1, file) == 1 &&
+             fread(overview->max, sizeof(overview->max), 1, file) == 1 &&
+             fread(overview->rms, sizeof(overview->rms), 1, file) == 1;
+        overview->total_frames = header.total_frames;
+    }
+    fclose(file);
+
+    return ok ? 0 : -1;
+}
+
+static void waveform_cache_store(const char* cache_path, const char* filepath, const struct stat* st, const WaveformOverview* overview)
+{
+    WaveformCacheHeader header;
+    char tmp_path[600];
+    FILE* file;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = WAVEFORM_MAGIC;
+    header.buckets = WAVEFORM_BUCKETS;
+    header.file_size = (uint64_t)st->st_size;
+    header.file_mtime = (int64_t)st->st_mtime;
+    header.total_frames = overview->total_frames;
+    snprintf(header.filepath, sizeof(header.filepath), "%s", filepath);
+
+    // Write then rename so a half-written file is never picked up.
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache_path);
+    file = fopen(tmp_path, "wb");
+    if (file == NULL)
+        return;
+
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(overview->min, sizeof(overview->min), 1, file);
+    fwrite(overview->max, sizeof(overview->max), 1, file);
+    fwrite(overview->rms, sizeof(overview->rms), 1, file);
+    if (fclose(file) == 0)
+        rename(tmp_path, cache_path);
+    else
+        remove(tmp_path);
+}
+
+// Decodes to mono at the file's own rate (no resampling) and keeps per-block
+// min/max/sum-of-squares, then folds the blocks into the fixed bucket count.
+static int waveform_compute(ma_vfs* vfs, const char* filepath, WaveformOverview* overview)
+{
+    ma_decoder decoder;
+    ma_decoder_config config = ma_decoder_config_init(ma_format_f32, 1, 0);
+    float samples[WAVEFORM_BLOCK_FRAMES];
+    float* block_min = NULL;
+    float* block_max = NULL;
+    double* block_sum = NULL;
+    size_t block_count = 0;
+    size_t block_cap = 0;
+    ma_uint64 total = 0;
+    ma_uint64 framesRead;
+
+    if (ma_decoder_init_vfs(vfs, filepath, &config, &decoder) != MA_SUCCESS)
+        return -1;
+
+    for (;;)
+    {
+        framesRead = 0;
+        ma_decoder_read_pcm_frames(&decoder, samples, WAVEFORM_BLOCK_FRAMES, &framesRead);
+        if (framesRead == 0)
+            break;
+
+        if (block_count == block_cap)
+        {
+            size_t cap = block_cap ? block_cap * 2 : 4096;
+            float* grown_min = realloc(block_min, cap * sizeof(float));
+            if (grown_min != NULL)
+                block_min = grown_min;
+            float* grown_max = grown_min != NULL ? realloc(block_max, cap * sizeof(float)) : NULL;
+            if (grown_max != NULL)
+                block_max = grown_max;
+            double* grown_sum = grown_max != NULL ? realloc(block_sum, cap * sizeof(double)) : NULL;
+            if (grown_sum == NULL)
+            {
+                ma_decoder_uninit(&decoder);
+                free(block_min);
+                free(block_max);
+                free(block_sum);
+                return -1;
+            }
+            block_sum = grown_sum;
+            block_cap = cap;
+        }
+
+        float lo = samples[0], hi = samples[0];
+        double sum = 0.0;
+        for (ma_uint64 i = 0; i < framesRead; i++)
+        {
+            if (samples[i] < lo) lo = samples[i];
+            if (samples[i] > hi) hi = samples[i];
+            sum += (double)samples[i] * samples[i];
+        }
+        block_min[block_count] = lo;
+        block_max[block_count] = hi;
+        block_sum[block_count] = sum;
+        block_count++;
+        total += framesRead;
+    }
+    ma_decoder_uninit(&decoder);
+
+    memset(overview, 0, sizeof(*overview));
+    overview->total_frames = total;
+    for (size_t b = 0; b < WAVEFORM_BUCKETS && block_count > 0; b++)
+    {
+        size_t first = b * block_count / WAVEFORM_BUCKETS;
+        size_t last = (b + 1) * block_count / WAVEFORM_BUCKETS;
+        if (last <= first)
+            last = first + 1;
+
+        float lo = block_min[first], hi = block_max[first];
+        double sum = 0.0;
+        for (size_t k = first; k < last; k++)
+        {
+            if (block_min[k] < lo) lo = block_min[k];
+            if (block_max[k] > hi) hi = block_max[k];
+            sum += block_sum[k];
+        }
+        overview->min[b] = lo;
+        overview->max[b] = hi;
+        overview->rms[b] = (float)sqrt(sum / ((double)(last - first) * WAVEFORM_BLOCK_FRAMES));
+    }
+
+    free(block_min);
+    free(block_max);
+    free(block_sum);
+
+    return block_count > 0 ? 0 : -1;
+}
+
+static void* waveform_thread(void* arg)
+{
+    WaveformWorker* worker = (WaveformWorker*)arg;
+    WaveformOverview* overview = malloc(sizeof(WaveformOverview));
+    char filepath[512];
+    char cache_path[512];
+    struct stat st;
+
+    if (overview == NULL)
+        return NULL;
+
+    // Keep the background pass from competing with the audio thread. Only
+    // this thread: setpriority would lower the whole process on macOS.
+#ifdef __APPLE__
+    pthread_set_qos_class_self_np(QOS_CLASS_BACKGROUND, 0);
+#elif defined(SCHED_IDLE)
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+
+    pthread_mutex_lock(&worker->lock);
+    while (!worker->quit)
+    {
+        if (!worker->has_request)
+        {
+            pthread_cond_wait(&worker->wake, &worker->lock);
+            continue;
+        }
+        snprintf(filepath, sizeof(filepath), "%s", worker->requested);
+        worker->has_request = MA_FALSE;
+        pthread_mutex_unlock(&worker->lock);
+
+        int ok = -1;
+        if (stat(filepath, &st) == 0)
+        {
+            waveform_cache_path(filepath, cache_path, sizeof(cache_path));
+            ok = waveform_cache_load(cache_path, filepath, &st, overview);
+            if (ok != 0)
+            {
+                ok = waveform_compute(worker->vfs, filepath, overview);
+                if (ok == 0)
+                    waveform_cache_store(cache_path, filepath, &st, overview);
+            }
+        }
+
+        pthread_mutex_lock(&worker->lock);
+        if (ok == 0 && strcmp(filepath, worker->requested) == 0)
+        {
+            worker->overview = *overview;
+            snprintf(worker->ready_path, sizeof(worker->ready_path), "%s", filepath);
+            worker->is_ready = MA_TRUE;
+        }
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    free(overview);
+    return NULL;
+}
+
+int waveform_worker_start(WaveformWorker* worker, ma_vfs* vfs)
+{
+    memset(worker, 0, sizeof(*worker));
+    worker->vfs = vfs;
+    pthread_mutex_init(&worker->lock, NULL);
+    pthread_cond_init(&worker->wake, NULL);
+    return pthread_create(&worker->thread, NULL, waveform_thread, worker) == 0 ? 0 : -1;
+}
+
+void waveform_worker_stop(WaveformWorker* worker)
+{
+    pthread_mutex_lock(&worker->lock);
+    worker->quit = MA_TRUE;
+    pthread_cond_signal(&worker->wake);
+    pthread_mutex_unlock(&worker->lock);
+    pthread_join(worker->thread, NULL);
+    pthread_mutex_destroy(&worker->lock);
+    pthread_cond_destroy(&worker->wake);
+}
+
+void waveform_request(WaveformWorker* worker, const char* filepath)
+{
+    pthread_mutex_lock(&worker->lock);
+    if (strcmp(worker->requested, filepath) != 0)
+    {
+        snprintf(worker->requested, sizeof(worker->requested), "%s", filepath);
+        worker->is_ready = MA_FALSE;
+        worker->has_request = MA_TRUE;
+        pthread_cond_signal(&worker->wake);
+    }
+    pthread_mutex_unlock(&worker->lock);
+}
+
+int waveform_snapshot(WaveformWorker* worker, WaveformOverview* overview)
+{
+    int result = -1;
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->is_ready && worker->overview.total_frames > 0)
+    {
+        *overview = worker->overview;
+        result = 0;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    return result;
+}
@@ -0,0 +1,41 @@
+#ifndef WAVEFORM_H
+#define WAVEFORM_H
+
+#include "miniaudio.h"
+#include <pthread.h>
+
+#define WAVEFORM_BUCKETS 1000
+
+typedef struct
+{
+    float min[WAVEFORM_BUCKETS];
+    float max[WAVEFORM_BUCKETS];
+    float rms[WAVEFORM_BUCKETS];
+    ma_uint64 total_frames;
+} WaveformOverview;
+
+// The overview is built on its own thread so opening a track never waits on it.
+typedef struct
+{
+    pthread_t thread;
+    ma_vfs* vfs;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    char requested[512];
+    char ready_path[512];
+    WaveformOverview overview;
+    ma_bool32 has_request;
+    ma_bool32 is_ready;
+    ma_bool32 quit;
+} WaveformWorker;
+
+// Files are decoded through vfs (NULL for plain stdio), so a recording or
+// fault-injecting layer sees this reader too.
+int waveform_worker_start(WaveformWorker* worker, ma_vfs* vfs);
+void waveform_worker_stop(WaveformWorker* worker);
+// Cheap to call every frame: only posts work when the track changes.
+void waveform_request(WaveformWorker* worker, const char* filepath);
+// Copies the overview for the requested track. Returns 0 once it is ready.
+int waveform_snapshot(WaveformWorker* worker, WaveformOverview* overview);
+
+#endif